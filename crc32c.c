@@ -0,0 +1,127 @@
+/*
+ * CRC-32C (Castagnoli) checksum
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ *
+ * Uses the SSE4.2 or ARMv8 CRC32 instructions when the CPU has them and
+ * falls back to a slicing-by-8 table implementation otherwise. The CPU
+ * check and table setup run once when the library is loaded.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "crc32c.h"
+
+#if defined __x86_64__ || defined __i386__
+ #include <nmmintrin.h>
+ #define CRC32C_X86 1
+#elif defined __aarch64__ && defined __ARM_FEATURE_CRC32
+ #include <arm_acle.h>
+ #define CRC32C_ARM 1
+#endif
+
+#define CRC32C_POLY 0x82f63b78	/* Reversed Castagnoli polynomial */
+
+static uint32_t crc_table[8][256];
+static int crc_hw;	/* Nonzero if hardware CRC32C is usable */
+
+__attribute__((constructor))
+static void crc32c_init(void)
+{
+	uint32_t crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = (uint32_t)i;
+		for (j = 0; j < 8; j++) crc = (crc >> 1) ^ (CRC32C_POLY & (0U - (crc & 1)));
+		crc_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++) {
+		crc = crc_table[0][i];
+		for (j = 1; j < 8; j++) {
+			crc = crc_table[0][crc & 0xff] ^ (crc >> 8);
+			crc_table[j][i] = crc;
+		}
+	}
+#ifdef CRC32C_X86
+	crc_hw = __builtin_cpu_supports("sse4.2");
+#elif defined CRC32C_ARM
+	crc_hw = 1;
+#endif
+	return;
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *buf, size_t len)
+{
+	uint32_t lo, hi;
+
+	while (len && ((uintptr_t)buf & 7)) {
+		crc = crc_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+	while (len >= 8) {
+		memcpy(&lo, buf, 4);
+		memcpy(&hi, buf + 4, 4);
+		/* Table lookups assume little-endian word loads */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		lo = __builtin_bswap32(lo);
+		hi = __builtin_bswap32(hi);
+#endif
+		lo ^= crc;
+		crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^
+			crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24] ^
+			crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff] ^
+			crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24];
+		buf += 8;
+		len -= 8;
+	}
+	while (len--) crc = crc_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *buf, size_t len)
+{
+ #ifdef __x86_64__
+	uint64_t crc64 = crc;
+	uint64_t w;
+
+	while (len >= 8) {
+		memcpy(&w, buf, 8);
+		crc64 = _mm_crc32_u64(crc64, w);
+		buf += 8;
+		len -= 8;
+	}
+	crc = (uint32_t)crc64;
+ #endif
+	while (len--) crc = _mm_crc32_u8(crc, *buf++);
+	return crc;
+}
+#elif defined CRC32C_ARM
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *buf, size_t len)
+{
+	uint64_t w;
+
+	while (len >= 8) {
+		memcpy(&w, buf, 8);
+		crc = __crc32cd(crc, w);
+		buf += 8;
+		len -= 8;
+	}
+	while (len--) crc = __crc32cb(crc, *buf++);
+	return crc;
+}
+#endif
+
+/* Update a CRC-32C with more data; start with crc = 0 */
+extern uint32_t lzjody_crc32c(uint32_t crc, const unsigned char * const buf, const size_t len)
+{
+	crc = ~crc;
+#if defined CRC32C_X86 || defined CRC32C_ARM
+	if (crc_hw) return ~crc32c_hw(crc, buf, len);
+#endif
+	return ~crc32c_sw(crc, buf, len);
+}
@@ -0,0 +1,17 @@
+/*
+ * CRC-32C (Castagnoli) checksum
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ *
+ * See crc32c.c for more information.
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+extern uint32_t lzjody_crc32c(uint32_t, const unsigned char * const, const size_t);
+
+#endif	/* CRC32C_H */
@@ -0,0 +1,284 @@
+/*
+ * Order-0 canonical Huffman coder for small blocks
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ *
+ * Encoded data layout:
+ *   32 bytes   bitmap of symbols present (bit n & 7 of byte n >> 3)
+ *   n nibbles  code length of each present symbol, high nibble first,
+ *              padded to a whole byte
+ *   bitstream  canonical codes packed LSB first
+ *
+ * Code lengths are limited to HUFF_MAX_BITS so the decoder can resolve
+ * every symbol with a single lookup in a table indexed by the next
+ * HUFF_MAX_BITS bits of input. A second table built from the first
+ * resolves two short codes per lookup, and the 64-bit bit buffer is
+ * refilled once for every four lookups.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "huffman.h"
+
+#define HUFF_TABLE_SIZE (1 << HUFF_MAX_BITS)
+
+/* Compute length-limited code lengths from symbol frequencies */
+static void huff_lengths(const unsigned int * const restrict freq,
+		unsigned char * const restrict len)
+{
+	/* Nodes 0-255 are symbols, 256+ are internal; leaves sorted by weight */
+	unsigned int weight[512];
+	uint16_t parent[512];
+	uint16_t leaf[256];
+	unsigned int nleaves = 0, i, j, next, lo, hi, a, b, kraft;
+	unsigned int leaf_pos, node_pos;
+	uint16_t t;
+
+	for (i = 0; i < 256; i++) {
+		len[i] = 0;
+		if (freq[i]) leaf[nleaves++] = (uint16_t)i;
+	}
+	if (nleaves == 0) return;
+	if (nleaves == 1) {
+		/* Codes must be complete; pair the symbol with an unused one */
+		len[leaf[0]] = 1;
+		len[leaf[0] ^ 1] = 1;
+		return;
+	}
+
+	/* Insertion sort leaves by frequency (at most 256 of them) */
+	for (i = 1; i < nleaves; i++) {
+		t = leaf[i];
+		for (j = i; j > 0 && freq[leaf[j - 1]] > freq[t]; j--) leaf[j] = leaf[j - 1];
+		leaf[j] = t;
+	}
+	for (i = 0; i < 256; i++) weight[i] = freq[i];
+
+	/* Two-queue Huffman construction: sorted leaves and internal nodes */
+	leaf_pos = 0;
+	node_pos = 256;
+	next = 256;
+	for (i = 0; i < nleaves - 1; i++) {
+		for (j = 0; j < 2; j++) {
+			if ((leaf_pos < nleaves) && ((node_pos >= next)
+					|| (weight[leaf[leaf_pos]] <= weight[node_pos])))
+				lo = leaf[leaf_pos++];
+			else lo = node_pos++;
+			if (j == 0) a = lo;
+			else b = lo;
+		}
+		weight[next] = weight[a] + weight[b];
+		parent[a] = (uint16_t)next;
+		parent[b] = (uint16_t)next;
+		next++;
+	}
+
+	/* Depths: the root is the last node created */
+	weight[next - 1] = 0;
+	for (i = next - 1; i > 256; i--) weight[i - 1] = weight[parent[i - 1]] + 1;
+	for (i = 0; i < nleaves; i++) {
+		hi = weight[parent[leaf[i]]] + 1;
+		len[leaf[i]] = (unsigned char)((hi > HUFF_MAX_BITS) ? HUFF_MAX_BITS : hi);
+	}
+
+	/* Clamping can oversubscribe the code space; lengthen the longest
+	 * codes still below the limit until the Kraft sum fits again */
+	kraft = 0;
+	for (i = 0; i < 256; i++) if (len[i]) kraft += 1U << (HUFF_MAX_BITS - len[i]);
+	while (kraft > HUFF_TABLE_SIZE) {
+		for (j = HUFF_MAX_BITS - 1; j > 0; j--) {
+			for (i = 0; i < nleaves; i++) {
+				if (len[leaf[i]] == j) {
+					len[leaf[i]]++;
+					kraft -= 1U << (HUFF_MAX_BITS - j - 1);
+					break;
+				}
+			}
+			if (i < nleaves) break;
+		}
+	}
+
+	/* That can overshoot and leave code space unused, which makes the
+	 * code incomplete; give it back by shortening the most frequent of
+	 * the longest codes. Each of those frees an amount that divides the
+	 * space left, so this always ends with a complete code. */
+	while (kraft < HUFF_TABLE_SIZE) {
+		hi = 0;
+		for (i = 0; i < nleaves; i++) if (len[leaf[i]] > hi) hi = len[leaf[i]];
+		for (i = nleaves; i > 0; i--) if (len[leaf[i - 1]] == hi) break;
+		len[leaf[i - 1]]--;
+		kraft += 1U << (HUFF_MAX_BITS - hi);
+	}
+	return;
+}
+
+/* Assign canonical codes (bit-reversed for LSB-first output)
+ * Fails unless the lengths describe a complete prefix code */
+static int huff_codes(const unsigned char * const restrict len,
+		uint16_t * const restrict code)
+{
+	unsigned int count[HUFF_MAX_BITS + 1];
+	unsigned int first[HUFF_MAX_BITS + 1];
+	unsigned int i, c, r, kraft = 0;
+
+	for (i = 0; i <= HUFF_MAX_BITS; i++) count[i] = 0;
+	for (i = 0; i < 256; i++) {
+		if (len[i] > HUFF_MAX_BITS) return -1;
+		count[len[i]]++;
+		if (len[i]) kraft += 1U << (HUFF_MAX_BITS - len[i]);
+	}
+	if (kraft != HUFF_TABLE_SIZE) return -1;
+	c = 0;
+	count[0] = 0;
+	for (i = 1; i <= HUFF_MAX_BITS; i++) {
+		c = (c + count[i - 1]) << 1;
+		first[i] = c;
+	}
+	for (i = 0; i < 256; i++) {
+		if (!len[i]) continue;
+		c = first[len[i]]++;
+		/* Reverse the code bits */
+		r = ((c & 0x5555) << 1) | ((c >> 1) & 0x5555);
+		r = ((r & 0x3333) << 2) | ((r >> 2) & 0x3333);
+		r = ((r & 0x0f0f) << 4) | ((r >> 4) & 0x0f0f);
+		r = ((r & 0x00ff) << 8) | ((r >> 8) & 0x00ff);
+		code[i] = (uint16_t)(r >> (16 - len[i]));
+	}
+	return 0;
+}
+
+/* Huffman-code "in" into "out"
+ * Returns the encoded size, or -1 if it would not fit in out_max bytes */
+extern int huff_encode(const unsigned char * const restrict in, const unsigned int in_len,
+		unsigned char * const restrict out, const unsigned int out_max)
+{
+	unsigned int freq[256];
+	unsigned char len[256];
+	uint16_t code[256];
+	unsigned int i, opos, nib = 0;
+	uint64_t buf = 0;
+	unsigned int bits = 0;
+
+	if (out_max < 33) return -1;
+	for (i = 0; i < 256; i++) freq[i] = 0;
+	for (i = 0; i < in_len; i++) freq[in[i]]++;
+	huff_lengths(freq, len);
+	if (huff_codes(len, code) < 0) return -1;
+
+	/* Symbol bitmap and code lengths */
+	for (i = 0; i < 32; i++) out[i] = 0;
+	opos = 32;
+	for (i = 0; i < 256; i++) {
+		if (!len[i]) continue;
+		out[i >> 3] |= (unsigned char)(1 << (i & 7));
+		if (opos >= out_max) return -1;
+		if (nib == 0) out[opos] = (unsigned char)(len[i] << 4);
+		else out[opos++] |= len[i];
+		nib ^= 1;
+	}
+	if (nib) opos++;
+
+	/* Bitstream */
+	for (i = 0; i < in_len; i++) {
+		buf |= (uint64_t)code[in[i]] << bits;
+		bits += len[in[i]];
+		while (bits >= 8) {
+			if (opos >= out_max) return -1;
+			out[opos++] = (unsigned char)buf;
+			buf >>= 8;
+			bits -= 8;
+		}
+	}
+	if (bits) {
+		if (opos >= out_max) return -1;
+		out[opos++] = (unsigned char)buf;
+	}
+	return (int)opos;
+}
+
+/* Decode exactly out_len symbols from in_len bytes of Huffman data
+ * Returns 0 on success or -1 if the data is corrupt */
+extern int huff_decode(const unsigned char * const restrict in, const unsigned int in_len,
+		unsigned char * const restrict out, const unsigned int out_len)
+{
+	uint16_t table[HUFF_TABLE_SIZE];	/* symbol | (length << 8) */
+	uint32_t pair[HUFF_TABLE_SIZE];	/* sym1 | sym2 << 8 | count << 16 | bits << 24 */
+	unsigned char len[256];
+	uint16_t code[256];
+	unsigned int i, j, l1, ipos, opos, nib = 0;
+	uint64_t buf = 0, w;
+	unsigned int bits = 0;
+	uint32_t p, p2, m;
+	uint16_t e;
+
+	if (in_len < 32) return -1;
+	ipos = 32;
+	for (i = 0; i < 256; i++) {
+		len[i] = 0;
+		if (!(in[i >> 3] & (1 << (i & 7)))) continue;
+		if (ipos >= in_len) return -1;
+		len[i] = (nib == 0) ? (unsigned char)(in[ipos] >> 4) : (unsigned char)(in[ipos++] & 0x0f);
+		nib ^= 1;
+		if (len[i] == 0) return -1;
+	}
+	if (nib) ipos++;
+	if (huff_codes(len, code) < 0) return -1;
+
+	/* Every table slot whose low bits match a code decodes to it; the
+	 * code is complete, so every slot gets filled */
+	for (i = 0; i < 256; i++) {
+		if (!len[i]) continue;
+		for (j = code[i]; j < HUFF_TABLE_SIZE; j += 1U << len[i])
+			table[j] = (uint16_t)(i | (len[i] << 8));
+	}
+	/* Second table: two symbols per lookup when both codes fit */
+	for (i = 0; i < HUFF_TABLE_SIZE; i++) {
+		e = table[i];
+		l1 = e >> 8;
+		p = (uint32_t)(e & 0xff) | (1U << 16) | (l1 << 24);
+		e = table[i >> l1];
+		p2 = (p & 0xff) | ((uint32_t)(e & 0xff) << 8) | (2U << 16) | ((l1 + (e >> 8)) << 24);
+		/* Branch-free select: this is unpredictable */
+		m = 0U - (uint32_t)((e >> 8) <= (HUFF_MAX_BITS - l1));
+		pair[i] = (p2 & m) | (p & ~m);
+	}
+
+	opos = 0;
+	/* Fast path: refill with one unaligned load, then four lookups of
+	 * up to two symbols each; at least 56 bits are buffered so no lookup
+	 * can run out of bits. Both symbol bytes are always stored. */
+#define HUFF_PAIR() do { \
+		p = pair[buf & (HUFF_TABLE_SIZE - 1)]; \
+		out[opos] = (unsigned char)p; \
+		out[opos + 1] = (unsigned char)(p >> 8); \
+		opos += (p >> 16) & 0xff; \
+		buf >>= (p >> 24); \
+		bits -= (p >> 24); \
+	} while (0)
+	while ((ipos + 8 <= in_len) && (opos + 8 <= out_len)) {
+		memcpy(&w, in + ipos, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		w = __builtin_bswap64(w);
+#endif
+		buf |= w << bits;
+		ipos += (63 - bits) >> 3;
+		bits |= 56;
+		HUFF_PAIR(); HUFF_PAIR(); HUFF_PAIR(); HUFF_PAIR();
+	}
+#undef HUFF_PAIR
+
+	/* Tail: refill byte by byte, one symbol at a time */
+	while (opos < out_len) {
+		while ((bits <= 56) && (ipos < in_len)) {
+			buf |= (uint64_t)in[ipos++] << bits;
+			bits += 8;
+		}
+		e = table[buf & (HUFF_TABLE_SIZE - 1)];
+		if ((unsigned int)(e >> 8) > bits) return -1;
+		out[opos++] = (unsigned char)e;
+		buf >>= (e >> 8);
+		bits -= (e >> 8);
+	}
+	return 0;
+}
@@ -0,0 +1,20 @@
+/*
+ * Order-0 canonical Huffman coder for small blocks
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ *
+ * See huffman.c for more information.
+ */
+
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+/* Longest code length; decoding tables have 1 << HUFF_MAX_BITS entries */
+#define HUFF_MAX_BITS 11
+
+extern int huff_encode(const unsigned char * const restrict, const unsigned int,
+		unsigned char * const restrict, const unsigned int);
+extern int huff_decode(const unsigned char * const restrict, const unsigned int,
+		unsigned char * const restrict, const unsigned int);
+
+#endif	/* HUFFMAN_H */
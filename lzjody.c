@@ -6,9 +6,16 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include "byteplane_xfrm.h"
+#include "crc32c.h"
+#include "huffman.h"
 #include "lzjody.h"
+#include "lzjody_ref.h"
+#include "lzjody_window.h"
+#include "sa_match.h"
 
 /* Debugging stuff */
 #ifndef DLOG
@@ -26,6 +33,11 @@
 #define P_LIT	0x20	/* Literal values */
 #define P_LZL	0x10	/* LZ match flag: size > 255 */
 #define P_EXT	0x00	/* Extended algorithms (ignore 0x10 and P_SHORT) */
+#define P_REF	0x09	/* Copy from the reference image (see lzjody_ref.c) */
+#define P_PATTERN 0x08	/* Repeated 2-, 4- or 8-byte pattern */
+#define P_FAR	0x07	/* Copy from the stream window (see lzjody_window.c) */
+#define P_SPLIT	0x06	/* Split stream layout (rest of block) */
+#define P_HUFF	0x05	/* Huffman coded command stream (rest of block) */
 #define P_PLANE 0x04	/* Byte plane transform */
 #define P_SEQ32	0x03	/* Sequential 32-bit values */
 #define P_SEQ16	0x02	/* Sequential 16-bit values */
@@ -40,6 +52,9 @@
 #define P_SHORT_MAX 0x0f
 #define P_SHORT_XMAX 0xff
 
+/* Commands that cover the whole block and only come first in it */
+#define P_WHOLE_BLOCK(c) ((((c) & (P_MASK | P_XMASK)) == P_HUFF) || (((c) & (P_MASK | P_XMASK)) == P_SPLIT))
+
 /* Minimum sizes for compression
  * These sizes are roughly calculated as follows:
  * control byte(s) + data byte(s) + other control byte(s)
@@ -58,12 +73,97 @@
 #define MIN_SEQ16_LENGTH 3
 #define MIN_SEQ8_LENGTH 4
 #define MIN_PLANE_LENGTH 8
+/* Pattern fills: periods 2, 4 and 8 all divide MAX_PATTERN, so any fill
+ * of MIN_PATTERN_LENGTH bytes repeats itself MAX_PATTERN bytes later */
+#define MIN_PATTERN_LENGTH 16
+#define MAX_PATTERN 8
+/* Shortest fill worth a command, in periods (more with O_SA_LZ) */
+#define PATTERN_MIN_REPEATS 4
+#define PATTERN_SA_REPEATS 6
+/* Command streams shorter than this never shrink under Huffman coding */
+#define MIN_HUFF_LENGTH 64
+
+/* Skip-ahead for O_ACCEL(n): the step past a position where nothing
+ * compressed is 1 + ((misses * n) >> ACCEL_MISS_SHIFT), where misses is
+ * the number of such positions since the last compressed item */
+#define ACCEL_MISS_SHIFT 5
+
+/* Cold finder tracking (see adapt_try()) */
+#define ADAPT_RLE 0
+#define ADAPT_SEQ8 1
+#define ADAPT_SEQ16 2
+#define ADAPT_SEQ32 3
+#define ADAPT_FINDERS 4
+#define ADAPT_COLD_MISSES 16
+
+/* Decoder output limit that never stops a block early */
+#define DECODE_ALL (LZJODY_BSIZE + 1)
+
+/* Byte plane retry filter (see lzjody_flush_literals())
+ * PLANE_MIN_COVER: estimated compressible bytes needed to attempt a retry
+ * PLANE_MARGINAL: retries covering less than 1/PLANE_MARGINAL of the run
+ * are skipped after PLANE_BACKOFF_FAILS consecutive failed retries, for up
+ * to PLANE_MAX_BACKOFF retries at a time */
+#define PLANE_MIN_COVER 6
+#define PLANE_MARGINAL 4
+#define PLANE_BACKOFF_FAILS 4
+#define PLANE_MAX_BACKOFF 32
+#define PLANE_HASH_BITS 10
+#define PLANE_CACHE_SIZE 64
 
 /* If a byte occurs more times than this in a block, use linear scanning */
 #ifndef MAX_LZ_BYTE_SCANS
  #define MAX_LZ_BYTE_SCANS 0x800
 #endif
 
+/* Scanner variant flag (never a caller option): the finders read their
+ * thresholds from the context instead of the constants above */
+#define O_TUNED 0x10000
+/* A finder threshold: the built-in constant, or the context's value in
+ * the O_TUNED variants; opts is a constant, so only one side is built */
+#define TUNED(d, opts, field, def) (((opts) & O_TUNED) ? (d)->ctx->params.field : (def))
+/* The same for code outside the scanner variants */
+#define CTX_PARAM(ctx, field, def) ((ctx)->tuned ? (ctx)->params.field : (def))
+
+/* Statistics collection compiles out completely unless requested */
+#ifdef LZJODY_STATS
+ #if defined __x86_64__ || defined __i386__
+  #include <x86intrin.h>
+  #define lzjody_cycles() __rdtsc()
+ #else
+  #include <time.h>
+static inline uint64_t lzjody_cycles(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+ #endif
+ #define STAT_START(t) t = lzjody_cycles()
+ #define STAT_TIME(d, field, t) do { if ((d)->stats) (d)->stats->field += lzjody_cycles() - (t); } while (0)
+ #define STAT_ADD(d, field, n) do { if ((d)->stats) (d)->stats->field += (n); } while (0)
+ #define STAT_CMD(d, type, n) do { if ((d)->stats) { \
+		(d)->stats->cmds[type]++; \
+		(d)->stats->cmd_bytes[type] += (n); } } while (0)
+ #define STAT_CALL(d, type, t) do { if ((d)->stats) { \
+		(d)->stats->calls[type]++; \
+		(d)->stats->cycles[type] += lzjody_cycles() - (t); } } while (0)
+#else
+ #define STAT_START(t)
+ #define STAT_TIME(d, field, t)
+ #define STAT_ADD(d, field, n)
+ #define STAT_CMD(d, type, n)
+ #define STAT_CALL(d, type, t)
+#endif /* LZJODY_STATS */
+
+/* The scanner and finders are written once and inlined into a separate
+ * variant for each option combination (see compress_scan()) */
+#ifdef __GNUC__
+ #define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+ #define ALWAYS_INLINE inline
+#endif
+
 struct comp_data_t {
 	const unsigned char *in;
 	unsigned char *out;
@@ -71,81 +171,124 @@ struct comp_data_t {
 	unsigned int opos;
 	unsigned int literals;
 	unsigned int literal_start;
+	unsigned int skipped;	/* Literal run was partly skipped by O_ACCEL */
 	unsigned int length;	/* Length of input data */
 	int options;	/* 0=exhaustive search, 1=stop at first match */
+	struct lzjody_ctx *ctx;	/* Context owning this data */
+	struct lzjody_stats *stats;	/* Statistics to update or NULL */
+	lzjody_trace_fn trace;	/* Trace function or NULL */
+	unsigned int cmd_opos;	/* Output position of the last control bytes */
 };
 
 struct lz_index_t {
-	uint16_t byte[256][MAX_LZ_BYTE_SCANS];	/* Lists of locations of each byte value */
-	uint16_t bytecnt[256];	/* How many offsets exist per byte */
+	uint16_t pos[LZJODY_BSIZE];	/* Locations of each byte value, grouped by value */
+	uint16_t start[257];	/* Byte c is at pos[start[c]] to pos[start[c + 1] - 1] */
+	struct sa_match_t sa;	/* Longest previous matches for O_SA_LZ */
 };
 
-static inline int lzjody_find_lz(struct comp_data_t * const restrict data,
-		const struct lz_index_t * const restrict idx);
-static inline int lzjody_find_rle(struct comp_data_t * const restrict data);
-static inline int lzjody_find_seq32(struct comp_data_t * const restrict data);
-static inline int lzjody_find_seq16(struct comp_data_t * const restrict data);
-static inline int lzjody_find_seq8(struct comp_data_t * const restrict data);
-
-static int compress_scan(struct comp_data_t * const restrict data,
-		const struct lz_index_t * const restrict idx)
-{
-	int err;
-
-	while (data->ipos < data->length) {
-		/* Scan for compressible items
-		 * Try each compressor in sequence; if none works,
-		 * just add the byte to the literal stream */
-		DLOG("[c_scan] ipos: 0x%x, opos: 0x%x\n", data->ipos, data->opos);
+/* One command as seen by lzjody_parse_command() */
+struct cmd_info_t {
+	unsigned int mode;
+	unsigned int next;	/* Next command (P_HUFF: start of coded data) */
+	unsigned int length;	/* Output bytes (P_HUFF: coded stream size) */
+	unsigned int src;	/* P_LZ: first output byte copied; else NO_SRC */
+};
+#define NO_SRC 0xffff
+
+/* All compressor working state; see lzjody.h */
+struct lzjody_ctx {
+	struct comp_data_t data;
+	struct lz_index_t idx;
+	/* Byte plane retry state for lzjody_flush_literals() */
+	struct comp_data_t d2;
+	struct lz_index_t idx2;
+	unsigned char lit_in[LZJODY_BSIZE];
+	unsigned char lit_out[LZJODY_BSIZE + 4];
+	/* Byte plane retry filter state */
+	uint16_t tri_pos[1 << PLANE_HASH_BITS];	/* Last position of each trigram hash */
+	uint16_t tri_gen[1 << PLANE_HASH_BITS];	/* Generation that wrote tri_pos */
+	uint16_t gen;	/* Current trigram table generation */
+	unsigned int plane_fails;	/* Consecutive unsuccessful retries */
+	unsigned int plane_skip;	/* Marginal retries left to skip */
+	uint32_t plane_cache[PLANE_CACHE_SIZE];	/* Runs known not to compress */
+	unsigned char xform_out[LZJODY_BSIZE];	/* Huffman coding and split layout scratch */
+	struct lzjody_window *window;	/* Stream window or NULL */
+	struct window_match_t far[WINDOW_MAX_MATCHES];	/* Window matches in this block */
+	const struct lzjody_ref *ref;	/* Reference image or NULL */
+	uint64_t ref_pos;	/* Stream offset of the next block */
+	struct ref_scratch_t ref_scratch;
+	struct ref_match_t refm[REF_MAX_MATCHES];	/* Reference matches in this block */
+	struct lzjody_stats *stats;
+	lzjody_trace_fn trace;	/* Trace function or NULL */
+	void *trace_arg;	/* Argument for the trace function */
+	uint32_t trace_block;	/* Blocks traced so far */
+	struct lzjody_params params;	/* Thresholds if tuned is set */
+	int tuned;	/* Use params instead of the built-in thresholds */
+};
 
-		err = lzjody_find_rle(data);
-		if (err < 0) return err;
-		if (err > 0) continue;
+/* Context used by lzjody_compress() and for NULL context arguments */
+static struct lzjody_ctx default_ctx;
 
-		err = lzjody_find_seq8(data);
-		if (err < 0) return err;
-		if (err > 0) continue;
-		err = lzjody_find_seq16(data);
-		if (err < 0) return err;
-		if (err > 0) continue;
-		err = lzjody_find_seq32(data);
-		if (err < 0) return err;
-		if (err > 0) continue;
+/* Report a command to the context's trace function */
+static void trace_command(const struct comp_data_t * const restrict data,
+		const unsigned int type, const unsigned int pos,
+		const unsigned int length, const uint32_t offset,
+		const unsigned int out, const unsigned int flags)
+{
+	struct lzjody_trace_event ev;
+
+	ev.block = data->ctx->trace_block;
+	ev.pos = (uint16_t)pos;
+	ev.length = (uint16_t)length;
+	ev.offset = offset;
+	ev.out = (uint16_t)out;
+	ev.type = (uint8_t)type;
+	ev.flags = (uint8_t)flags;
+	data->trace(data->ctx->trace_arg, &ev);
+	return;
+}
 
-		err = lzjody_find_lz(data, idx);
-		if (err < 0) return err;
-		if (err > 0) continue;
+#define TRACE(d, type, pos, len, off, out, fl) do { if ((d)->trace) \
+		trace_command((d), (type), (pos), (len), (off), (out), (fl)); } while (0)
+/* Output bytes of the command just written */
+#define CMD_OUT(d) ((d)->opos - (d)->cmd_opos)
+static int lzjody_parse_command(const unsigned char * const,
+		const unsigned int, unsigned int, struct cmd_info_t * const);
 
-		/* Nothing compressed; add to literal bytes */
-		if (data->literals == 0) data->literal_start = data->ipos;
-		data->literals++;
-		data->ipos++;
-	}
-	return 0;
-}
+static int compress_scan(struct comp_data_t * const restrict data,
+		const struct lz_index_t * const restrict idx);
 
 /* Build an array of byte values for faster LZ matching */
 static int index_bytes(const struct comp_data_t * const restrict data,
 		struct lz_index_t * const restrict idx)
 {
-	unsigned int pos = 0;
-	unsigned char c;
+	uint16_t cnt[256];
+	const unsigned int max_scans = CTX_PARAM(data->ctx, max_lz_byte_scans, MAX_LZ_BYTE_SCANS);
+	unsigned int pos, end, sum = 0;
+	int i;
 
-	/* Clear any existing index */
-	for (int i = 0; i < 256; i++) idx->bytecnt[i] = 0;
-
-	/* Read each byte and add its offset to its list */
 	if (data->length < MIN_LZ_MATCH) goto error_index;
-	while (pos < (data->length - MIN_LZ_MATCH)) {
-		c = *(data->in + pos);
-		idx->byte[c][idx->bytecnt[c]] = pos;
-		idx->bytecnt[c]++;
-/*		DLOG("pos 0x%x, len 0x%x, byte 0x%x, cnt 0x%x\n",
-				pos, data->length, c,
-				idx->bytecnt[c]); */
-		pos++;
-		if (idx->bytecnt[c] == MAX_LZ_BYTE_SCANS) break;
+	for (i = 0; i < 256; i++) cnt[i] = 0;
+
+	/* Count each byte value, stopping once any value has been seen
+	 * max_scans times; find_lz() scans linearly past that */
+	end = data->length - MIN_LZ_MATCH;
+	for (pos = 0; pos < end; pos++) {
+		if (++cnt[data->in[pos]] == max_scans) {
+			pos++;
+			break;
+		}
+	}
+	end = pos;
+
+	/* Lay the lists out back to back, then fill them in input order */
+	for (i = 0; i < 256; i++) {
+		idx->start[i] = (uint16_t)sum;
+		sum += cnt[i];
+		cnt[i] = idx->start[i];
 	}
+	idx->start[256] = (uint16_t)sum;
+	for (pos = 0; pos < end; pos++) idx->pos[cnt[data->in[pos]]++] = (uint16_t)pos;
 	return 0;
 
 error_index:
@@ -153,6 +296,18 @@ error_index:
 	return -1;
 }
 
+/* Prepare the LZ match finder selected by the options */
+static int index_block(const struct comp_data_t * const restrict data,
+		struct lz_index_t * const restrict idx)
+{
+	if (data->options & O_SA_LZ) {
+		if (data->length < MIN_LZ_MATCH) return index_bytes(data, idx);
+		sa_match_build(&idx->sa, data->in, data->length);
+		return 0;
+	}
+	return index_bytes(data, idx);
+}
+
 /* Write the control byte(s) that define data
  * type is the P_xxx value that determines the type of the control byte */
 static int lzjody_write_control(struct comp_data_t * const restrict data,
@@ -160,6 +315,7 @@ static int lzjody_write_control(struct comp_data_t * const restrict data,
 		const uint16_t value)
 {
 	if (value > 0x1000) goto error_value_too_large;
+	data->cmd_opos = data->opos;
 	DLOG("control: (i 0x%x, o 0x%x) t 0x%x, val 0x%x: ",
 			data->ipos, data->opos, type, value);
 	/* Extended control bytes */
@@ -225,6 +381,8 @@ static int lzjody_really_flush_literals(struct comp_data_t * const restrict data
 		data->opos++;
 		i++;
 	}
+	STAT_CMD(data, LZJODY_ST_LIT, data->literals);
+	TRACE(data, LZJODY_ST_LIT, data->literal_start, data->literals, 0, CMD_OUT(data), 0);
 	/* Reset literal counter*/
 	DLOG("flushed; new opos: 0x%x\n\n", data->opos);
 	data->literals = 0;
@@ -236,21 +394,73 @@ error_opos:
 	return -1;
 }
 
+/* Estimate how many bytes of a transposed literal run the finders could
+ * cover: equal or incrementing neighbors (RLE/seq8) and repeated trigrams
+ * (LZ). This only needs to be good enough to reject hopeless retries. */
+static unsigned int plane_estimate(struct lzjody_ctx * const restrict ctx,
+		const unsigned char * const restrict t, const unsigned int length)
+{
+	unsigned int i, h;
+	unsigned int covered = 0, run = 0;
+	unsigned int last_cover = 0;	/* End of the last counted LZ trigram */
+	int d, prev_d = -1;
+
+	/* Start a new trigram table generation instead of clearing it */
+	ctx->gen++;
+	if (ctx->gen == 0) {
+		for (i = 0; i < (1 << PLANE_HASH_BITS); i++) ctx->tri_gen[i] = 0;
+		ctx->gen = 1;
+	}
+
+	for (i = 1; i < length; i++) {
+		d = (int)t[i] - (int)t[i - 1];
+		if ((d == 0 || d == 1) && (d == prev_d)) {
+			run++;
+			/* Three bytes make a run worth counting */
+			covered += (run == 2) ? 3 : ((run > 2) ? 1 : 0);
+		} else run = 1;
+		prev_d = d;
+
+		if (i + 1 >= length) continue;
+		h = (((uint32_t)t[i - 1] << 16) | ((uint32_t)t[i] << 8) | t[i + 1]) * 2654435761U;
+		h >>= (32 - PLANE_HASH_BITS);
+		if ((ctx->tri_gen[h] == ctx->gen) && (i >= last_cover)
+				&& (t[ctx->tri_pos[h] - 1] == t[i - 1])
+				&& (t[ctx->tri_pos[h]] == t[i])
+				&& (t[ctx->tri_pos[h] + 1] == t[i + 1])) {
+			covered += 3;
+			last_cover = i + 3;
+		}
+		ctx->tri_gen[h] = ctx->gen;
+		ctx->tri_pos[h] = (uint16_t)i;
+	}
+	return covered;
+}
+
 /* Intercept a stream of literals and try byte plane transformation */
 static int lzjody_flush_literals(struct comp_data_t * const restrict data)
 {
-	static unsigned char lit_in[LZJODY_BSIZE];
-	static unsigned char lit_out[LZJODY_BSIZE + 4];
+	unsigned char * const lit_in = data->ctx->lit_in;
+	unsigned char * const lit_out = data->ctx->lit_out;
+	struct comp_data_t * const d2 = &data->ctx->d2;
+	struct lz_index_t * const idx = &data->ctx->idx2;
 	unsigned int i;
+	unsigned int hdr;	/* Space reserved for the P_PLANE control bytes */
+	int direct;	/* Compressing straight into data->out? */
+	unsigned int cover;	/* Estimated compressible bytes */
+	uint32_t key;	/* Failure cache key for this run */
+	struct lzjody_ctx * const ctx = data->ctx;
 	int err;
-	static struct comp_data_t d2;
-	static struct lz_index_t idx;
+#ifdef LZJODY_STATS
+	uint64_t t;
+#endif
 
 	/* For zero literals we'll just do nothing. */
 	if (data->literals == 0) return 0;
 
-	/* Handle blocking of recursive calls or very short literal runs */
-	if ((data->literals < MIN_PLANE_LENGTH)
+	/* Handle blocking of recursive calls, very short literal runs and
+	 * runs that O_ACCEL already judged incompressible */
+	if ((data->literals < CTX_PARAM(ctx, min_plane_length, MIN_PLANE_LENGTH)) || data->skipped
 			|| (data->options & O_REALFLUSH)) {
 		err = lzjody_really_flush_literals(data);
 		if (err < 0) return err;
@@ -258,64 +468,130 @@ static int lzjody_flush_literals(struct comp_data_t * const restrict data)
 	}
 
 
-	d2.in = lit_in;
-	d2.out = lit_out;
-	d2.ipos = 0;
-	d2.opos = 0;
-	d2.literals = 0;
-	d2.literal_start = 0;
-	d2.length = data->literals;
+	STAT_START(t);
+	/* Compress the transformed run straight into the output after room
+	 * for its control bytes unless the attempt could overrun the space
+	 * the caller provided (length + 4); if it doesn't pay off, the
+	 * bytes past data->opos are simply overwritten. Runs of up to
+	 * P_SHORT_XMAX + 3 bytes always get the short control form. */
+	hdr = (data->literals > (P_SHORT_XMAX + 3)) ? 3 : 2;
+	direct = (data->opos + hdr + data->literals + 2) <=
+		(data->length + ((data->options & O_NOPREFIX) ? 2 : 4));
+	d2->in = lit_in;
+	d2->out = direct ? (data->out + data->opos + hdr) : lit_out;
+	d2->ipos = 0;
+	d2->opos = 0;
+	d2->literals = 0;
+	d2->literal_start = 0;
+	d2->length = data->literals;
 	/* Don't allow recursive passes or compressed data size prefix */
-	d2.options = (data->options | O_REALFLUSH | O_NOPREFIX);
+	d2->options = (data->options | O_REALFLUSH | O_NOPREFIX);
+	d2->ctx = data->ctx;
+	/* Retry work is accounted to the byte plane, not the finders */
+	d2->stats = NULL;
+	d2->trace = NULL;
 
 	DLOG("flush_literals: 0x%x\n", data->literals);
 
 	/* Try to compress a literal run further */
 	DLOG("compress further: 0x%x @ 0x%x\n", data->literals, data->literal_start);
 	/* Make a transformed copy of the data */
+	/* Skip runs that recently failed to compress, e.g. duplicated data */
+	key = (lzjody_crc32c(0, data->in + data->literal_start, data->literals)
+			^ data->literals) | 1;
+	if (ctx->plane_cache[key % PLANE_CACHE_SIZE] == key) goto skip_retry;
+
 	err = byteplane_transform((data->in + data->literal_start),
 			lit_in, data->literals, 4);
 	if (err < 0) return err;
 
+	/* Reject hopeless retries cheaply, and after a string of failures
+	 * also back off from marginal ones for a while */
+	cover = plane_estimate(ctx, lit_in, data->literals);
+	if (cover < PLANE_MIN_COVER) goto skip_retry;
+	if ((cover * PLANE_MARGINAL) < data->literals && ctx->plane_skip > 0) {
+		ctx->plane_skip--;
+		goto skip_retry;
+	}
+
 	/* Load arrays for match speedup */
-	err = index_bytes(&d2, &idx);
+	err = index_block(d2, idx);
 	if (err < 0) return err;
 
 	/* Try to compress the data again */
-	err = compress_scan(&d2, &idx);
+	err = compress_scan(d2, idx);
 	if (err < 0) return err;
-	err = lzjody_really_flush_literals(&d2);
+	err = lzjody_really_flush_literals(d2);
 	if (err < 0) return err;
+	STAT_CALL(data, LZJODY_ST_PLANE, t);
 
 	/* If there was not enough of a size improvement, give up */
-	if ((d2.opos + 2) >= d2.length) {
+	if ((d2->opos + 2) >= d2->length) {
 		DLOG("[bp] No improvement, skipping (0x%x >= 0x%x)\n",
-				d2.opos,
-				d2.length);
+				d2->opos,
+				d2->length);
+		TRACE(data, LZJODY_ST_PLANE, data->literal_start, data->literals, 0,
+				hdr + d2->opos, LZJODY_TR_REJECTED);
+		ctx->plane_cache[key % PLANE_CACHE_SIZE] = key;
+		ctx->plane_fails++;
+		if (ctx->plane_fails >= PLANE_BACKOFF_FAILS) {
+			i = ctx->plane_fails - PLANE_BACKOFF_FAILS;
+			ctx->plane_skip = (i < 5) ? (1U << i) : PLANE_MAX_BACKOFF;
+		}
 		err = lzjody_really_flush_literals(data);
 		if (err < 0) return err;
 		return 0;
 	}
+	ctx->plane_fails = 0;
 
 	/* Dump the newly compressed data as a literal stream */
-	DLOG("Improvement: 0x%x -> 0x%x\n", d2.length, d2.opos);
-	err = lzjody_write_control(data, P_PLANE, d2.opos);
-	if (err < 0) return err;
+	DLOG("Improvement: 0x%x -> 0x%x\n", d2->length, d2->opos);
+	if (direct) {
+		/* Close the gap if a long run shrank enough for a short control */
+		if ((hdr == 3) && (d2->opos <= P_SHORT_XMAX)) {
+			for (i = 0; i < d2->opos; i++) *(d2->out + i - 1) = *(d2->out + i);
+		}
+		err = lzjody_write_control(data, P_PLANE, d2->opos);
+		if (err < 0) return err;
+		data->opos += d2->opos;
+	} else {
+		err = lzjody_write_control(data, P_PLANE, d2->opos);
+		if (err < 0) return err;
 
-	i = 0;
-	while (i < d2.opos) {
-		*(data->out + data->opos) = *(d2.out + i);
-		data->opos++;
-		i++;
+		i = 0;
+		while (i < d2->opos) {
+			*(data->out + data->opos) = *(d2->out + i);
+			data->opos++;
+			i++;
+		}
 	}
+	STAT_CMD(data, LZJODY_ST_PLANE, data->literals);
+	TRACE(data, LZJODY_ST_PLANE, data->literal_start, data->literals, 0, CMD_OUT(data), 0);
 	/* Reset literal counter*/
 	data->literals = 0;
 	return 0;
+
+skip_retry:
+	DLOG("[bp] Retry filtered (0x%x @ 0x%x)\n", data->literals, data->literal_start);
+	STAT_ADD(data, plane_skipped, 1);
+	STAT_CALL(data, LZJODY_ST_PLANE, t);
+	TRACE(data, LZJODY_ST_PLANE, data->literal_start, data->literals, 0, 0, LZJODY_TR_FILTERED);
+	return lzjody_really_flush_literals(data);
+}
+
+/* Flush pending literals before writing a command; retry passes
+ * (O_REALFLUSH) never attempt byte plane transformation */
+static ALWAYS_INLINE int lzjody_flush_before(struct comp_data_t * const restrict data,
+		const unsigned int opts)
+{
+	if (opts & O_REALFLUSH) return lzjody_really_flush_literals(data);
+	return lzjody_flush_literals(data);
 }
 
 /* Find best LZ data match for current input position */
-static inline int lzjody_find_lz(struct comp_data_t * const restrict data,
-		const struct lz_index_t * const restrict idx)
+static ALWAYS_INLINE int lzjody_find_lz(struct comp_data_t * const restrict data,
+		const struct lz_index_t * const restrict idx,
+		const unsigned int opts, const unsigned int big_literals)
 {
 	unsigned int scan = 0;
 	const unsigned char *m0, *m1, *m2;	/* pointers for matches */
@@ -327,28 +603,43 @@ static inline int lzjody_find_lz(struct comp_data_t * const restrict data,
 	int best_lz_start = 0;
 	unsigned int total_scans;
 	unsigned int offset;
-	unsigned int min_lz_match = MIN_LZ_MATCH;
-	int err;
-
 	/* If literal count > short form constraints, avoid data expansion */
-	if (data->literals > P_SHORT_MAX) min_lz_match++;
+	const unsigned int min_lz_match = TUNED(data, opts, min_lz_match, MIN_LZ_MATCH) + big_literals;
+	int err;
 
-	if (data->ipos >= (data->length - min_lz_match)) return 0;
+	if ((data->ipos + min_lz_match) >= data->length) return 0;
+
+	/* The suffix array engine already knows the longest match */
+	if (opts & O_SA_LZ) {
+		best_lz = idx->sa.len[data->ipos];
+		best_lz_start = idx->sa.pos[data->ipos];
+		if (best_lz > MAX_LZ_MATCH) best_lz = MAX_LZ_MATCH;
+		/* Stop at a window match (see lzjody_compress_ctx()) */
+		if (best_lz > in_remain) best_lz = in_remain;
+		/* LZ can't use 4-bit offsets after 0x0f bytes */
+		if ((best_lz < min_lz_match)
+				|| ((best_lz == min_lz_match) && (best_lz_start > 0x0f)))
+			best_lz = 0;
+		goto end_lz_matches;
+	}
 
 	m0 = data->in + data->ipos;
-	total_scans = idx->bytecnt[*m0];
+	total_scans = idx->start[*m0 + 1] - idx->start[*m0];
 
 	/* If the byte value does not exist anywhere, give up */
 	if (!total_scans) return 0;
 
 	/* Use linear matches if a byte happens too frequently */
-	if (total_scans >= MAX_LZ_BYTE_SCANS) goto lz_linear_match;
+	if (total_scans >= TUNED(data, opts, max_lz_byte_scans, MAX_LZ_BYTE_SCANS)) {
+		STAT_ADD(data, lz_linear, 1);
+		goto lz_linear_match;
+	}
 
 	while (scan < total_scans) {
 		/* Get offset of next byte */
 		length = 0;
 		m1 = m0;
-		offset = idx->byte[*m1][scan];
+		offset = idx->pos[idx->start[*m1] + scan];
 
 		/* Don't use offsets higher than input position */
 		if (offset >= data->ipos) {
@@ -403,7 +694,7 @@ end_lz_jump_match:
 			DLOG("LZ match: 0x%x : 0x%x (j)\n", offset, length);
 			best_lz_start = offset;
 			best_lz = length;
-			if (data->options & O_FAST_LZ) break;	/* Accept first LZ match */
+			if (opts & O_FAST_LZ) break;	/* Accept first LZ match */
 			if (done) break;
 			if (length >= MAX_LZ_MATCH) break;
 		}
@@ -456,7 +747,7 @@ end_lz_linear_match:
 			DLOG("LZ match: 0x%x : 0x%x (l)\n", scan, length);
 			best_lz_start = scan;
 			best_lz = length;
-			if (data->options & O_FAST_LZ) break;	/* Accept first LZ match */
+			if (opts & O_FAST_LZ) break;	/* Accept first LZ match */
 			if (done) break;
 			if (length >= MAX_LZ_MATCH) break;
 		}
@@ -467,7 +758,7 @@ end_lz_matches:
 	/* Write out the best LZ match, if any */
 	if (best_lz) {
 		DLOG("LZ compressed %x:%x bytes\n", best_lz_start, best_lz);
-		err = lzjody_flush_literals(data);
+		err = lzjody_flush_before(data, opts);
 		if (err < 0) return err;
 		if (best_lz < 256) {
 			err = lzjody_write_control(data, P_LZ, best_lz_start);
@@ -481,6 +772,8 @@ end_lz_matches:
 		/* Write LZ match length low byte */
 		*(data->out + data->opos) = (unsigned char)(best_lz & 0xff);
 		data->opos++;
+		STAT_CMD(data, LZJODY_ST_LZ, best_lz);
+		TRACE(data, LZJODY_ST_LZ, data->ipos, best_lz, best_lz_start, CMD_OUT(data), 0);
 		/* Skip matched input */
 		data->ipos += best_lz;
 		return 1;
@@ -493,28 +786,27 @@ err_remain_underflow:
 }
 
 /* Find best RLE data match for current input position */
-static inline int lzjody_find_rle(struct comp_data_t * const restrict data)
+static ALWAYS_INLINE int lzjody_find_rle(struct comp_data_t * const restrict data,
+		const unsigned int opts, const unsigned int big_literals)
 {
 	const unsigned char c = *(data->in + data->ipos);
 	unsigned int length = 0;
-	unsigned int big_literals = 0;
 	int err;
-
-	/* If literal count > short form constraints, avoid data expansion */
-	if (data->literals > P_SHORT_MAX) big_literals = 1;
 	while (((length + data->ipos) < data->length) && (*(data->in + data->ipos + length) == c)) {
 		length++;
 	}
-	if (length >= (MIN_RLE_LENGTH + big_literals)) {
+	if (length >= (TUNED(data, opts, min_rle_length, MIN_RLE_LENGTH) + big_literals)) {
 		DLOG("RLE: 0x%02x of 0x%02x at i %x, o %x\n",
 				length, c, data->ipos, data->opos);
-		err = lzjody_flush_literals(data);
+		err = lzjody_flush_before(data, opts);
 		if (err < 0) return err;
 		err = lzjody_write_control(data, P_RLE, length);
 		if (err < 0) return err;
 		/* Write repeated byte */
 		*(data->out + data->opos) = c;
 		data->opos++;
+		STAT_CMD(data, LZJODY_ST_RLE, length);
+		TRACE(data, LZJODY_ST_RLE, data->ipos, length, 0, CMD_OUT(data), 0);
 		/* Skip matched input */
 		data->ipos += length;
 		return 1;
@@ -522,40 +814,89 @@ static inline int lzjody_find_rle(struct comp_data_t * const restrict data)
 	return 0;
 }
 
+/* Find a fill of a repeating 2-, 4- or 8-byte pattern */
+static ALWAYS_INLINE int lzjody_find_pattern(struct comp_data_t * const restrict data,
+		const struct lz_index_t * const restrict idx,
+		const unsigned int opts, const unsigned int big_literals)
+{
+	const unsigned char * const p = data->in + data->ipos;
+	const unsigned int remain = data->length - data->ipos;
+	unsigned int period, length = MIN_PATTERN_LENGTH;
+	int err;
+
+	/* One 8-byte comparison rules out nearly every position */
+	if (remain < MIN_PATTERN_LENGTH) return 0;
+	if (*(const uint64_t *)p != *(const uint64_t *)(p + MAX_PATTERN)) return 0;
+	/* The shortest period makes the smallest command */
+	for (period = 2; period < MAX_PATTERN; period <<= 1)
+		if (*(const uint64_t *)p == *(const uint64_t *)(p + period)) break;
+	/* Runs of one byte are left to RLE even when it is skipped */
+	if ((period == 2) && (p[0] == p[1])) return 0;
+
+	while ((length + 8 <= remain) &&
+			(*(const uint64_t *)(p + length) == *(const uint64_t *)(p + length - period)))
+		length += 8;
+	while ((length < remain) && (p[length] == p[length - period])) length++;
+	if (length < (MIN_PATTERN_LENGTH + big_literals)) return 0;
+	/* A short fill costs about as much as one period of literals and an
+	 * LZ copy, which can share its bytes with what comes next; the suffix
+	 * array's longer matches make that more likely */
+	if (length < (period * ((opts & O_SA_LZ) ? PATTERN_SA_REPEATS : PATTERN_MIN_REPEATS)))
+		return 0;
+	/* An LZ copy of an earlier fill is smaller; the suffix array knows */
+	if ((opts & O_SA_LZ) && (idx->sa.len[data->ipos] + period + 2 >= length)) return 0;
+
+	DLOG("Pattern: 0x%x bytes of period %u at i %x, o %x\n",
+			length, period, data->ipos, data->opos);
+	err = lzjody_flush_before(data, opts);
+	if (err < 0) return err;
+	err = lzjody_write_control(data, P_PATTERN, length);
+	if (err < 0) return err;
+	*(data->out + data->opos) = (unsigned char)period;
+	memcpy(data->out + data->opos + 1, p, period);
+	data->opos += 1 + period;
+	STAT_CMD(data, LZJODY_ST_PATTERN, length);
+	TRACE(data, LZJODY_ST_PATTERN, data->ipos, length, period, CMD_OUT(data), 0);
+	data->ipos += length;
+	return 1;
+}
+
 /* Find sequential 32-bit values for compression */
-static inline int lzjody_find_seq32(struct comp_data_t * const restrict data)
+static ALWAYS_INLINE int lzjody_find_seq32(struct comp_data_t * const restrict data,
+		const unsigned int opts, const unsigned int big_literals)
 {
 	uint32_t num32;
 	uint32_t *m32 = (uint32_t *)((uintptr_t)data->in + (uintptr_t)data->ipos);
-	const uint32_t num_orig32 = *m32;
+	uint32_t num_orig32;
 	unsigned int seqcnt;
-	unsigned int big_literals = 0;
 	int err;
 
-	/* If literal count > short form constraints, avoid data expansion */
-	if (data->literals > P_SHORT_MAX) big_literals = 1;
+	/* Don't read a partial word past the end of the input */
+	if ((data->ipos + 3) >= data->length) return 0;
+	num_orig32 = *m32;
 
 	/* 32-bit sequences */
 	seqcnt = 0;
 	num32 = *m32;
 	/* Loop bounds check compensates for bit width of data elements */
-	while (*m32 == num32) {
-		if ((data->ipos + seqcnt + 3) >= data->length) break;
+	while (((data->ipos + seqcnt + 3) < data->length) && (*m32 == num32)) {
 		seqcnt += 4;
 		num32++;
 		m32++;
 	}
 	seqcnt >>= 2;
 
-	if (seqcnt >= (MIN_SEQ32_LENGTH + big_literals)) {
+	if (seqcnt >= (TUNED(data, opts, min_seq32_length, MIN_SEQ32_LENGTH) + big_literals)) {
 		DLOG("Seq(32): start 0x%x, 0x%x items\n", num_orig32, seqcnt);
-		err = lzjody_flush_literals(data);
+		err = lzjody_flush_before(data, opts);
 		if (err < 0) return err;
 		err = lzjody_write_control(data, P_SEQ32, seqcnt);
 		if (err < 0) return err;
 		*(uint32_t *)((uintptr_t)data->out + (uintptr_t)data->opos) = num_orig32;
 		data->opos += sizeof(uint32_t);
+		TRACE(data, LZJODY_ST_SEQ32, data->ipos, (seqcnt << 2), 0, CMD_OUT(data), 0);
 		data->ipos += (seqcnt << 2);
+		STAT_CMD(data, LZJODY_ST_SEQ32, seqcnt << 2);
 		return 1;
 	}
 
@@ -563,37 +904,39 @@ static inline int lzjody_find_seq32(struct comp_data_t * const restrict data)
 }
 
 /* Find sequential 16-bit values for compression */
-static inline int lzjody_find_seq16(struct comp_data_t * const restrict data)
+static ALWAYS_INLINE int lzjody_find_seq16(struct comp_data_t * const restrict data,
+		const unsigned int opts, const unsigned int big_literals)
 {
 	uint16_t num16;
 	uint16_t *m16 = (uint16_t *)((uintptr_t)data->in + (uintptr_t)data->ipos);
-	const uint16_t num_orig16 = *m16;
+	uint16_t num_orig16;
 	unsigned int seqcnt;
-	unsigned int big_literals = 0;
 	int err;
 
-	/* If literal count > short form constraints, avoid data expansion */
-	if (data->literals > P_SHORT_MAX) big_literals = 1;
+	/* Don't read a partial word past the end of the input */
+	if ((data->ipos + 1) >= data->length) return 0;
+	num_orig16 = *m16;
 
 	seqcnt = 0;
 	num16 = *m16;
 	/* Loop bounds check compensates for bit width of data elements */
-	while (*m16 == num16) {
-		if ((data->ipos + (seqcnt << 1) + 1) >= data->length) break;
+	while (((data->ipos + (seqcnt << 1) + 1) < data->length) && (*m16 == num16)) {
 		seqcnt++;
 		num16++;
 		m16++;
 	}
 
-	if (seqcnt >= (MIN_SEQ16_LENGTH + big_literals)) {
+	if (seqcnt >= (TUNED(data, opts, min_seq16_length, MIN_SEQ16_LENGTH) + big_literals)) {
 		DLOG("Seq(16): start 0x%x, 0x%x items\n", num_orig16, seqcnt);
-		err = lzjody_flush_literals(data);
+		err = lzjody_flush_before(data, opts);
 		if (err < 0) return err;
 		err = lzjody_write_control(data, P_SEQ16, seqcnt);
 		if (err < 0) return err;
 		*(uint16_t *)((uintptr_t)data->out + (uintptr_t)data->opos) = num_orig16;
 		data->opos += sizeof(uint16_t);
+		TRACE(data, LZJODY_ST_SEQ16, data->ipos, (seqcnt << 1), 0, CMD_OUT(data), 0);
 		data->ipos += (seqcnt << 1);
+		STAT_CMD(data, LZJODY_ST_SEQ16, seqcnt << 1);
 		return 1;
 	}
 
@@ -601,45 +944,537 @@ static inline int lzjody_find_seq16(struct comp_data_t * const restrict data)
 }
 
 /* Find sequential 8-bit values for compression */
-static inline int lzjody_find_seq8(struct comp_data_t * const restrict data)
+static ALWAYS_INLINE int lzjody_find_seq8(struct comp_data_t * const restrict data,
+		const unsigned int opts, const unsigned int big_literals)
 {
 	uint8_t num8;
 	uint8_t *m8 = (uint8_t *)((uintptr_t)data->in + (uintptr_t)data->ipos);
 	const uint8_t num_orig8 = *m8;
 	unsigned int seqcnt;
-	unsigned int big_literals = 0;
 	int err;
 
-	/* If literal count > short form constraints, avoid data expansion */
-	if (data->literals > P_SHORT_MAX) big_literals = 1;
-
 	seqcnt = 0;
 	num8 = *m8;
-	while (*m8 == num8) {
-		if ((data->ipos + seqcnt) >= data->length) break;
+	while (((data->ipos + seqcnt) < data->length) && (*m8 == num8)) {
 		seqcnt++;
 		num8++;
 		m8++;
 	}
 
-	if (seqcnt >= (MIN_SEQ8_LENGTH + big_literals)) {
+	if (seqcnt >= (TUNED(data, opts, min_seq8_length, MIN_SEQ8_LENGTH) + big_literals)) {
 		DLOG("Seq(8): start 0x%x, 0x%x items\n", num_orig8, seqcnt);
-		err = lzjody_flush_literals(data);
+		err = lzjody_flush_before(data, opts);
 		if (err < 0) return err;
 		err = lzjody_write_control(data, P_SEQ8, seqcnt);
 		if (err < 0) return err;
 		*(uint8_t *)((uintptr_t)data->out + (uintptr_t)data->opos) = num_orig8;
 		data->opos += sizeof(uint8_t);
+		TRACE(data, LZJODY_ST_SEQ8, data->ipos, seqcnt, 0, CMD_OUT(data), 0);
 		data->ipos += seqcnt;
+		STAT_CMD(data, LZJODY_ST_SEQ8, seqcnt);
 		return 1;
 	}
 	return 0;
 }
 
+/* Finder hit tracking: once one of the cheap finders has
+ * missed ADAPT_COLD_MISSES positions in a row, it is only called where a
+ * quick test of the next few bytes says it can possibly match, until it
+ * hits again. The test is exact, so output never changes; it just costs
+ * less than a finder call that is almost certain to fail, and more than
+ * nothing when the finder is hitting often. Skipping cold finders
+ * outright was tried and is slower: every position a skipped RLE or
+ * sequence finder would have taken falls through to the LZ search. */
+struct adapt_t {
+	unsigned int miss[ADAPT_FINDERS];	/* Consecutive misses */
+};
+
+/* Should finder n be called at this position? */
+static ALWAYS_INLINE int adapt_try(struct comp_data_t * const restrict data,
+		const struct adapt_t * const restrict ad, const unsigned int n)
+{
+	const unsigned char * const p = data->in + data->ipos;
+	const unsigned int remain = data->length - data->ipos;
+	int possible;
+
+	if (ad->miss[n] < ADAPT_COLD_MISSES) return 1;
+	switch (n) {
+		case ADAPT_RLE:
+			possible = (remain >= MIN_RLE_LENGTH) && (p[1] == p[0]) && (p[2] == p[0]);
+			break;
+		case ADAPT_SEQ8:
+			possible = (remain >= MIN_SEQ8_LENGTH) && (p[1] == (unsigned char)(p[0] + 1));
+			break;
+		case ADAPT_SEQ16:
+			possible = (remain >= (MIN_SEQ16_LENGTH << 1)) &&
+				(*(const uint16_t *)(p + 2) == (uint16_t)(*(const uint16_t *)p + 1));
+			break;
+		case ADAPT_SEQ32:
+		default:
+			possible = (remain >= (MIN_SEQ32_LENGTH << 2)) &&
+				(*(const uint32_t *)(p + 4) == *(const uint32_t *)p + 1);
+			break;
+	}
+	if (!possible) {
+		STAT_ADD(data, finder_skipped, 1);
+	}
+	return possible;
+}
+
+static ALWAYS_INLINE void adapt_result(struct adapt_t * const restrict ad,
+		const unsigned int n, const int hit)
+{
+	if (hit) ad->miss[n] = 0;
+	else ad->miss[n]++;
+	return;
+}
+
+/* Scan a block with all finders; opts is a constant in each variant */
+static ALWAYS_INLINE int compress_scan_tmpl(struct comp_data_t * const restrict data,
+		const struct lz_index_t * const restrict idx, const unsigned int opts)
+{
+	struct adapt_t ad = { { 0, 0, 0, 0 } };
+	const unsigned int accel = (data->options & O_ACCEL_MASK) >> O_ACCEL_SHIFT;
+	unsigned int misses = 0;	/* Positions tried since the last hit */
+	unsigned int step;
+	unsigned int big_literals;
+	int err;
+#ifdef LZJODY_STATS
+	uint64_t t;
+#endif
+
+	while (data->ipos < data->length) {
+		/* Scan for compressible items
+		 * Try each compressor in sequence; if none works,
+		 * just add the byte to the literal stream */
+		DLOG("[c_scan] ipos: 0x%x, opos: 0x%x\n", data->ipos, data->opos);
+
+		/* If literal count > short form constraints, every finder
+		 * needs one more byte of match to avoid data expansion */
+		big_literals = (data->literals > P_SHORT_MAX);
+
+		if (adapt_try(data, &ad, ADAPT_RLE)) {
+			STAT_START(t);
+			err = lzjody_find_rle(data, opts, big_literals);
+			STAT_CALL(data, LZJODY_ST_RLE, t);
+			if (err < 0) return err;
+			adapt_result(&ad, ADAPT_RLE, err);
+			if (err > 0) continue;
+		}
+
+		STAT_START(t);
+		err = lzjody_find_pattern(data, idx, opts, big_literals);
+		STAT_CALL(data, LZJODY_ST_PATTERN, t);
+		if (err < 0) return err;
+		if (err > 0) continue;
+
+		if (adapt_try(data, &ad, ADAPT_SEQ8)) {
+			STAT_START(t);
+			err = lzjody_find_seq8(data, opts, big_literals);
+			STAT_CALL(data, LZJODY_ST_SEQ8, t);
+			if (err < 0) return err;
+			adapt_result(&ad, ADAPT_SEQ8, err);
+			if (err > 0) continue;
+		}
+		if (adapt_try(data, &ad, ADAPT_SEQ16)) {
+			STAT_START(t);
+			err = lzjody_find_seq16(data, opts, big_literals);
+			STAT_CALL(data, LZJODY_ST_SEQ16, t);
+			if (err < 0) return err;
+			adapt_result(&ad, ADAPT_SEQ16, err);
+			if (err > 0) continue;
+		}
+		if (adapt_try(data, &ad, ADAPT_SEQ32)) {
+			STAT_START(t);
+			err = lzjody_find_seq32(data, opts, big_literals);
+			STAT_CALL(data, LZJODY_ST_SEQ32, t);
+			if (err < 0) return err;
+			adapt_result(&ad, ADAPT_SEQ32, err);
+			if (err > 0) continue;
+		}
+
+		STAT_START(t);
+		err = lzjody_find_lz(data, idx, opts, big_literals);
+		STAT_CALL(data, LZJODY_ST_LZ, t);
+		if (err < 0) return err;
+		if (err > 0) continue;
+
+		/* Nothing compressed; add to literal bytes, skipping further
+		 * ahead as the miss streak grows if acceleration is on */
+		if (data->literals == 0) {
+			data->literal_start = data->ipos;
+			data->skipped = 0;
+			misses = 0;
+		}
+		step = 1;
+		if (accel) {
+			step += (misses * accel) >> ACCEL_MISS_SHIFT;
+			if (step > (data->length - data->ipos)) step = data->length - data->ipos;
+			if (step > 1) data->skipped = 1;
+			misses++;
+		}
+		data->literals += step;
+		data->ipos += step;
+	}
+	return 0;
+}
+
+/* Specialized scanners: one per LZ engine for top-level passes and for
+ * byte plane retries (O_REALFLUSH), so no option is tested in the loops */
+#define SCAN_VARIANT(name, opts) \
+static int name(struct comp_data_t * const restrict data, \
+		const struct lz_index_t * const restrict idx) \
+{ \
+	return compress_scan_tmpl(data, idx, (opts)); \
+}
+SCAN_VARIANT(compress_scan_jump, 0)
+SCAN_VARIANT(compress_scan_fast, O_FAST_LZ)
+SCAN_VARIANT(compress_scan_sa, O_SA_LZ)
+SCAN_VARIANT(compress_scan_jump_rf, O_REALFLUSH)
+SCAN_VARIANT(compress_scan_fast_rf, O_FAST_LZ | O_REALFLUSH)
+SCAN_VARIANT(compress_scan_sa_rf, O_SA_LZ | O_REALFLUSH)
+SCAN_VARIANT(compress_scan_jump_t, O_TUNED)
+SCAN_VARIANT(compress_scan_fast_t, O_FAST_LZ | O_TUNED)
+SCAN_VARIANT(compress_scan_sa_t, O_SA_LZ | O_TUNED)
+SCAN_VARIANT(compress_scan_jump_rf_t, O_REALFLUSH | O_TUNED)
+SCAN_VARIANT(compress_scan_fast_rf_t, O_FAST_LZ | O_REALFLUSH | O_TUNED)
+SCAN_VARIANT(compress_scan_sa_rf_t, O_SA_LZ | O_REALFLUSH | O_TUNED)
+#undef SCAN_VARIANT
+
+/* Run the scanner variant matching the options (O_SA_LZ wins over
+ * O_FAST_LZ, which only affects the jump list engine) and whether the
+ * context has tuned thresholds */
+static int compress_scan(struct comp_data_t * const restrict data,
+		const struct lz_index_t * const restrict idx)
+{
+	if (data->ctx->tuned) {
+		if (data->options & O_REALFLUSH) {
+			if (data->options & O_SA_LZ) return compress_scan_sa_rf_t(data, idx);
+			if (data->options & O_FAST_LZ) return compress_scan_fast_rf_t(data, idx);
+			return compress_scan_jump_rf_t(data, idx);
+		}
+		if (data->options & O_SA_LZ) return compress_scan_sa_t(data, idx);
+		if (data->options & O_FAST_LZ) return compress_scan_fast_t(data, idx);
+		return compress_scan_jump_t(data, idx);
+	}
+	if (data->options & O_REALFLUSH) {
+		if (data->options & O_SA_LZ) return compress_scan_sa_rf(data, idx);
+		if (data->options & O_FAST_LZ) return compress_scan_fast_rf(data, idx);
+		return compress_scan_jump_rf(data, idx);
+	}
+	if (data->options & O_SA_LZ) return compress_scan_sa(data, idx);
+	if (data->options & O_FAST_LZ) return compress_scan_fast(data, idx);
+	return compress_scan_jump(data, idx);
+}
+
+/* Replace the block's command stream with a Huffman coded copy of it
+ * (a single P_HUFF command) if that is smaller. Literal bytes and the
+ * control, length and offset bytes are all coded with one table. */
+static int lzjody_huffman_block(struct comp_data_t * const restrict data)
+{
+	const unsigned int start = (data->options & O_NOPREFIX) ? 0 : 2;
+	const unsigned int inner = data->opos - start;
+	const unsigned int hdr = (inner > P_SHORT_XMAX) ? 3 : 2;
+	unsigned int i;
+	int size, err;
+#ifdef LZJODY_STATS
+	uint64_t t;
+#endif
+
+	if ((inner < MIN_HUFF_LENGTH) || (inner > LZJODY_BSIZE)) return 0;
+	STAT_START(t);
+	/* Must come out at least one byte smaller including the control */
+	size = huff_encode(data->out + start, inner, data->ctx->xform_out, inner - hdr - 1);
+	STAT_CALL(data, LZJODY_ST_HUFF, t);
+	if (size < 0) return 0;
+
+	DLOG("Huffman: 0x%x -> 0x%x\n", inner, size);
+	data->opos = start;
+	err = lzjody_write_control(data, P_HUFF, (uint16_t)inner);
+	if (err < 0) return err;
+	for (i = 0; i < (unsigned int)size; i++) *(data->out + data->opos + i) = data->ctx->xform_out[i];
+	data->opos += (unsigned int)size;
+	STAT_CMD(data, LZJODY_ST_HUFF, inner);
+	TRACE(data, LZJODY_ST_HUFF, 0, data->length, 0, CMD_OUT(data), 0);
+	return 0;
+}
+
+/* Rewrite the finished command stream in the split layout (O_SPLIT):
+ * a P_SPLIT command whose length is the number of commands, a 16-bit
+ * big-endian length of the argument stream, then the control bytes, the
+ * bytes every command carries after its control byte, and the literal
+ * bytes, each stream in one piece. Decoding then walks the control bytes
+ * one at a time and copies literals with memcpy(). The layout is a few
+ * bytes larger, so it is only kept if the block still shrinks. */
+static int lzjody_split_block(struct comp_data_t * const restrict data)
+{
+	const unsigned int start = (data->options & O_NOPREFIX) ? 0 : 2;
+	const unsigned int inner = data->opos - start;
+	const unsigned char * const in = data->out + start;
+	unsigned char * const tmp = data->ctx->xform_out;
+	struct cmd_info_t cmd;
+	unsigned int ipos, hdr, lit, ncmd = 0, nargs = 0, cpos, apos, lpos;
+	int err;
+
+	/* Measure the streams */
+	for (ipos = 0; ipos < inner; ipos = cmd.next) {
+		if (lzjody_parse_command(in, inner, ipos, &cmd) < 0) goto error_parse;
+		lit = (cmd.mode == P_LIT) ? cmd.length : 0;
+		ncmd++;
+		nargs += cmd.next - ipos - 1 - lit;
+	}
+	hdr = ((ncmd > P_SHORT_XMAX) ? 3 : 2) + 2;
+	if (hdr + inner >= data->length) return 0;
+
+	/* Deal each command's bytes out to the three streams */
+	cpos = 0;
+	apos = ncmd;
+	lpos = ncmd + nargs;
+	for (ipos = 0; ipos < inner; ipos = cmd.next) {
+		lzjody_parse_command(in, inner, ipos, &cmd);
+		lit = (cmd.mode == P_LIT) ? cmd.length : 0;
+		tmp[cpos++] = in[ipos];
+		memcpy(tmp + apos, in + ipos + 1, cmd.next - ipos - 1 - lit);
+		apos += cmd.next - ipos - 1 - lit;
+		memcpy(tmp + lpos, in + cmd.next - lit, lit);
+		lpos += lit;
+	}
+
+	DLOG("Split: %u commands, 0x%x argument bytes\n", ncmd, nargs);
+	data->opos = start;
+	err = lzjody_write_control(data, P_SPLIT, (uint16_t)ncmd);
+	if (err < 0) return err;
+	*(data->out + data->opos) = (unsigned char)(nargs >> 8);
+	*(data->out + data->opos + 1) = (unsigned char)nargs;
+	data->opos += 2;
+	memcpy(data->out + data->opos, tmp, inner);
+	data->opos += inner;
+	return 0;
+
+error_parse:
+	fprintf(stderr, "liblzjody: internal error: cannot parse block for split layout at 0x%x\n", ipos);
+	return -1;
+}
+
+/* Write a P_FAR command for a stream window match at the current input
+ * position: the match length, then its 24-bit big-endian distance back
+ * from the start of the block */
+static int lzjody_write_far(struct comp_data_t * const restrict data,
+		const struct window_match_t * const restrict m)
+{
+	int err;
+
+	err = lzjody_flush_literals(data);
+	if (err < 0) return err;
+	DLOG("Far match: 0x%x bytes at 0x%x, distance 0x%x\n", m->length, m->start, m->dist);
+	err = lzjody_write_control(data, P_FAR, m->length);
+	if (err < 0) return err;
+	*(data->out + data->opos) = (unsigned char)(m->dist >> 16);
+	*(data->out + data->opos + 1) = (unsigned char)(m->dist >> 8);
+	*(data->out + data->opos + 2) = (unsigned char)m->dist;
+	data->opos += 3;
+	STAT_CMD(data, LZJODY_ST_FAR, m->length);
+	TRACE(data, LZJODY_ST_FAR, data->ipos, m->length, m->dist, CMD_OUT(data), 0);
+	data->ipos += m->length;
+	return 0;
+}
+
+/* Write a P_REF command for a reference image match at the current input
+ * position: the match length, then its 24-bit big-endian signed distance
+ * from the same offset in the reference */
+static int lzjody_write_ref(struct comp_data_t * const restrict data,
+		const struct ref_match_t * const restrict m)
+{
+	const uint32_t delta = (uint32_t)m->delta;
+	int err;
+
+	err = lzjody_flush_literals(data);
+	if (err < 0) return err;
+	DLOG("Reference match: 0x%x bytes at 0x%x, delta %d\n", m->length, m->start, m->delta);
+	err = lzjody_write_control(data, P_REF, m->length);
+	if (err < 0) return err;
+	*(data->out + data->opos) = (unsigned char)(delta >> 16);
+	*(data->out + data->opos + 1) = (unsigned char)(delta >> 8);
+	*(data->out + data->opos + 2) = (unsigned char)delta;
+	data->opos += 3;
+	STAT_CMD(data, LZJODY_ST_REF, m->length);
+	TRACE(data, LZJODY_ST_REF, data->ipos, m->length, delta, CMD_OUT(data), 0);
+	data->ipos += m->length;
+	return 0;
+}
+
+/* Size of a context for callers that provide their own memory */
+extern size_t lzjody_ctx_size(void)
+{
+	return sizeof(struct lzjody_ctx);
+}
+
+/* Prepare caller-provided memory of lzjody_ctx_size() bytes for use
+ * as a context; the memory must be suitably aligned for any type */
+extern struct lzjody_ctx *lzjody_ctx_init(void * const mem)
+{
+	struct lzjody_ctx * const ctx = (struct lzjody_ctx *)mem;
+
+	if (!ctx) return NULL;
+	ctx->stats = NULL;
+	ctx->trace = NULL;
+	ctx->trace_arg = NULL;
+	ctx->trace_block = 0;
+	ctx->window = NULL;
+	ctx->ref = NULL;
+	ctx->ref_pos = 0;
+	ctx->tuned = 0;
+	lzjody_params_default(&ctx->params);
+	ctx->gen = 0;
+	for (int i = 0; i < (1 << PLANE_HASH_BITS); i++) ctx->tri_gen[i] = 0;
+	ctx->plane_fails = 0;
+	ctx->plane_skip = 0;
+	for (int i = 0; i < PLANE_CACHE_SIZE; i++) ctx->plane_cache[i] = 0;
+	return ctx;
+}
+
+/* Allocate and initialize a new context */
+extern struct lzjody_ctx *lzjody_ctx_new(void)
+{
+	return lzjody_ctx_init(malloc(sizeof(struct lzjody_ctx)));
+}
+
+extern void lzjody_ctx_free(struct lzjody_ctx * const ctx)
+{
+	if (ctx != &default_ctx) free(ctx);
+	return;
+}
+
+/* Attach a statistics structure to a context (NULL detaches it)
+ * Returns -1 if the library was built without statistics support */
+extern int lzjody_ctx_set_stats(struct lzjody_ctx * const ctx,
+		struct lzjody_stats * const stats)
+{
+#ifdef LZJODY_STATS
+	if (ctx) ctx->stats = stats;
+	else default_ctx.stats = stats;
+	return 0;
+#else
+	(void)ctx;
+	(void)stats;
+	return -1;
+#endif
+}
+
+/* Attach a trace function to a context (NULL detaches it); block numbers
+ * in events count from the first block compressed after this call */
+extern int lzjody_ctx_set_trace(struct lzjody_ctx * const ctx_in,
+		const lzjody_trace_fn trace, void * const arg)
+{
+	struct lzjody_ctx * const ctx = ctx_in ? ctx_in : &default_ctx;
+
+	ctx->trace = trace;
+	ctx->trace_arg = arg;
+	ctx->trace_block = 0;
+	return 0;
+}
+
+/* Attach a stream window to a context (NULL detaches it); every block
+ * compressed with the context from now on is added to the window
+ * Returns -1 if the window's hash table can't be allocated */
+extern int lzjody_ctx_set_window(struct lzjody_ctx * const ctx,
+		struct lzjody_window * const window)
+{
+	if (window && (window_alloc_table(window) < 0)) return -1;
+	if (ctx) ctx->window = window;
+	else default_ctx.window = window;
+	return 0;
+}
+
+/* Attach a reference image to a context (NULL detaches it); the next
+ * block compressed is at offset pos in the stream, and each block
+ * advances it. A context with a reference doesn't use its window. */
+extern int lzjody_ctx_set_ref(struct lzjody_ctx * const ctx_in,
+		const struct lzjody_ref * const ref, const uint64_t pos)
+{
+	struct lzjody_ctx * const ctx = ctx_in ? ctx_in : &default_ctx;
+
+	ctx->ref = ref;
+	ctx->ref_pos = pos;
+	return 0;
+}
+
+/* The built-in compressor thresholds */
+extern void lzjody_params_default(struct lzjody_params * const p)
+{
+	p->min_lz_match = MIN_LZ_MATCH;
+	p->min_rle_length = MIN_RLE_LENGTH;
+	p->min_seq8_length = MIN_SEQ8_LENGTH;
+	p->min_seq16_length = MIN_SEQ16_LENGTH;
+	p->min_seq32_length = MIN_SEQ32_LENGTH;
+	p->min_plane_length = MIN_PLANE_LENGTH;
+	p->max_lz_byte_scans = MAX_LZ_BYTE_SCANS;
+	return;
+}
+
+/* Set a context's compressor thresholds (NULL restores the defaults)
+ * Minimum lengths can't go below the defaults, which are the shortest
+ * items that never expand a block. Returns -1 for a value out of range */
+extern int lzjody_ctx_set_params(struct lzjody_ctx * const ctx_in,
+		const struct lzjody_params * const p)
+{
+	struct lzjody_ctx * const ctx = ctx_in ? ctx_in : &default_ctx;
+
+	if (!p) {
+		lzjody_params_default(&ctx->params);
+		ctx->tuned = 0;
+		return 0;
+	}
+	if ((p->min_lz_match < MIN_LZ_MATCH) || (p->min_lz_match > LZJODY_PARAM_MAX_LENGTH)
+			|| (p->min_rle_length < MIN_RLE_LENGTH) || (p->min_rle_length > LZJODY_PARAM_MAX_LENGTH)
+			|| (p->min_seq8_length < MIN_SEQ8_LENGTH) || (p->min_seq8_length > LZJODY_PARAM_MAX_LENGTH)
+			|| (p->min_seq16_length < MIN_SEQ16_LENGTH) || (p->min_seq16_length > LZJODY_PARAM_MAX_LENGTH)
+			|| (p->min_seq32_length < MIN_SEQ32_LENGTH) || (p->min_seq32_length > LZJODY_PARAM_MAX_LENGTH)
+			|| (p->min_plane_length < MIN_PLANE_LENGTH) || (p->min_plane_length > LZJODY_BSIZE)
+			|| (p->max_lz_byte_scans < 1) || (p->max_lz_byte_scans > LZJODY_BSIZE))
+		goto error_range;
+	ctx->params = *p;
+	/* The default values take the faster constant variants */
+	ctx->tuned = (p->min_lz_match != MIN_LZ_MATCH) || (p->min_rle_length != MIN_RLE_LENGTH)
+		|| (p->min_seq8_length != MIN_SEQ8_LENGTH) || (p->min_seq16_length != MIN_SEQ16_LENGTH)
+		|| (p->min_seq32_length != MIN_SEQ32_LENGTH) || (p->min_plane_length != MIN_PLANE_LENGTH)
+		|| (p->max_lz_byte_scans != MAX_LZ_BYTE_SCANS);
+	return 0;
+
+error_range:
+	fprintf(stderr, "liblzjody: error: compressor parameter out of range\n");
+	return -1;
+}
+
+/* Options for a speed level from LZJODY_LEVEL_MIN (fastest) to
+ * LZJODY_LEVEL_MAX (smallest); out-of-range levels are clamped.
+ * LZJODY_LEVEL_DEFAULT is plain lzjody_compress() with no options. */
+extern unsigned int lzjody_level_options(const int level)
+{
+	static const unsigned int level_options[LZJODY_LEVEL_MAX + 1] = {
+		0,
+		O_FAST_LZ | O_ACCEL(8),		/* 1 */
+		O_FAST_LZ | O_ACCEL(4),		/* 2 */
+		O_FAST_LZ | O_ACCEL(1),		/* 3 */
+		O_ACCEL(2),			/* 4 */
+		O_ACCEL(1),			/* 5 */
+		0,				/* 6 */
+		O_HUFFMAN,			/* 7 */
+		/* The suffix array has no cheaper setting: O_SA_LZ alone was
+		 * slower than 7 and often larger, and O_ACCEL ruins tables */
+		O_SA_LZ | O_HUFFMAN,		/* 8 */
+		O_SA_LZ | O_HUFFMAN		/* 9 */
+	};
+
+	if (level < LZJODY_LEVEL_MIN) return level_options[LZJODY_LEVEL_MIN];
+	if (level > LZJODY_LEVEL_MAX) return level_options[LZJODY_LEVEL_MAX];
+	return level_options[level];
+}
+
 /* Lempel-Ziv compressor by Jody Bruchon (LZJODY)
  * Compresses "blk" data and puts result in "out"
- * out must be at least 2 bytes larger than blk in case
- * the data is not compressible at all.
+ * out must be at least 4 bytes larger than blk (8 with O_CHECKSUM)
+ * in case the data is not compressible at all.
  * Returns the size of "out" data or returns -1 if the
  * compressed data is not smaller than the original data.
  */
@@ -648,24 +1483,42 @@ extern int lzjody_compress(const unsigned char * const blk_in,
 		const unsigned int options,
 		const unsigned int length)
 {
-	int err;
+	return lzjody_compress_ctx(&default_ctx, blk_in, blk_out, options, length);
+}
 
-	/* Initialize compression data structure */
-	static struct comp_data_t data;
-	static struct lz_index_t idx;
+/* Reentrant compressor: same as lzjody_compress() with a given context */
+extern int lzjody_compress_ctx(struct lzjody_ctx * const ctx_in,
+		const unsigned char * const blk_in,
+		unsigned char * const blk_out,
+		const unsigned int options,
+		const unsigned int length)
+{
+	struct lzjody_ctx * const ctx = ctx_in ? ctx_in : &default_ctx;
+	struct comp_data_t * const restrict data = &ctx->data;
+	struct lz_index_t * const restrict idx = &ctx->idx;
+	unsigned int far = 0, nref = 0, i;	/* Stream window and reference matches */
+	int err;
+#ifdef LZJODY_STATS
+	uint64_t t_total, t;
+#endif
 
 	DLOG("Comp: blk len 0x%x\n", length);
+	STAT_START(t_total);
 
-	data.in = blk_in;
-	data.out = blk_out;
-	data.ipos = 0;
-	data.opos = 2;
-	data.literals = 0;
-	data.literal_start = 0;
-	data.length = length;
-	data.options = options;
+	/* Initialize compression data structure */
+	data->in = blk_in;
+	data->out = blk_out;
+	data->ipos = 0;
+	data->opos = 2;
+	data->literals = 0;
+	data->literal_start = 0;
+	data->length = length;
+	data->options = options;
+	data->ctx = ctx;
+	data->stats = ctx->stats;
+	data->trace = ctx->trace;
 
-	if (options & O_NOPREFIX) data.opos = 0;
+	if (options & O_NOPREFIX) data->opos = 0;
 
 	/* Perform sanity checks on data length */
 	if (length == 0) goto error_zero_length;
@@ -673,43 +1526,111 @@ extern int lzjody_compress(const unsigned char * const blk_in,
 
 	/* Nothing under 3 bytes long will compress */
 	if (length < 3) {
-		data.literals = length;
+		data->literals = length;
 		goto compress_short;
 	}
 
+	/* Reference image or stream window matches split the block into
+	 * pieces that are scanned separately, each one ending where a match
+	 * starts. A block found whole in the reference has nothing to scan. */
+	if (ctx->ref) {
+		STAT_START(t);
+		nref = ref_find(ctx->ref, ctx->ref_pos, blk_in, length, &ctx->ref_scratch, ctx->refm);
+		STAT_CALL(data, LZJODY_ST_REF, t);
+	}
+
 	/* Load arrays for match speedup */
-	err = index_bytes(&data, &idx);
-	if (err < 0) return err;
+	if ((nref != 1) || (ctx->refm[0].length != length)) {
+		STAT_START(t);
+		err = index_block(data, idx);
+		if (err < 0) return err;
+		STAT_TIME(data, index_cycles, t);
+	}
+
+	/* Stream window matches work the same way */
+	if (!ctx->ref && ctx->window && !(options & O_NOPREFIX)) {
+		STAT_START(t);
+		far = window_find(ctx->window, blk_in, length, ctx->far);
+		STAT_CALL(data, LZJODY_ST_FAR, t);
+	}
+	for (i = 0; i < nref; i++) {
+		data->length = ctx->refm[i].start;
+		err = compress_scan(data, idx);
+		if (err < 0) return err;
+		data->length = length;
+		err = lzjody_write_ref(data, ctx->refm + i);
+		if (err < 0) return err;
+	}
+	for (i = 0; i < far; i++) {
+		data->length = ctx->far[i].start;
+		err = compress_scan(data, idx);
+		if (err < 0) return err;
+		data->length = length;
+		err = lzjody_write_far(data, ctx->far + i);
+		if (err < 0) return err;
+	}
 
 	/* Scan through entire block looking for compressible items */
-	err = compress_scan(&data, &idx);
+	err = compress_scan(data, idx);
 	if (err < 0) return err;
 
 compress_short:
 	/* Flush any remaining literals */
-	err = lzjody_flush_literals(&data);
+	err = lzjody_flush_literals(data);
 	if (err < 0) return err;
 
+	if (options & O_SPLIT) {
+		err = lzjody_split_block(data);
+		if (err < 0) return err;
+	}
+
+	if (options & O_HUFFMAN) {
+		err = lzjody_huffman_block(data);
+		if (err < 0) return err;
+	}
+
+	/* Append the block checksum (big-endian) if requested */
+	if (options & O_CHECKSUM) {
+		const uint32_t crc = lzjody_crc32c(0, blk_in, length);
+
+		*(data->out + data->opos) = (unsigned char)(crc >> 24);
+		*(data->out + data->opos + 1) = (unsigned char)(crc >> 16);
+		*(data->out + data->opos + 2) = (unsigned char)(crc >> 8);
+		*(data->out + data->opos + 3) = (unsigned char)crc;
+		data->opos += 4;
+	}
+
+	/* Later blocks may refer to this one */
+	if (ctx->window) window_append(ctx->window, blk_in, length);
+	ctx->ref_pos += length;
+
 	/* Write the total length to the data block unless asked not to */
 	if (!(options & O_NOPREFIX)) {
 /* This uncompressed block part isn't working yet */
 #if 0
-		if (data.opos >= length) {
+		if (data->opos >= length) {
 			/* Flag incompressible data for possible faster decompression */
-			*(unsigned char *)(data.out) =
-				(unsigned char)((((data.opos - 2) & 0x1f00) >> 8) | O_NOCOMPRESS);
+			*(unsigned char *)(data->out) =
+				(unsigned char)((((data->opos - 2) & 0x1f00) >> 8) | O_NOCOMPRESS);
 			DLOG("### Incompressible: %x -> %x\n",
-				(unsigned char)(((data.opos - 2) & 0x1f00) >> 8),
-				(unsigned char)(((data.opos - 2) & 0x1f00) >> 8) | O_NOCOMPRESS);
+				(unsigned char)(((data->opos - 2) & 0x1f00) >> 8),
+				(unsigned char)(((data->opos - 2) & 0x1f00) >> 8) | O_NOCOMPRESS);
 		} else {
 #endif
-			*(unsigned char *)(data.out) = (unsigned char)(((data.opos - 2) & 0x1f00) >> 8);
+			*(unsigned char *)(data->out) = (unsigned char)(((data->opos - 2) & 0x1f00) >> 8);
+			if (options & O_CHECKSUM) *(unsigned char *)(data->out) |= O_CHECKSUM;
+			if (far) *(unsigned char *)(data->out) |= O_FARREF;
 //		}
-		*(unsigned char *)(data.out + 1) = (unsigned char)(data.opos - 2);
+		*(unsigned char *)(data->out + 1) = (unsigned char)(data->opos - 2);
 	}
 
-	DLOG("compressed length: %x\n\n", data.opos);
-	return data.opos;
+	DLOG("compressed length: %x\n\n", data->opos);
+	if (data->trace) ctx->trace_block++;
+	STAT_ADD(data, blocks, 1);
+	STAT_ADD(data, bytes_in, length);
+	STAT_ADD(data, bytes_out, data->opos);
+	STAT_TIME(data, total_cycles, t_total);
+	return data->opos;
 
 error_large_length:
 	fprintf(stderr, "liblzjody: error: block length %d larger than maximum of %d\n",
@@ -720,15 +1641,414 @@ error_zero_length:
 	return -1;
 }
 
-/* LZJODY decompressor */
+/* Data outside a block that its copies read: the stream window for
+ * P_FAR, and the reference image with the block's stream offset for P_REF */
+struct ext_src_t {
+	const struct lzjody_window *win;
+	const struct lzjody_ref *ref;
+	uint64_t pos;
+};
+
+static int lzjody_decompress_block(const unsigned char * const in,
+		unsigned char * const out, const unsigned int size,
+		unsigned int ipos, unsigned int opos, const unsigned int limit,
+		const struct ext_src_t * const ext);
+
+/* Write length bytes of a repeating pattern of period bytes; the filled
+ * span doubles with each copy, so long fills run at memcpy() speed */
+static inline void pattern_fill(unsigned char * const restrict out,
+		const unsigned char * const restrict pattern,
+		const unsigned int period, const unsigned int length)
+{
+	unsigned int done = (period < length) ? period : length;
+	unsigned int n;
+
+	memcpy(out, pattern, done);
+	while (done < length) {
+		n = (done < length - done) ? done : length - done;
+		memcpy(out + done, out, n);
+		done += n;
+	}
+	return;
+}
+
+static int lzjody_decompress_split(const unsigned char * const in,
+		const unsigned int size, const unsigned int ctl_len,
+		unsigned char * const out, const struct ext_src_t * const ext);
+
+/* Decompress a whole block, verifying its checksum if it has one */
+static int lzjody_decompress_checked(const unsigned char * const in,
+		unsigned char * const out, const unsigned int size,
+		const unsigned int options, const struct ext_src_t * const ext)
+{
+	uint32_t crc;
+	int length;
+
+	if (!(options & O_CHECKSUM)) return lzjody_decompress_block(in, out, size, 0, 0, DECODE_ALL, ext);
+
+	if (size <= 4) goto error_size;
+	/* Read the checksum first; in-place decoding may overwrite it */
+	crc = ((uint32_t)*(in + size - 4) << 24) | ((uint32_t)*(in + size - 3) << 16)
+		| ((uint32_t)*(in + size - 2) << 8) | (uint32_t)*(in + size - 1);
+	length = lzjody_decompress_block(in, out, size - 4, 0, 0, DECODE_ALL, ext);
+	if (length < 0) return length;
+	if (lzjody_crc32c(0, out, (size_t)length) != crc) goto error_checksum;
+	return length;
+
+error_size:
+	fprintf(stderr, "liblzjody: data error: block too short for checksum (%d bytes)\n", size);
+	return -1;
+error_checksum:
+	fprintf(stderr, "liblzjody: data error: block checksum mismatch (stored 0x%08x, actual 0x%08x)\n",
+			crc, lzjody_crc32c(0, out, (size_t)length));
+	return -1;
+}
+
+/* LZJODY decompressor
+ * If options has O_CHECKSUM, the last four bytes of the input are the
+ * block checksum and are verified against the decompressed data */
 extern int lzjody_decompress(const unsigned char * const in,
 		unsigned char * const out,
 		const unsigned int size,
 		const unsigned int options)
+{
+	if (options & O_FARREF) goto error_farref;
+	return lzjody_decompress_checked(in, out, size, options, NULL);
+
+error_farref:
+	fprintf(stderr, "liblzjody: error: block refers to earlier blocks and needs a stream window\n");
+	return -1;
+}
+
+/* Decompress the next block of a stream through its window, which every
+ * block of the stream must pass through in order, including blocks with
+ * O_NOCOMPRESS (copied as they are). The output joins the window. */
+extern int lzjody_decompress_window(struct lzjody_window * const win,
+		const unsigned char * const in,
+		unsigned char * const out,
+		const unsigned int size,
+		const unsigned int options)
+{
+	const struct ext_src_t ext = { win, NULL, 0 };
+	int length;
+
+	if (options & O_NOCOMPRESS) {
+		if (size > LZJODY_BSIZE) goto error_size;
+		memmove(out, in, size);
+		length = (int)size;
+	} else {
+		length = lzjody_decompress_checked(in, out, size, options, &ext);
+		if (length < 0) return length;
+	}
+	window_append(win, out, (unsigned int)length);
+	return length;
+
+error_size:
+	fprintf(stderr, "liblzjody: error: stored block length %d larger than maximum of %d\n",
+			size, LZJODY_BSIZE);
+	return -1;
+}
+
+/* Decompress a block that was compressed against a reference image; pos
+ * is the block's offset in the stream. Blocks with O_NOCOMPRESS are
+ * copied as they are. */
+extern int lzjody_decompress_ref(const struct lzjody_ref * const ref,
+		const uint64_t pos,
+		const unsigned char * const in,
+		unsigned char * const out,
+		const unsigned int size,
+		const unsigned int options)
+{
+	const struct ext_src_t ext = { NULL, ref, pos };
+
+	if (options & O_FARREF) goto error_farref;
+	if (options & O_NOCOMPRESS) {
+		if (size > LZJODY_BSIZE) goto error_size;
+		memmove(out, in, size);
+		return (int)size;
+	}
+	return lzjody_decompress_checked(in, out, size, options, &ext);
+
+error_farref:
+	fprintf(stderr, "liblzjody: error: block refers to earlier blocks and needs a stream window\n");
+	return -1;
+error_size:
+	fprintf(stderr, "liblzjody: error: stored block length %d larger than maximum of %d\n",
+			size, LZJODY_BSIZE);
+	return -1;
+}
+
+static int lzjody_stream_length(const unsigned char * const, const unsigned int);
+
+/* Parse the command at ipos without decoding it
+ * Returns 0, or -1 if it is malformed or runs past the end of the input */
+static int lzjody_parse_command(const unsigned char * const in,
+		const unsigned int size, unsigned int ipos,
+		struct cmd_info_t * const cmd)
+{
+	const unsigned char c = in[ipos++];
+	unsigned int control = 0, length = 0;
+	int bp_length;
+
+	cmd->mode = c & P_MASK;
+	cmd->src = NO_SRC;
+	if (cmd->mode == 0) {
+		cmd->mode = c & P_XMASK;
+		/* Every extended command has a length */
+		if (cmd->mode != 0) {
+			if (ipos >= size) return -1;
+			length = in[ipos++];
+			if (!(c & P_SHORT)) {
+				if (ipos >= size) return -1;
+				length = (length << 8) + in[ipos++];
+			}
+			if (length > LZJODY_BSIZE) return -1;
+		}
+	} else if (c & P_SHORT) control = c & P_SHORT_MAX;
+	else {
+		if (ipos >= size) return -1;
+		if (c & (P_RLE | P_LZL)) control = (unsigned int)(c & (P_LZL | P_SHORT_MAX)) << 8;
+		else control = (unsigned int)(c & P_SHORT_MAX) << 8;
+		control += in[ipos++];
+	}
+
+	switch (cmd->mode) {
+		case P_HUFF:
+			/* Coded data runs to the end of the block */
+			cmd->length = length;
+			break;
+		case P_PLANE:
+			if (ipos + length > size) return -1;
+			bp_length = lzjody_stream_length(in + ipos, length);
+			if (bp_length < 0) return -1;
+			cmd->length = (unsigned int)bp_length;
+			ipos += length;
+			break;
+		case P_LZ:
+			if (ipos >= size) return -1;
+			cmd->src = control & 0xfff;
+			length = in[ipos++];
+			if (c & P_LZL) {
+				if (ipos >= size) return -1;
+				length = (length << 8) + in[ipos++];
+			}
+			cmd->length = length;
+			break;
+		case P_RLE:
+			cmd->length = control;
+			ipos++;
+			break;
+		case P_LIT:
+			cmd->length = control;
+			ipos += control;
+			break;
+		case P_SEQ32:
+			cmd->length = length << 2;
+			ipos += sizeof(uint32_t);
+			break;
+		case P_SEQ16:
+			cmd->length = length << 1;
+			ipos += sizeof(uint16_t);
+			break;
+		case P_SEQ8:
+			cmd->length = length;
+			ipos += sizeof(uint8_t);
+			break;
+		case P_FAR:
+		case P_REF:
+			cmd->length = length;
+			ipos += 3;
+			break;
+		case P_PATTERN:
+			if (ipos >= size) return -1;
+			cmd->length = length;
+			ipos += 1 + in[ipos];
+			break;
+		default:
+			return -1;
+	}
+	if (ipos > size) return -1;
+	cmd->next = ipos;
+	return 0;
+}
+
+/* Total output of a command stream without decoding it, or -1 */
+static int lzjody_stream_length(const unsigned char * const in, const unsigned int size)
+{
+	struct cmd_info_t cmd;
+	unsigned int ipos = 0, opos = 0;
+
+	while (ipos < size) {
+		if (lzjody_parse_command(in, size, ipos, &cmd) < 0) return -1;
+		/* Byte planes are never Huffman coded */
+		if (cmd.mode == P_HUFF) return -1;
+		opos += cmd.length;
+		if (opos > LZJODY_BSIZE) return -1;
+		ipos = cmd.next;
+	}
+	return (int)opos;
+}
+
+/* Find the first command that must be decoded to produce output bytes
+ * start to end - 1. Walking back from the last command needed, earlier
+ * commands are needed if they overlap the range or anything a needed LZ
+ * command copies from; the first one that isn't ends the walk, since
+ * everything before it ends even earlier. Any parsing trouble leaves the
+ * resume point at the start and the decoder reports the error. */
+static void lzjody_range_plan(const unsigned char * const in,
+		const unsigned int size, const unsigned int start,
+		const unsigned int end, unsigned int * const resume_ipos,
+		unsigned int * const resume_opos)
+{
+	uint16_t cmd_ipos[LZJODY_BSIZE + 1];
+	uint16_t cmd_opos[LZJODY_BSIZE + 1];
+	uint16_t cmd_src[LZJODY_BSIZE];
+	struct cmd_info_t cmd;
+	unsigned int ipos = 0, opos = 0, need = start, n = 0;
+
+	*resume_ipos = 0;
+	*resume_opos = 0;
+	while ((ipos < size) && (opos < end)) {
+		if (n == LZJODY_BSIZE) return;
+		if (lzjody_parse_command(in, size, ipos, &cmd) < 0) return;
+		if (cmd.mode == P_HUFF) return;
+		cmd_ipos[n] = (uint16_t)ipos;
+		cmd_opos[n] = (uint16_t)opos;
+		cmd_src[n] = (uint16_t)cmd.src;
+		n++;
+		opos += cmd.length;
+		if (opos > LZJODY_BSIZE) return;
+		ipos = cmd.next;
+	}
+	cmd_ipos[n] = (uint16_t)ipos;
+	cmd_opos[n] = (uint16_t)opos;
+
+	/* Command i - 1 ends where command i starts */
+	while ((n > 0) && (cmd_opos[n] > need)) {
+		n--;
+		if (cmd_src[n] < need) need = cmd_src[n];
+	}
+	*resume_ipos = cmd_ipos[n];
+	*resume_opos = cmd_opos[n];
+	return;
+}
+
+/* Decompress only enough of a block to produce len bytes at offset start
+ * "out" must hold LZJODY_BSIZE bytes; the range is written to out + start
+ * and the rest of out is undefined. Commands before the range that it
+ * doesn't depend on are skipped, and decoding stops at the end of the
+ * range. O_CHECKSUM blocks are accepted but the checksum is not verified.
+ * Returns the number of bytes available in the range (less than len if
+ * the block ends first) or -1 on error. */
+extern int lzjody_decompress_range(const unsigned char * const in,
+		unsigned char * const out, unsigned int size,
+		const unsigned int options, const unsigned int start,
+		const unsigned int len)
+{
+	unsigned char huff_temp[LZJODY_BSIZE];
+	const unsigned char *stream = in;
+	struct cmd_info_t cmd;
+	unsigned int end, ipos, opos;
+	int length;
+
+	if (options & O_FARREF) goto error_farref;
+	if (options & O_CHECKSUM) {
+		if (size <= 4) goto error_size;
+		size -= 4;
+	}
+	if ((size == 0) || (start > LZJODY_BSIZE)) goto error_range;
+	end = (len > LZJODY_BSIZE - start) ? LZJODY_BSIZE : start + len;
+
+	/* A Huffman coded block is one command; plan on the decoded stream */
+	if ((lzjody_parse_command(in, size, 0, &cmd) == 0) && (cmd.mode == P_HUFF)) {
+		if (huff_decode(in + cmd.next, size - cmd.next, huff_temp, cmd.length) < 0) goto error_huff;
+		if ((cmd.length == 0) || ((huff_temp[0] & (P_MASK | P_XMASK)) == P_HUFF)) goto error_huff;
+		stream = huff_temp;
+		size = cmd.length;
+	}
+	lzjody_range_plan(stream, size, start, end, &ipos, &opos);
+	length = lzjody_decompress_block(stream, out, size, ipos, opos, end, NULL);
+	if (length < 0) return length;
+	if ((unsigned int)length <= start) return 0;
+	if ((unsigned int)length > end) length = (int)end;
+	return length - (int)start;
+
+error_size:
+	fprintf(stderr, "liblzjody: data error: block too short for checksum (%d bytes)\n", size);
+	return -1;
+error_range:
+	fprintf(stderr, "liblzjody: error: bad range 0x%x+0x%x of block size %d\n", start, len, size);
+	return -1;
+error_huff:
+	fprintf(stderr, "liblzjody: data error: bad Huffman coded data\n");
+	return -1;
+error_farref:
+	fprintf(stderr, "liblzjody: error: cannot read a range of a block that refers to earlier blocks\n");
+	return -1;
+}
+
+/* Extra space needed to decompress a block in place: with the block's
+ * "size" bytes at the very end of a buffer of its decompressed length
+ * plus the margin, lzjody_decompress() can write to the start of the
+ * same buffer. Output never passes input that is still to be read, so
+ * the margin is how far the compressed data still to come outgrows the
+ * output still to come at the worst point. Huffman coded blocks are
+ * read in full before any output is written. Split stream blocks read
+ * their control bytes from the front, so they get no overlap at all.
+ * Returns the margin in bytes or -1 if the block is malformed. */
+extern int lzjody_inplace_margin(const unsigned char * const in,
+		const unsigned int size, const unsigned int options)
+{
+	unsigned char huff_temp[LZJODY_BSIZE];
+	struct cmd_info_t cmd;
+	unsigned int payload = size, ipos = 0, opos = 0, ahead = 0;
+	int length;
+
+	/* Stored blocks only need memmove() */
+	if (options & O_NOCOMPRESS) return 0;
+	if (options & O_CHECKSUM) {
+		if (size <= 4) goto error_data;
+		payload -= 4;
+	}
+	if (payload == 0) goto error_data;
+	if ((in[0] & (P_MASK | P_XMASK)) == P_SPLIT) return (int)size;
+
+	while (ipos < payload) {
+		if (lzjody_parse_command(in, payload, ipos, &cmd) < 0) goto error_data;
+		if (cmd.mode == P_HUFF) {
+			if (ipos != 0) goto error_data;
+			if (huff_decode(in + cmd.next, payload - cmd.next, huff_temp, cmd.length) < 0) goto error_data;
+			if ((cmd.length > 0) && ((huff_temp[0] & (P_MASK | P_XMASK)) == P_SPLIT)) return (int)size;
+			length = lzjody_stream_length(huff_temp, cmd.length);
+			if (length < 0) goto error_data;
+			opos = (unsigned int)length;
+			break;
+		}
+		opos += cmd.length;
+		if (opos > LZJODY_BSIZE) goto error_data;
+		ipos = cmd.next;
+		if (opos > ipos + ahead) ahead = opos - ipos;
+	}
+	if (size + ahead <= opos) return 0;
+	return (int)(size + ahead - opos);
+
+error_data:
+	fprintf(stderr, "liblzjody: data error: cannot parse block for in-place margin\n");
+	return -1;
+}
+
+/* Decompress one block of commands (no checksum) starting with the
+ * command at ipos, whose output goes to opos. Stops after the command
+ * that reaches output position limit; returns the output position. */
+static int lzjody_decompress_block(const unsigned char * const in,
+		unsigned char * const out,
+		const unsigned int size,
+		register unsigned int ipos,
+		register unsigned int opos,
+		const unsigned int limit,
+		const struct ext_src_t * const ext)
 {
 	unsigned int mode;
-	register unsigned int ipos = 0;
-	register unsigned int opos = 0;
 	unsigned int offset;
 	register unsigned int length = 0;
 	unsigned int sl;	/* short/long */
@@ -749,15 +2069,17 @@ extern int lzjody_decompress(const unsigned char * const in,
 		uint8_t num8;
 	} num;
 	unsigned int seqbits = 0;
-	unsigned char *bp_out;
-	unsigned int bp_length;
+	int bp_length;
 	unsigned char bp_temp[LZJODY_BSIZE];
 	int err;
 
+/* Fail unless n more input bytes exist */
+#define DECODE_NEED(n) do { if (ipos + (n) > size) goto error_truncated; } while (0)
+
 	/* Cannot decompress a zero-length block */
 	if (size == 0) return -1;
 
-	while (ipos < size) {
+	while ((ipos < size) && (opos < limit)) {
 		c = *(in + ipos);
 		DLOG("Command 0x%x\n", c);
 		mode = c & P_MASK;
@@ -768,12 +2090,15 @@ extern int lzjody_decompress(const unsigned char * const in,
 			/* Change mode to the extended command instead */
 			mode = c & P_XMASK;
 			DLOG("X-mode: %x\n", mode);
-			/* Initializer for sequence/byteplane commands */
-			if (mode & (P_SMASK | P_PLANE)) {
+			/* Every extended command starts with a length */
+			if (mode != 0) {
+				DECODE_NEED(sl ? 1 : 2);
 				length = *(in + ipos);
 #ifdef DEBUG
-				if (mode & P_SMASK) { DLOG("Seq length: %x\n", length); }
-				if (mode & P_PLANE) { DLOG("Byte plane length: %x\n", length); }
+				if (mode < P_PLANE) { DLOG("Seq length: %x\n", length); }
+				if (mode == P_PLANE) { DLOG("Byte plane length: %x\n", length); }
+				if (mode == P_HUFF) { DLOG("Huffman length: %x\n", length); }
+				if (mode == P_SPLIT) { DLOG("Split command count: %x\n", length); }
 #endif /* DLOG */
 				ipos++;
 				/* Long form has a high byte */
@@ -793,6 +2118,7 @@ extern int lzjody_decompress(const unsigned char * const in,
 			control = c & P_SHORT_MAX;
 			DLOG("Short control: 0x%x\n", control);
 		} else {
+			DECODE_NEED(1);
 			if (c & (P_RLE | P_LZL)) 
 				control = (unsigned int)(c & (P_LZL | P_SHORT_MAX)) << 8;
 			else control = (unsigned int)(c & P_SHORT_MAX) << 8;
@@ -803,29 +2129,82 @@ extern int lzjody_decompress(const unsigned char * const in,
 
 		/* Based on the command, select a decompressor */
 		switch (mode) {
+			case P_HUFF:
+				/* Huffman coded command stream: always the whole block.
+				 * Decode it to scratch space, then decompress that. */
+				DLOG("%04x:%04x:  Huffman 0x%x\n", ipos, opos, length);
+				if (opos != 0) goto error_huff;
+				if (huff_decode(in + ipos, size - ipos, bp_temp, length) < 0) goto error_huff;
+				/* Refuse nesting so corrupt data can't recurse deeply */
+				if ((length > 0) && ((bp_temp[0] & (P_MASK | P_XMASK)) == P_HUFF)) goto error_huff;
+				return lzjody_decompress_block(bp_temp, out, length, 0, 0, limit, ext);
+			case P_SPLIT:
+				/* Split stream layout: always the whole block */
+				DLOG("%04x:%04x:  Split streams, 0x%x commands\n", ipos, opos, length);
+				if (opos != 0) goto error_mode;
+				return lzjody_decompress_split(in + ipos, size - ipos, length, out, ext);
 			case P_PLANE:
 				/* Byte plane transformation handler */
 				DLOG("%04x:%04x:  Byte plane c_len 0x%x\n", ipos, opos, length);
-				bp_out = out + opos;
-				bp_length = lzjody_decompress((in + ipos), bp_out, length, 0);
-
-				err = byteplane_transform(bp_out, bp_temp, bp_length, -4);
+				/* Byte planes hold plain command streams */
+				DECODE_NEED(length);
+				if ((length > 0) && P_WHOLE_BLOCK(*(in + ipos))) goto error_mode;
+				/* Decode the planes to scratch space, then transpose
+				 * them straight into their final positions */
+				bp_length = lzjody_decompress_block((in + ipos), bp_temp, length, 0, 0, DECODE_ALL, NULL);
+				if (bp_length < 0) return bp_length;
+				if ((opos + (unsigned int)bp_length) > LZJODY_BSIZE) goto error_bp_length;
+
+				err = byteplane_transform(bp_temp, out + opos, bp_length, -4);
 				if (err < 0) return err;
 
 				DLOG("Byte plane transform len 0x%x done\n", bp_length);
 				ipos += length;
-				opos += bp_length;
-				if (opos > LZJODY_BSIZE) goto error_bp_length;
-				length = 0;
-				/* memcpy sucks, we can do it ourselves */
-				while(length < bp_length) {
-					*(bp_out + length) = *(bp_temp + length);
-					length++;
-				}
+				opos += (unsigned int)bp_length;
+				break;
+			case P_PATTERN:
+				/* Pattern fill: the period, then the pattern */
+				DECODE_NEED(1);
+				offset = *(in + ipos);
+				DLOG("%04x:%04x: Pattern fill 0x%x, period %u\n", ipos, opos, length, offset);
+				if ((offset < 2) || (offset > MAX_PATTERN)) goto error_pattern;
+				DECODE_NEED(1 + offset);
+				if ((opos + length) > LZJODY_BSIZE) goto error_pattern;
+				/* Range reads don't need what follows the limit */
+				pattern_fill(out + opos, in + ipos + 1, offset,
+						((opos + length) > limit) ? limit - opos : length);
+				ipos += 1 + offset;
+				opos += length;
+				break;
+			case P_FAR:
+				/* Copy from earlier blocks in the stream window */
+				DECODE_NEED(3);
+				offset = ((unsigned int)*(in + ipos) << 16)
+					| ((unsigned int)*(in + ipos + 1) << 8) | *(in + ipos + 2);
+				ipos += 3;
+				DLOG("%04x:%04x: Far copy (%x:%x)\n", ipos, opos, offset, length);
+				if (!ext || !ext->win) goto error_far;
+				if ((opos + length) > LZJODY_BSIZE) goto error_far;
+				if (window_copy(ext->win, offset, length, out + opos) < 0) goto error_far;
+				opos += length;
+				break;
+			case P_REF:
+				/* Copy from the reference image near this offset */
+				DECODE_NEED(3);
+				offset = ((unsigned int)*(in + ipos) << 16)
+					| ((unsigned int)*(in + ipos + 1) << 8) | *(in + ipos + 2);
+				ipos += 3;
+				DLOG("%04x:%04x: Reference copy (%x:%x)\n", ipos, opos, offset, length);
+				if (!ext || !ext->ref) goto error_ref;
+				if ((opos + length) > LZJODY_BSIZE) goto error_ref;
+				if (ref_copy(ext->ref, ext->pos + opos, REF_DELTA(offset), length, out + opos) < 0)
+					goto error_ref;
+				opos += length;
 				break;
 			case P_LZ:
 				/* LZ (dictionary-based) compression */
 				offset = control & 0xfff;
+				DECODE_NEED((c & P_LZL) ? 2 : 1);
 				length = *(in + ipos);
 				ipos++;
 				if (c & P_LZL) {
@@ -844,6 +2223,8 @@ extern int lzjody_decompress(const unsigned char * const in,
 				mem2 = out + opos;
 				opos += length;
 				if (opos > LZJODY_BSIZE) goto error_lz_length;
+				/* Range reads don't need what follows the limit */
+				if (opos > limit) length -= opos - limit;
 				while (length != 0) {
 					*mem2 = *mem1;
 					mem1++; mem2++;
@@ -854,21 +2235,30 @@ extern int lzjody_decompress(const unsigned char * const in,
 			case P_RLE:
 				/* Run-length encoding */
 				length = control;
+				DECODE_NEED(1);
 				c = *(in + ipos);
 				ipos++;
 				DLOG("%04x:%04x: RLE run 0x%x\n", ipos, opos, length);
 				if (opos + length > LZJODY_BSIZE) goto error_rle_length;
+				/* Range reads don't need what follows the limit */
+				offset = opos + length;
+				if (offset > limit) length = limit - opos;
 				while (length > 0) {
 					*(out + opos) = c;
 					opos++;
 					length--;
 				}
+				opos = offset;
 				break;
 
 			case P_LIT:
 				/* Literal byte sequence */
 				DLOG("%04x:%04x: 0x%x literal bytes\n", ipos, opos, control);
 				length = control;
+				if ((opos + control) > LZJODY_BSIZE) goto error_lit_length;
+				if ((ipos + control) > size) goto error_lit_length;
+				/* Range reads don't need what follows the limit */
+				if ((opos + control) > limit) length = limit - opos;
 				mem1 = (const unsigned char *)(in + ipos);
 				mem2 = (unsigned char *)(out + opos);
 				while (length != 0) {
@@ -878,7 +2268,6 @@ extern int lzjody_decompress(const unsigned char * const in,
 				}
 				ipos += control;
 				opos += control;
-				if (opos > LZJODY_BSIZE) goto error_lit_length;
 				break;
 
 			case P_SEQ32:
@@ -886,6 +2275,7 @@ extern int lzjody_decompress(const unsigned char * const in,
 				/* Sequential increment compression (32-bit) */
 				DLOG("%04x:%04x: Seq(32) 0x%x\n", ipos, opos, length);
 				/* Get sequence start number */
+				DECODE_NEED(sizeof(uint32_t));
 				num.num32 = *(uint32_t *)((uintptr_t)in + (uintptr_t)ipos);
 				ipos += sizeof(uint32_t);
 				/* Get sequence start position */
@@ -905,6 +2295,7 @@ extern int lzjody_decompress(const unsigned char * const in,
 				/* Sequential increment compression (16-bit) */
 				DLOG("%04x:%04x: Seq(16) 0x%x\n", ipos, opos, length);
 				/* Get sequence start number */
+				DECODE_NEED(sizeof(uint16_t));
 				num.num16 = *(uint16_t *)((uintptr_t)in + (uintptr_t)ipos);
 				ipos += sizeof(uint16_t);
 				/* Get sequence start position */
@@ -924,6 +2315,7 @@ extern int lzjody_decompress(const unsigned char * const in,
 				/* Sequential increment compression (8-bit) */
 				DLOG("%04x:%04x: Seq(8) 0x%x\n", ipos, opos, length);
 				/* Get sequence start number */
+				DECODE_NEED(sizeof(uint8_t));
 				num.num8 = *(uint8_t *)((uintptr_t)in + (uintptr_t)ipos);
 				ipos += sizeof(uint8_t);
 				/* Get sequence start position */
@@ -942,15 +2334,23 @@ extern int lzjody_decompress(const unsigned char * const in,
 		}
 	}
 
+#undef DECODE_NEED
+
 	if (opos > LZJODY_BSIZE) goto error_opos;
 	return opos;
 
+error_truncated:
+	fprintf(stderr, "liblzjody: data error: command 0x%x runs past end of block\n", c);
+	return -1;
 error_opos:
 	fprintf(stderr, "liblzjody: error: output pos %d higher than maximum %d)\n", opos, LZJODY_BSIZE);
 	return -1;
 error_bp_length:
 	fprintf(stderr, "liblzjody: error: byte plane length overflows output pos (%d > %d)\n",
-			opos, LZJODY_BSIZE);
+			opos + bp_length, LZJODY_BSIZE);
+	return -1;
+error_huff:
+	fprintf(stderr, "liblzjody: data error: bad Huffman coded data at 0x%x\n", ipos);
 	return -1;
 error_rle_length:
 	fprintf(stderr, "liblzjody: error: RLE length overflows output pos (%d > %d)\n",
@@ -958,7 +2358,7 @@ error_rle_length:
 	return -1;
 error_lit_length:
 	fprintf(stderr, "liblzjody: error: literal length overflows output pos (%d > %d)\n",
-			opos, LZJODY_BSIZE);
+			opos + control, LZJODY_BSIZE);
 	return -1;
 error_lz_length:
 	fprintf(stderr, "liblzjody: error: LZ length overflows output pos (%d > %d)\n",
@@ -977,5 +2377,176 @@ error_length:
 error_mode:
 	fprintf(stderr, "liblzjody: error: invalid decompressor mode 0x%x at 0x%x\n", mode, ipos);
 	return -1;
+error_pattern:
+	fprintf(stderr, "liblzjody: data error: bad pattern fill 0x%x (period %u)\n", length, offset);
+	return -1;
+error_far:
+	if (!ext || !ext->win) fprintf(stderr, "liblzjody: error: far copy at 0x%x without a stream window\n", ipos);
+	else fprintf(stderr, "liblzjody: data error: far copy 0x%x:0x%x is outside the stream window\n",
+			offset, length);
+	return -1;
+error_ref:
+	if (!ext || !ext->ref) fprintf(stderr, "liblzjody: error: reference copy at 0x%x without a reference image\n", ipos);
+	else fprintf(stderr, "liblzjody: data error: reference copy 0x%x:0x%x is outside the reference image\n",
+			offset, length);
+	return -1;
 }
 
+
+/* Decode the body of a P_SPLIT block: ctl_len control bytes after a
+ * 16-bit argument stream length, then the argument stream, then the
+ * literal stream up to the end of the block (see lzjody_split_block()).
+ * Each stream is read from its own pointer, so finding the next control
+ * byte never waits on the previous command's arguments, and literals
+ * and non-overlapping LZ matches are copied with memcpy(). */
+static int lzjody_decompress_split(const unsigned char * const in,
+		const unsigned int size, const unsigned int ctl_len,
+		unsigned char * const out, const struct ext_src_t * const ext)
+{
+	const unsigned char *ctl, *ctl_end, *arg, *arg_end, *lit, *lit_end;
+	unsigned int opos = 0, mode, sl, control = 0, length = 0, offset, i;
+	unsigned char c;
+	unsigned char bp_temp[LZJODY_BSIZE];
+	int bp_length;
+	uint32_t num32;
+	uint16_t num16;
+	uint8_t num8;
+
+/* Fail unless n more argument bytes exist */
+#define SPLIT_ARGS(n) do { if ((size_t)(arg_end - arg) < (size_t)(n)) goto error_split; } while (0)
+
+	ctl = in + 2;
+	if (size < 2) goto error_split;
+	length = ((unsigned int)in[0] << 8) | in[1];
+	if (2 + ctl_len + length > size) goto error_split;
+	ctl_end = ctl + ctl_len;
+	arg = ctl_end;
+	arg_end = arg + length;
+	lit = arg_end;
+	lit_end = in + size;
+
+	while (ctl < ctl_end) {
+		c = *ctl++;
+		mode = c & P_MASK;
+		sl = c & P_SHORT;
+		if (mode == 0) {
+			mode = c & P_XMASK;
+			if (mode != 0) {
+				SPLIT_ARGS(sl ? 1 : 2);
+				length = *arg++;
+				if (!sl) length = (length << 8) | *arg++;
+				if (length > LZJODY_BSIZE) goto error_split;
+			}
+		} else if (sl) control = c & P_SHORT_MAX;
+		else {
+			SPLIT_ARGS(1);
+			if (c & (P_RLE | P_LZL))
+				control = (unsigned int)(c & (P_LZL | P_SHORT_MAX)) << 8;
+			else control = (unsigned int)(c & P_SHORT_MAX) << 8;
+			control |= *arg++;
+		}
+
+		switch (mode) {
+			case P_PLANE:
+				SPLIT_ARGS(length);
+				if ((length > 0) && P_WHOLE_BLOCK(*arg)) goto error_split;
+				bp_length = lzjody_decompress_block(arg, bp_temp, length, 0, 0, DECODE_ALL, NULL);
+				if (bp_length < 0) return bp_length;
+				if ((opos + (unsigned int)bp_length) > LZJODY_BSIZE) goto error_length;
+				if (byteplane_transform(bp_temp, out + opos, bp_length, -4) < 0) return -1;
+				arg += length;
+				opos += (unsigned int)bp_length;
+				break;
+			case P_PATTERN:
+				SPLIT_ARGS(1);
+				offset = *arg;
+				if ((offset < 2) || (offset > MAX_PATTERN)) goto error_split;
+				SPLIT_ARGS(1 + offset);
+				if ((opos + length) > LZJODY_BSIZE) goto error_length;
+				pattern_fill(out + opos, arg + 1, offset, length);
+				arg += 1 + offset;
+				opos += length;
+				break;
+			case P_FAR:
+				SPLIT_ARGS(3);
+				offset = ((unsigned int)arg[0] << 16) | ((unsigned int)arg[1] << 8) | arg[2];
+				arg += 3;
+				if (!ext || !ext->win || ((opos + length) > LZJODY_BSIZE)) goto error_split;
+				if (window_copy(ext->win, offset, length, out + opos) < 0) goto error_split;
+				opos += length;
+				break;
+			case P_REF:
+				SPLIT_ARGS(3);
+				offset = ((unsigned int)arg[0] << 16) | ((unsigned int)arg[1] << 8) | arg[2];
+				arg += 3;
+				if (!ext || !ext->ref || ((opos + length) > LZJODY_BSIZE)) goto error_split;
+				if (ref_copy(ext->ref, ext->pos + opos, REF_DELTA(offset), length, out + opos) < 0)
+					goto error_split;
+				opos += length;
+				break;
+			case P_LZ:
+				offset = control & 0xfff;
+				SPLIT_ARGS((c & P_LZL) ? 2 : 1);
+				length = *arg++;
+				if (c & P_LZL) length = (length << 8) | *arg++;
+				if (offset >= opos) goto error_split;
+				if ((opos + length) > LZJODY_BSIZE) goto error_length;
+				/* Overlapping matches repeat the bytes being written */
+				if (offset + length <= opos) memcpy(out + opos, out + offset, length);
+				else for (i = 0; i < length; i++) out[opos + i] = out[offset + i];
+				opos += length;
+				break;
+			case P_RLE:
+				SPLIT_ARGS(1);
+				if ((opos + control) > LZJODY_BSIZE) goto error_length;
+				memset(out + opos, *arg++, control);
+				opos += control;
+				break;
+			case P_LIT:
+				if ((size_t)(lit_end - lit) < control) goto error_split;
+				if ((opos + control) > LZJODY_BSIZE) goto error_length;
+				memcpy(out + opos, lit, control);
+				lit += control;
+				opos += control;
+				break;
+			case P_SEQ32:
+				SPLIT_ARGS(sizeof(uint32_t));
+				memcpy(&num32, arg, sizeof(uint32_t));
+				arg += sizeof(uint32_t);
+				if ((opos + (length << 2)) > LZJODY_BSIZE) goto error_length;
+				for (i = 0; i < length; i++, num32++, opos += 4) memcpy(out + opos, &num32, 4);
+				break;
+			case P_SEQ16:
+				SPLIT_ARGS(sizeof(uint16_t));
+				memcpy(&num16, arg, sizeof(uint16_t));
+				arg += sizeof(uint16_t);
+				if ((opos + (length << 1)) > LZJODY_BSIZE) goto error_length;
+				for (i = 0; i < length; i++, num16++, opos += 2) memcpy(out + opos, &num16, 2);
+				break;
+			case P_SEQ8:
+				SPLIT_ARGS(sizeof(uint8_t));
+				num8 = *arg++;
+				if ((opos + length) > LZJODY_BSIZE) goto error_length;
+				for (i = 0; i < length; i++) out[opos++] = num8++;
+				break;
+			default:
+				goto error_mode;
+		}
+	}
+#undef SPLIT_ARGS
+
+	/* Every stream must be used up exactly */
+	if ((arg != arg_end) || (lit != lit_end)) goto error_split;
+	return (int)opos;
+
+error_split:
+	fprintf(stderr, "liblzjody: data error: bad split stream block (command 0x%x)\n",
+			(unsigned int)(ctl - in));
+	return -1;
+error_length:
+	fprintf(stderr, "liblzjody: error: split stream output overflows block (0x%x)\n", opos);
+	return -1;
+error_mode:
+	fprintf(stderr, "liblzjody: error: invalid split stream command 0x%x\n", c);
+	return -1;
+}
@@ -8,6 +8,9 @@
 #ifndef LZJODY_H
 #define LZJODY_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -17,19 +20,226 @@ extern "C" {
 
 /* Maximum amount of data the algorithm can process at a time */
 #define LZJODY_BSIZE 4096
+/* Largest possible compressed block (length prefix, expansion, checksum) */
+#define LZJODY_CBSIZE (LZJODY_BSIZE + 8)
 
 /* Options for the compressor */
 #define O_FAST_LZ 0x01	/* Stop at first LZ match (faster but not recommended) */
+#define O_SA_LZ 0x02	/* Find longest LZ matches with a suffix array (slower, smaller) */
+#define O_HUFFMAN 0x04	/* Huffman code the compressed block if that makes it smaller */
+#define O_SPLIT 0x08	/* Store commands, arguments and literals as separate streams */
+#define O_CHECKSUM 0x20	/* Append a CRC-32C of the uncompressed data (also a block header flag) */
 #define O_NOPREFIX 0x40	/* Don't prefix lzjody_compress() data with the compressed length */
 #define O_REALFLUSH 0x80	/* Make lzjody_flush_literals() flush without question */
 
+/* Skip-ahead acceleration 0-15 (0 = off): after each position where
+ * nothing compresses, skip further ahead the longer the current literal
+ * run is. Faster on incompressible data at some cost in ratio. */
+#define O_ACCEL_SHIFT 8
+#define O_ACCEL_MASK 0xf00
+#define O_ACCEL(n) (((unsigned int)(n) << O_ACCEL_SHIFT) & O_ACCEL_MASK)
+
+/* Speed levels for lzjody_level_options(): 1 is fastest, 9 is smallest */
+#define LZJODY_LEVEL_MIN 1
+#define LZJODY_LEVEL_DEFAULT 6
+#define LZJODY_LEVEL_MAX 9
+
 /* Decompressor options (some copied from data block header) */
 #define O_NOCOMPRESS 0x80	/* Incompressible block packing flag */
+#define O_FARREF 0x40	/* Block refers to earlier blocks (needs a stream window) */
+
+/* History a stream window keeps for long-distance matches */
+#define LZJODY_WINDOW_SIZE 0x1000000
+
+/* Compressor statistics command types (indexes into lzjody_stats arrays) */
+#define LZJODY_ST_LIT	0	/* Literal runs */
+#define LZJODY_ST_RLE	1	/* Run-length encoding */
+#define LZJODY_ST_SEQ8	2	/* Sequential 8-bit values */
+#define LZJODY_ST_SEQ16	3	/* Sequential 16-bit values */
+#define LZJODY_ST_SEQ32	4	/* Sequential 32-bit values */
+#define LZJODY_ST_LZ	5	/* LZ (dictionary) matches */
+#define LZJODY_ST_PLANE	6	/* Byte plane transformed literal runs */
+#define LZJODY_ST_HUFF	7	/* Huffman coded blocks (bytes: command stream sizes) */
+#define LZJODY_ST_FAR	8	/* Stream window matches (calls: window searches) */
+#define LZJODY_ST_PATTERN	9	/* Repeated multi-byte pattern fills */
+#define LZJODY_ST_REF	10	/* Reference image copies (calls: reference searches) */
+#define LZJODY_ST_MAX	11
+
+/* Compressor statistics, accumulated across calls while attached to a
+ * context. Only collected if the library is built with LZJODY_STATS;
+ * cycle counts are TSC ticks on x86 and nanoseconds elsewhere. */
+struct lzjody_stats {
+	uint64_t blocks;	/* Blocks compressed */
+	uint64_t bytes_in;	/* Uncompressed bytes */
+	uint64_t bytes_out;	/* Compressed bytes */
+	uint64_t cmds[LZJODY_ST_MAX];	/* Commands emitted */
+	uint64_t cmd_bytes[LZJODY_ST_MAX];	/* Input bytes covered by commands */
+	uint64_t calls[LZJODY_ST_MAX];	/* Finder calls (plane: runs considered) */
+	uint64_t cycles[LZJODY_ST_MAX];	/* Cycles spent in finders */
+	uint64_t lz_linear;	/* LZ searches using the linear scanner */
+	uint64_t plane_skipped;	/* Byte plane retries avoided by the filter */
+	uint64_t finder_skipped;	/* Cold finder calls avoided by a quick test */
+	uint64_t index_cycles;	/* Cycles spent indexing blocks */
+	uint64_t total_cycles;	/* Cycles spent in lzjody_compress_ctx() */
+};
+
+/* Compression context: owns all compressor scratch state so that
+ * compression is reentrant when each thread uses its own context.
+ * Functions taking a context use a built-in static one for NULL. */
+struct lzjody_ctx;
+
+extern size_t lzjody_ctx_size(void);
+extern struct lzjody_ctx *lzjody_ctx_init(void * const);
+extern struct lzjody_ctx *lzjody_ctx_new(void);
+extern void lzjody_ctx_free(struct lzjody_ctx * const);
+extern int lzjody_ctx_set_stats(struct lzjody_ctx * const,
+		struct lzjody_stats * const);
+
+/* Compression trace: a function attached with lzjody_ctx_set_trace() is
+ * called for every command the context's compressor emits, in output
+ * order. Literal runs long enough for a byte plane retry report the
+ * retry first (type LZJODY_ST_PLANE); a rejected or filtered retry is
+ * followed by the literal run that was written instead. Unlike
+ * statistics, tracing is always built in; without a function attached
+ * it costs one test per command. */
+#define LZJODY_TR_REJECTED	0x01	/* Byte plane retry didn't pay off */
+#define LZJODY_TR_FILTERED	0x02	/* Byte plane retry skipped without trying */
+
+struct lzjody_trace_event {
+	uint32_t block;	/* Blocks traced before this one */
+	uint16_t pos;	/* Block offset of the first input byte covered */
+	uint16_t length;	/* Input bytes covered (LZJODY_ST_HUFF: the whole block) */
+	uint32_t offset;	/* LZ: source offset; far: distance back; pattern: period;
+				 * ref: distance from its own offset (int32_t) */
+	uint16_t out;	/* Output bytes, including control bytes */
+	uint8_t type;	/* LZJODY_ST_* */
+	uint8_t flags;	/* LZJODY_TR_* */
+};
+
+typedef void (*lzjody_trace_fn)(void *, const struct lzjody_trace_event *);
+
+extern int lzjody_ctx_set_trace(struct lzjody_ctx * const,
+		const lzjody_trace_fn, void * const);
+
+/* Stream window for long-distance matching (lzjody_window.c). Attached
+ * to a context, it lets blocks refer to data in any of the blocks that
+ * context compressed before them; such blocks carry O_FARREF and must be
+ * decompressed in order through a window with lzjody_decompress_window().
+ * A window is used by one stream at a time. */
+struct lzjody_window;
+
+extern struct lzjody_window *lzjody_window_new(void);
+extern void lzjody_window_free(struct lzjody_window * const);
+extern int lzjody_ctx_set_window(struct lzjody_ctx * const,
+		struct lzjody_window * const);
+
+/* Reference image for delta compression (lzjody_ref.c): a context with
+ * a reference attached copies data from the reference at or near each
+ * block's own offset in the stream, given as the stream offset of the
+ * next block compressed. Such blocks are still independent of each other
+ * but decompress only with lzjody_decompress_ref(), given the same
+ * reference and the block's stream offset. The reference wraps memory
+ * the caller keeps until it is freed. */
+struct lzjody_ref;
 
+extern struct lzjody_ref *lzjody_ref_new(const unsigned char * const, const uint64_t);
+extern void lzjody_ref_free(struct lzjody_ref * const);
+extern int lzjody_ctx_set_ref(struct lzjody_ctx * const,
+		const struct lzjody_ref * const, const uint64_t);
+
+/* Compressor thresholds for lzjody_ctx_set_params(); "lzjody_tune" finds
+ * good values for a corpus. Blocks compressed with any values decompress
+ * as usual. lzjody_params_default() fills in the built-in values, which
+ * contexts start with; minimum lengths can only be raised from them and
+ * are at most LZJODY_PARAM_MAX_LENGTH. */
+#define LZJODY_PARAM_MAX_LENGTH 255
+struct lzjody_params {
+	unsigned int min_lz_match;	/* Shortest LZ match (bytes) */
+	unsigned int min_rle_length;	/* Shortest byte run (bytes) */
+	unsigned int min_seq8_length;	/* Shortest sequences (values) */
+	unsigned int min_seq16_length;
+	unsigned int min_seq32_length;
+	unsigned int min_plane_length;	/* Shortest literal run retried as byte planes */
+	unsigned int max_lz_byte_scans;	/* Byte count per block above which LZ scans linearly */
+};
+
+extern void lzjody_params_default(struct lzjody_params * const);
+extern int lzjody_ctx_set_params(struct lzjody_ctx * const,
+		const struct lzjody_params * const);
+
+extern unsigned int lzjody_level_options(const int);
+
+extern int lzjody_compress_ctx(struct lzjody_ctx * const,
+		const unsigned char * const, unsigned char * const,
+		const unsigned int, const unsigned int);
 extern int lzjody_compress(const unsigned char * const, unsigned char * const,
 		const unsigned int, const unsigned int);
 extern int lzjody_decompress(const unsigned char * const, unsigned char * const,
 		const unsigned int, const unsigned int);
+extern int lzjody_decompress_window(struct lzjody_window * const,
+		const unsigned char * const, unsigned char * const,
+		const unsigned int, const unsigned int);
+extern int lzjody_decompress_ref(const struct lzjody_ref * const, const uint64_t,
+		const unsigned char * const, unsigned char * const,
+		const unsigned int, const unsigned int);
+extern int lzjody_decompress_range(const unsigned char * const, unsigned char * const,
+		const unsigned int, const unsigned int, const unsigned int, const unsigned int);
+/* In-place decompression: put a block's data at the end of a buffer of
+ * its decompressed length (or LZJODY_BSIZE) plus this margin and
+ * decompress to the start */
+extern int lzjody_inplace_margin(const unsigned char * const, const unsigned int,
+		const unsigned int);
+
+/* Predict lzjody_compress() output size without compressing (lzjody_estimate.c) */
+extern int lzjody_estimate(const unsigned char * const, const unsigned int,
+		const unsigned int);
+
+/* Asynchronous jobs on a pool of worker threads (lzjody_queue.c). A
+ * compress job turns length bytes of input into the length-prefixed
+ * blocks that "lzjody -c" writes (O_NOPREFIX is ignored); a decompress
+ * job turns such blocks back into data. The caller owns a job and its
+ * buffers from submission until its callback runs or it is reaped. */
+#define LZJODY_JOB_COMPRESS 0
+#define LZJODY_JOB_DECOMPRESS 1
+
+/* Output space a compress job needs for n input bytes */
+#define LZJODY_JOB_BOUND(n) ((((size_t)(n) + LZJODY_BSIZE - 1) / LZJODY_BSIZE) * LZJODY_CBSIZE)
+
+struct lzjody_job {
+	int type;	/* LZJODY_JOB_COMPRESS or LZJODY_JOB_DECOMPRESS */
+	unsigned int options;	/* Compressor options */
+	const unsigned char *in;
+	size_t length;	/* Bytes at in */
+	unsigned char *out;
+	size_t out_size;	/* Space at out */
+	/* Run on a worker thread when the job is done; NULL queues the
+	 * job for lzjody_queue_reap() instead */
+	void (*done)(struct lzjody_job *);
+	void *token;	/* For the caller; never touched */
+	int64_t result;	/* Output length or -1 on error, once done */
+	struct lzjody_job *next;	/* Used by the queue */
+};
+
+struct lzjody_queue;
+
+extern struct lzjody_queue *lzjody_queue_new(unsigned int, unsigned int);
+extern int lzjody_queue_submit(struct lzjody_queue * const, struct lzjody_job * const);
+extern unsigned int lzjody_queue_reap(struct lzjody_queue * const,
+		struct lzjody_job ** const, const unsigned int, const int);
+extern int lzjody_queue_fd(const struct lzjody_queue * const);
+extern void lzjody_queue_free(struct lzjody_queue * const);
+
+/* Random access reader for streams written by "lzjody -c" (lzjody_file.c).
+ * A handle may be shared by threads; all of them use one block cache. */
+struct lzjody_file;
+
+extern struct lzjody_file *lzjody_open(const char * const, unsigned int);
+extern struct lzjody_file *lzjody_open_ref(const char * const, unsigned int,
+		const struct lzjody_ref * const);
+extern uint64_t lzjody_file_size(const struct lzjody_file * const);
+extern int64_t lzjody_pread(struct lzjody_file * const, void * const,
+		const size_t, const uint64_t);
+extern void lzjody_close(struct lzjody_file * const);
 
 #ifdef __cplusplus
 }
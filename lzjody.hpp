@@ -0,0 +1,271 @@
+/*
+ * Lempel-Ziv-JodyBruchon compression library: C++ interface
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * See lzjody.c for license information.
+ *
+ * Header-only C++20 wrapper around lzjody.h. Compressors own a context
+ * and decompressors own one block of scratch space; both are allocated
+ * once by the constructor through the given allocator, so compressing
+ * and decompressing never allocate. Objects are move-only and can be
+ * kept per thread or pooled. Use lzjody::pmr::compressor and friends
+ * for std::pmr memory resources.
+ *
+ * Failures throw lzjody::error (the library also reports details on
+ * stderr); buffers that are too small throw std::length_error.
+ */
+
+#ifndef LZJODY_HPP
+#define LZJODY_HPP
+
+#if __cplusplus < 202002L
+ #error "lzjody.hpp requires C++20"
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include "lzjody.h"
+
+namespace lzjody {
+
+/* Largest uncompressed block */
+inline constexpr std::size_t max_block_size = LZJODY_BSIZE;
+/* Largest compressed block including its length prefix */
+inline constexpr std::size_t max_compressed_size = LZJODY_CBSIZE;
+
+/* Output space compress() needs for n input bytes */
+constexpr std::size_t compress_bound(const std::size_t n, const unsigned int options = 0) noexcept
+{
+	return n + 4 + ((options & O_CHECKSUM) ? 4 : 0);
+}
+
+class error : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
+
+namespace detail {
+
+/* Allocate n bytes aligned for any type from a byte allocator */
+template <typename Allocator>
+class raw_buffer {
+	using unit = std::max_align_t;
+	using alloc_type = typename std::allocator_traits<Allocator>::template rebind_alloc<unit>;
+	using traits = std::allocator_traits<alloc_type>;
+
+public:
+	raw_buffer(const std::size_t size, const Allocator &alloc)
+		: alloc_(alloc), units_((size + sizeof(unit) - 1) / sizeof(unit)),
+		p_(traits::allocate(alloc_, units_)) {}
+	raw_buffer(raw_buffer &&other) noexcept
+		: alloc_(std::move(other.alloc_)), units_(other.units_),
+		p_(std::exchange(other.p_, nullptr)) {}
+	raw_buffer(const raw_buffer &) = delete;
+	raw_buffer &operator=(const raw_buffer &) = delete;
+	raw_buffer &operator=(raw_buffer &&) = delete;
+	~raw_buffer() { if (p_) traits::deallocate(alloc_, p_, units_); }
+
+	void *get() const noexcept { return p_; }
+	Allocator get_allocator() const { return Allocator(alloc_); }
+
+	/* Take other's memory if the allocators allow it; returns false
+	 * (leaving both unchanged) if the memory has to stay with other */
+	bool steal(raw_buffer &other) noexcept
+	{
+		constexpr bool pocma = traits::propagate_on_container_move_assignment::value;
+		if (!pocma && !(alloc_ == other.alloc_)) return false;
+		if (p_) traits::deallocate(alloc_, p_, units_);
+		if constexpr (pocma) alloc_ = std::move(other.alloc_);
+		units_ = other.units_;
+		p_ = std::exchange(other.p_, nullptr);
+		return true;
+	}
+
+private:
+	alloc_type alloc_;
+	std::size_t units_;
+	unit *p_;
+};
+
+inline unsigned int block_length(const std::span<const unsigned char> block)
+{
+	if (block.size() < 2) throw error("lzjody: block shorter than its prefix");
+	return (static_cast<unsigned int>(block[0] & 0x1f) << 8) | block[1];
+}
+
+} /* namespace detail */
+
+/* Block compressor owning a compression context */
+template <typename Allocator = std::allocator<std::byte>>
+class basic_compressor {
+public:
+	using allocator_type = Allocator;
+
+	explicit basic_compressor(const unsigned int options = 0, const Allocator &alloc = Allocator())
+		: mem_(lzjody_ctx_size(), alloc),
+		ctx_(lzjody_ctx_init(mem_.get())), options_(options) {}
+	basic_compressor(basic_compressor &&other) noexcept
+		: mem_(std::move(other.mem_)), ctx_(std::exchange(other.ctx_, nullptr)),
+		options_(other.options_), stats_(other.stats_) {}
+	basic_compressor(const basic_compressor &) = delete;
+	basic_compressor &operator=(const basic_compressor &) = delete;
+	basic_compressor &operator=(basic_compressor &&other)
+	{
+		if (this == &other) return *this;
+		/* Contexts carry no data between blocks that must survive a
+		 * move, so unequal allocators just keep this context, or make
+		 * a new one if this object was moved from */
+		if (mem_.steal(other.mem_)) ctx_ = std::exchange(other.ctx_, nullptr);
+		else {
+			if (!mem_.get()) {
+				detail::raw_buffer<Allocator> fresh(lzjody_ctx_size(), mem_.get_allocator());
+				mem_.steal(fresh);
+			}
+			ctx_ = lzjody_ctx_init(mem_.get());
+		}
+		options_ = other.options_;
+		stats_ = other.stats_;
+		if (ctx_) lzjody_ctx_set_stats(ctx_, stats_);
+		return *this;
+	}
+	~basic_compressor() = default;
+
+	/* Compress one block of up to max_block_size bytes into out, which
+	 * must hold compress_bound(in.size(), options()) bytes. Returns the
+	 * part of out that was written. A moved-from compressor throws. */
+	std::span<unsigned char> compress(const std::span<const unsigned char> in,
+			const std::span<unsigned char> out)
+	{
+		/* Never fall back on the library's shared default context */
+		if (!ctx_) throw error("lzjody: compressor has no context (moved from)");
+		if (in.empty() || in.size() > max_block_size)
+			throw std::length_error("lzjody: block size out of range");
+		if (out.size() < compress_bound(in.size(), options_))
+			throw std::length_error("lzjody: compression output buffer too small");
+		const int len = lzjody_compress_ctx(ctx_, in.data(), out.data(),
+				options_, static_cast<unsigned int>(in.size()));
+		if (len < 0) throw error("lzjody: compression failed");
+		return out.first(static_cast<std::size_t>(len));
+	}
+
+	std::span<std::byte> compress(const std::span<const std::byte> in,
+			const std::span<std::byte> out)
+	{
+		const auto r = compress(std::span<const unsigned char>(reinterpret_cast<const unsigned char *>(in.data()), in.size()),
+				std::span<unsigned char>(reinterpret_cast<unsigned char *>(out.data()), out.size()));
+		return out.first(r.size());
+	}
+
+	unsigned int options() const noexcept { return options_; }
+	void set_options(const unsigned int options) noexcept { options_ = options; }
+
+	/* Attach statistics (see lzjody.h); false if built without them */
+	bool set_stats(lzjody_stats * const stats) noexcept
+	{
+		stats_ = stats;
+		return ctx_ && lzjody_ctx_set_stats(ctx_, stats) == 0;
+	}
+
+	lzjody_ctx *native_handle() const noexcept { return ctx_; }
+	allocator_type get_allocator() const { return mem_.get_allocator(); }
+
+private:
+	detail::raw_buffer<Allocator> mem_;
+	lzjody_ctx *ctx_;
+	unsigned int options_;
+	lzjody_stats *stats_ = nullptr;
+};
+
+/* Decompressor for length-prefixed blocks as written by compress().
+ * Blocks decode straight into out when it can hold max_block_size
+ * bytes and through the owned scratch block otherwise. */
+template <typename Allocator = std::allocator<std::byte>>
+class basic_decompressor {
+public:
+	using allocator_type = Allocator;
+
+	explicit basic_decompressor(const Allocator &alloc = Allocator())
+		: mem_(max_block_size, alloc) {}
+	basic_decompressor(basic_decompressor &&) noexcept = default;
+	basic_decompressor(const basic_decompressor &) = delete;
+	basic_decompressor &operator=(const basic_decompressor &) = delete;
+	basic_decompressor &operator=(basic_decompressor &&other)
+	{
+		/* Scratch contents never matter; keep ours if we can't steal,
+		 * or make new scratch if this object was moved from */
+		if (this == &other) return *this;
+		if (!mem_.steal(other.mem_) && !mem_.get()) {
+			detail::raw_buffer<Allocator> fresh(max_block_size, mem_.get_allocator());
+			mem_.steal(fresh);
+		}
+		return *this;
+	}
+	~basic_decompressor() = default;
+
+	/* Total size (prefix included) of the block at the start of data */
+	static std::size_t block_size(const std::span<const unsigned char> data)
+	{
+		return 2 + static_cast<std::size_t>(detail::block_length(data));
+	}
+
+	/* Decompress the block at the start of "block" into out and return
+	 * the part of out that was written. A moved-from decompressor throws. */
+	std::span<unsigned char> decompress(const std::span<const unsigned char> block,
+			const std::span<unsigned char> out)
+	{
+		if (!mem_.get()) throw error("lzjody: decompressor has no scratch block (moved from)");
+		const unsigned int length = detail::block_length(block);
+		const unsigned int options = block[0] & 0xe0;
+		const unsigned char * const payload = block.data() + 2;
+		unsigned char * const scratch = static_cast<unsigned char *>(mem_.get());
+		int len;
+
+		if (block.size() - 2 < length)
+			throw error("lzjody: block is truncated");
+		if (options & O_NOCOMPRESS) {
+			if (out.size() < length) throw std::length_error("lzjody: output buffer too small");
+			std::copy(payload, payload + length, out.data());
+			return out.first(length);
+		}
+		if (out.size() >= max_block_size) {
+			len = lzjody_decompress(payload, out.data(), length, options);
+			if (len < 0) throw error("lzjody: corrupt compressed block");
+			return out.first(static_cast<std::size_t>(len));
+		}
+		len = lzjody_decompress(payload, scratch, length, options);
+		if (len < 0) throw error("lzjody: corrupt compressed block");
+		if (out.size() < static_cast<std::size_t>(len)) throw std::length_error("lzjody: output buffer too small");
+		std::copy(scratch, scratch + len, out.data());
+		return out.first(static_cast<std::size_t>(len));
+	}
+
+	std::span<std::byte> decompress(const std::span<const std::byte> block,
+			const std::span<std::byte> out)
+	{
+		const auto r = decompress(std::span<const unsigned char>(reinterpret_cast<const unsigned char *>(block.data()), block.size()),
+				std::span<unsigned char>(reinterpret_cast<unsigned char *>(out.data()), out.size()));
+		return out.first(r.size());
+	}
+
+	allocator_type get_allocator() const { return mem_.get_allocator(); }
+
+private:
+	detail::raw_buffer<Allocator> mem_;
+};
+
+using compressor = basic_compressor<>;
+using decompressor = basic_decompressor<>;
+
+namespace pmr {
+using compressor = basic_compressor<std::pmr::polymorphic_allocator<std::byte>>;
+using decompressor = basic_decompressor<std::pmr::polymorphic_allocator<std::byte>>;
+} /* namespace pmr */
+
+} /* namespace lzjody */
+
+#endif	/* LZJODY_HPP */
@@ -0,0 +1,355 @@
+/*
+ * Lempel-Ziv-JodyBruchon compression utility
+ * Compressing and decompressing many files on one worker pool
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ *
+ * "lzjody -c file..." and "lzjody -d file..." push every file through a
+ * single lzjody_queue. Files are read one after another in pieces of
+ * BATCH_JOB_BLOCKS blocks, so the end of one file and the start of the
+ * next are in flight together and all workers stay busy however the
+ * file sizes vary. Each job remembers its file and sequence number; the
+ * main thread writes finished jobs in order, holding back any that
+ * finish before the jobs ahead of them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "lzjody.h"
+#include "lzjody_util.h"
+
+/* Outputs must not be text mode on Windows */
+#ifndef O_BINARY
+ #define O_BINARY 0
+#endif
+
+/* Blocks in each job, and job slots per worker thread */
+#define BATCH_JOB_BLOCKS 16
+#define BATCH_SLOTS_PER_THREAD 4
+/* Space for a job's input and output in either direction */
+#define BATCH_IN_SIZE (BATCH_JOB_BLOCKS * (LZJODY_CBSIZE + 2))
+#define BATCH_OUT_SIZE (BATCH_JOB_BLOCKS * LZJODY_CBSIZE)
+/* Finished jobs taken from the queue at a time */
+#define BATCH_REAP 16
+/* Longest line accepted in a list file */
+#define BATCH_LINE_MAX 4096
+
+#define SLOT_FREE 0
+#define SLOT_BUSY 1
+#define SLOT_DONE 2
+
+struct batch_file {
+	const char *name;	/* Input file */
+	char *out_name;	/* Output file */
+	FILE *in;
+	FILE *out;
+	unsigned int submitted;	/* Jobs submitted so far */
+	unsigned int written;	/* Jobs written so far, in order */
+	int eof;	/* All input has been submitted */
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+};
+
+struct batch_slot {
+	struct lzjody_job job;
+	struct batch_file *file;
+	unsigned int seq;	/* Job number within the file */
+	int state;
+	unsigned char in[BATCH_IN_SIZE];
+	unsigned char out[BATCH_OUT_SIZE];
+};
+
+
+/* Add a file to the list of files to process */
+extern int batch_add_name(struct batch_names * const list, const char * const name)
+{
+	const char **p;
+
+	if (list->count == list->alloc) {
+		list->alloc = list->alloc ? list->alloc * 2 : 16;
+		p = (const char **)realloc(list->name, (size_t)list->alloc * sizeof(const char *));
+		if (!p) goto error_oom;
+		list->name = p;
+	}
+	list->name[list->count++] = name;
+	return 0;
+
+error_oom:
+	fprintf(stderr, "lzjody: out of memory\n");
+	return -1;
+}
+
+
+/* Add every file named in a list file, one per line ("-" is stdin) */
+extern int batch_read_list(struct batch_names * const list, const char * const path)
+{
+	char line[BATCH_LINE_MAX];
+	char *name;
+	FILE *fp;
+	size_t len;
+
+	fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!fp) goto error_open;
+	while (fgets(line, BATCH_LINE_MAX, fp)) {
+		len = strlen(line);
+		if ((len == BATCH_LINE_MAX - 1) && (line[len - 1] != '\n')) goto error_long;
+		while ((len > 0) && ((line[len - 1] == '\n') || (line[len - 1] == '\r'))) len--;
+		if (len == 0) continue;
+		line[len] = '\0';
+		name = strdup(line);
+		if (!name || (batch_add_name(list, name) < 0)) goto error;
+	}
+	if (ferror(fp)) goto error_open;
+	if (fp != stdin) fclose(fp);
+	return 0;
+
+error_long:
+	fprintf(stderr, "lzjody: %s: line too long\n", path);
+	goto error;
+error_open:
+	fprintf(stderr, "lzjody: %s: cannot read list\n", path);
+error:
+	if (fp && (fp != stdin)) fclose(fp);
+	return -1;
+}
+
+
+/* Open a file's input and create its output, which must not exist */
+static int open_file(struct batch_file * const f, const char mode)
+{
+	const size_t len = strlen(f->name);
+	const size_t slen = strlen(LZJODY_SUFFIX);
+	int fd;
+
+	if (mode == 'c') {
+		f->out_name = (char *)malloc(len + slen + 1);
+		if (!f->out_name) goto error_oom;
+		memcpy(f->out_name, f->name, len);
+		memcpy(f->out_name + len, LZJODY_SUFFIX, slen + 1);
+	} else {
+		if ((len <= slen) || strcmp(f->name + len - slen, LZJODY_SUFFIX)) goto error_suffix;
+		f->out_name = (char *)malloc(len - slen + 1);
+		if (!f->out_name) goto error_oom;
+		memcpy(f->out_name, f->name, len - slen);
+		f->out_name[len - slen] = '\0';
+	}
+
+	f->in = fopen(f->name, "rb");
+	if (!f->in) goto error_open;
+	fd = open(f->out_name, O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0644);
+	if (fd < 0) goto error_create;
+	f->out = fdopen(fd, "wb");
+	if (!f->out) {
+		close(fd);
+		unlink(f->out_name);
+		goto error_create;
+	}
+	return 0;
+
+error_oom:
+	fprintf(stderr, "lzjody: out of memory\n");
+	return -1;
+error_suffix:
+	fprintf(stderr, "lzjody: %s: name does not end in %s\n", f->name, LZJODY_SUFFIX);
+	return -1;
+error_open:
+	fprintf(stderr, "lzjody: %s: cannot open\n", f->name);
+	return -1;
+error_create:
+	fprintf(stderr, "lzjody: %s: cannot create (does it exist already?)\n", f->out_name);
+	return -1;
+}
+
+
+/* Read whole length-prefixed blocks for a decompression job
+ * Returns the bytes read, 0 at the end of the file, or -1 on error */
+static int read_blocks(struct batch_file * const f, unsigned char * const buf)
+{
+	unsigned int length;
+	int total = 0, i;
+	size_t n;
+
+	for (i = 0; i < BATCH_JOB_BLOCKS; i++) {
+		n = fread(buf + total, 1, 2, f->in);
+		if (n == 0 && !ferror(f->in)) break;
+		if (n != 2) goto error_read;
+		/* Far references need every earlier block decoded first */
+		if (buf[total] & O_FARREF) goto error_farref;
+		length = ((unsigned int)(buf[total] & 0x1f) << 8) | buf[total + 1];
+		if (length > LZJODY_CBSIZE) goto error_read;
+		if (fread(buf + total + 2, 1, length, f->in) != length) goto error_read;
+		total += 2 + (int)length;
+	}
+	return total;
+
+error_read:
+	fprintf(stderr, "lzjody: %s: read error or damaged block\n", f->name);
+	return -1;
+error_farref:
+	fprintf(stderr, "lzjody: %s: compressed with -l; use lzjody -d < %s\n",
+			f->name, f->name);
+	return -1;
+}
+
+
+/* Close a file whose jobs have all been written */
+static int finish_file(struct batch_file * const f, const int verbose)
+{
+	int err = 0;
+
+	fclose(f->in);
+	f->in = NULL;
+	if (fclose(f->out) != 0) err = -1;
+	f->out = NULL;
+	if (err < 0) goto error_write;
+	if (verbose) fprintf(stderr, "lzjody: %s: %llu -> %llu bytes\n", f->name,
+			(unsigned long long)f->bytes_in, (unsigned long long)f->bytes_out);
+	return 0;
+
+error_write:
+	fprintf(stderr, "lzjody: %s: write error\n", f->out_name);
+	unlink(f->out_name);
+	return -1;
+}
+
+
+/* Write a file's finished jobs that are next in line */
+static int write_ready(struct batch_slot * const slots, const int nslots,
+		struct batch_file * const f, const int verbose)
+{
+	struct batch_slot *s;
+	int i;
+
+	while (1) {
+		for (i = 0; i < nslots; i++) {
+			s = slots + i;
+			if ((s->state == SLOT_DONE) && (s->file == f) && (s->seq == f->written)) break;
+		}
+		if (i == nslots) break;
+		if (fwrite(s->out, 1, (size_t)s->job.result, f->out) != (size_t)s->job.result)
+			goto error_write;
+		f->bytes_in += s->job.length;
+		f->bytes_out += (uint64_t)s->job.result;
+		f->written++;
+		s->state = SLOT_FREE;
+	}
+	if (f->eof && (f->written == f->submitted)) return finish_file(f, verbose);
+	return 0;
+
+error_write:
+	fprintf(stderr, "lzjody: %s: write error\n", f->out_name);
+	return -1;
+}
+
+
+/* Compress (mode 'c') or decompress (mode 'd') each named file to a
+ * new file with LZJODY_SUFFIX added or removed */
+extern int batch_files(const char mode, const struct batch_names * const list,
+		const unsigned int options, const int verbose)
+{
+	const int count = list->count;
+	struct lzjody_queue *q = NULL;
+	struct lzjody_job *done[BATCH_REAP];
+	struct batch_file *files, *f;
+	struct batch_slot *slots = NULL, *s;
+	int nprocs = 1, nslots, in_flight = 0, cur = 0, i, n, k;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	nprocs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nprocs < 1) nprocs = 1;
+#endif
+	nslots = nprocs * BATCH_SLOTS_PER_THREAD;
+
+	files = (struct batch_file *)calloc((size_t)count, sizeof(struct batch_file));
+	slots = (struct batch_slot *)calloc((size_t)nslots, sizeof(struct batch_slot));
+	if (!files || !slots) goto error_oom;
+	for (i = 0; i < count; i++) files[i].name = list->name[i];
+	q = lzjody_queue_new((unsigned int)nprocs, (unsigned int)nslots);
+	if (!q) goto error;
+
+	while (1) {
+		/* Keep every free slot busy with the next piece of input */
+		for (i = 0; (i < nslots) && (cur < count); i++) {
+			s = slots + i;
+			if (s->state != SLOT_FREE) continue;
+			f = files + cur;
+			if (!f->in && (open_file(f, mode) < 0)) goto error;
+			if (mode == 'c') {
+				n = (int)fread(s->in, 1, BATCH_JOB_BLOCKS * LZJODY_BSIZE, f->in);
+				if (ferror(f->in)) goto error_read;
+			} else {
+				n = read_blocks(f, s->in);
+				if (n < 0) goto error;
+			}
+			if (n == 0) {
+				f->eof = 1;
+				if ((f->written == f->submitted) && (finish_file(f, verbose) < 0)) goto error;
+				cur++;
+				/* Look at this slot again for the next file */
+				i--;
+				continue;
+			}
+			s->job.type = (mode == 'c') ? LZJODY_JOB_COMPRESS : LZJODY_JOB_DECOMPRESS;
+			s->job.options = options;
+			s->job.in = s->in;
+			s->job.length = (size_t)n;
+			s->job.out = s->out;
+			s->job.out_size = BATCH_OUT_SIZE;
+			s->job.done = NULL;
+			s->job.token = s;
+			s->file = f;
+			s->seq = f->submitted++;
+			s->state = SLOT_BUSY;
+			if (lzjody_queue_submit(q, &s->job) != 0) goto error;
+			in_flight++;
+		}
+		if (in_flight == 0) break;
+
+		n = (int)lzjody_queue_reap(q, done, BATCH_REAP, 1);
+		for (k = 0; k < n; k++) {
+			s = (struct batch_slot *)done[k]->token;
+			in_flight--;
+			if (s->job.result < 0) {
+				fprintf(stderr, "lzjody: %s: cannot %s\n", s->file->name,
+						(mode == 'c') ? "compress" : "decompress");
+				goto error;
+			}
+			s->state = SLOT_DONE;
+		}
+		for (k = 0; k < n; k++) {
+			s = (struct batch_slot *)done[k]->token;
+			if (s->file->out && (write_ready(slots, nslots, s->file, verbose) < 0)) goto error;
+		}
+	}
+
+	lzjody_queue_free(q);
+	for (i = 0; i < count; i++) free(files[i].out_name);
+	free(slots);
+	free(files);
+	return 0;
+
+error_read:
+	fprintf(stderr, "lzjody: %s: read error\n", f->name);
+	goto error;
+error_oom:
+	fprintf(stderr, "lzjody: out of memory\n");
+error:
+	/* Outputs that were not finished are removed */
+	lzjody_queue_free(q);
+	if (files) for (i = 0; i < count; i++) {
+		if (files[i].in) fclose(files[i].in);
+		if (files[i].out) {
+			fclose(files[i].out);
+			unlink(files[i].out_name);
+		}
+		free(files[i].out_name);
+	}
+	free(slots);
+	free(files);
+	return -1;
+}
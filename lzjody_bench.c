@@ -0,0 +1,670 @@
+/*
+ * Lempel-Ziv-JodyBruchon compression library
+ * In-process benchmark with synthetic disk image corpora
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ *
+ * Every corpus is split into LZJODY_BSIZE blocks and run through
+ * lzjody_compress() and lzjody_decompress() several times; the fastest
+ * pass is reported. Results are written to stdout as JSON so that runs
+ * from different releases can be compared by scripts. With -q the corpus
+ * is also run through a job queue in QUEUE_JOB_SIZE jobs to measure how
+ * the worker pool scales.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "lzjody.h"
+
+#define BENCH_VER "0.1"
+#define BENCH_VERDATE "2020-07-14"
+
+/* Default size of each generated corpus and timed passes per corpus */
+#define DEF_CORPUS_SIZE (4 * 1024 * 1024)
+#define DEF_PASSES 3
+
+struct corpus_t {
+	const char *name;
+	unsigned char *data;
+	size_t length;
+};
+
+/* Working buffers shared by all corpora */
+static unsigned char *comp;	/* Compressed blocks, LZJODY_BSIZE + 4 apart */
+static int *comp_len;	/* Compressed length of each block */
+static unsigned char *dec;	/* Decompressed output */
+static int range_reads;	/* Also time RANGE_READ_SIZE reads (-r) */
+static int *est_len;	/* lzjody_estimate() of each block (-m) */
+static int estimates;	/* Also check lzjody_estimate() accuracy (-m) */
+static struct lzjody_queue *queue;	/* Job queue for -q, or NULL */
+static struct lzjody_job *qjob;	/* One job per QUEUE_JOB_SIZE of a corpus */
+static unsigned char *qcomp;	/* Compressed jobs, QUEUE_JOB_BOUND apart */
+static int64_t *qcomp_len;	/* Compressed length of each job */
+
+/* Size of the partial block reads timed by -r */
+#define RANGE_READ_SIZE 512
+/* Estimate error band (fraction of the block size) reported by -m */
+#define ESTIMATE_BAND 0.10
+/* Input size of each job run by -q and the output space it may need */
+#define QUEUE_JOB_SIZE (64 * 1024)
+#define QUEUE_JOB_BOUND LZJODY_JOB_BOUND(QUEUE_JOB_SIZE)
+/* Finished jobs taken from the queue at a time */
+#define QUEUE_REAP 16
+
+/* Simple deterministic PRNG (xorshift64*) so corpora are reproducible */
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static inline uint64_t rng(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static inline unsigned int rng_range(const unsigned int max)
+{
+	return (unsigned int)(rng() % max);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/*** Corpus generators ***/
+
+static void gen_random(unsigned char *p, size_t len)
+{
+	while (len--) *p++ = (unsigned char)(rng() >> 56);
+}
+
+static const char * const words[] = {
+	"the", "of", "and", "to", "a", "in", "is", "it", "that", "for",
+	"file", "system", "block", "data", "disk", "image", "error", "kernel",
+	"device", "mount", "user", "root", "config", "value", "return", "with",
+	"partition", "sector", "compression", "buffer", "network", "address",
+	"version", "package", "library", "default", "option", "service",
+	"/usr/lib", "/etc/fstab", "0x1000", "2020-07-14", "INFO:", "WARNING:"
+};
+#define NUM_WORDS (sizeof(words) / sizeof(char *))
+
+/* Log files, configuration and documentation */
+static void gen_text(unsigned char *p, size_t len)
+{
+	size_t pos = 0;
+	unsigned int linelen = 0;
+	const char *w;
+	size_t wl;
+
+	while (pos < len) {
+		/* Skew word choice toward the start of the list */
+		w = words[rng_range(rng_range(NUM_WORDS) + 1)];
+		wl = strlen(w);
+		if (pos + wl + 1 > len) break;
+		memcpy(p + pos, w, wl);
+		pos += wl;
+		linelen += (unsigned int)wl + 1;
+		if (linelen > 60 + rng_range(16)) {
+			p[pos++] = '\n';
+			linelen = 0;
+		} else p[pos++] = ' ';
+	}
+	while (pos < len) p[pos++] = '\n';
+}
+
+/* Mostly empty image: zero blocks with scattered sparse data */
+static void gen_zero(unsigned char *p, size_t len)
+{
+	size_t pos;
+	unsigned int i;
+
+	memset(p, 0, len);
+	for (pos = 0; pos + LZJODY_BSIZE <= len; pos += LZJODY_BSIZE) {
+		i = rng_range(100);
+		/* 80% of blocks stay completely empty */
+		if (i < 80) continue;
+		if (i < 90) {
+			/* Partially written block with a zero tail */
+			gen_text(p + pos, rng_range(LZJODY_BSIZE / 2) + 16);
+		} else if (i < 95) {
+			/* A few stray words such as a boot signature */
+			p[pos + 510] = 0x55;
+			p[pos + 511] = 0xaa;
+			gen_random(p + pos + 0x1b8, 6);
+		} else gen_random(p + pos + rng_range(LZJODY_BSIZE - 64), 64);
+	}
+}
+
+/* Filesystem metadata: inode tables, block bitmaps and directory entries */
+static void gen_fsmeta(unsigned char *p, size_t len)
+{
+	size_t pos = 0;
+	uint32_t inode = 12;
+	uint32_t mtime = 1594684800;
+	uint32_t blockno = 0x8000;
+	unsigned int kind, i;
+
+	while (pos + LZJODY_BSIZE <= len) {
+		unsigned char *b = p + pos;
+
+		memset(b, 0, LZJODY_BSIZE);
+		kind = rng_range(4);
+		if (kind < 2) {
+			/* Inode table: 128-byte records */
+			for (i = 0; i < LZJODY_BSIZE; i += 128) {
+				uint16_t mode = (rng_range(4) == 0) ? 0x41ed : 0x81a4;
+				uint32_t size = rng_range(65536);
+				uint32_t t = mtime + rng_range(4096);
+
+				memcpy(b + i, &mode, 2);
+				memcpy(b + i + 4, &size, 4);
+				memcpy(b + i + 8, &t, 4);
+				memcpy(b + i + 12, &t, 4);
+				memcpy(b + i + 16, &t, 4);
+				b[i + 26] = 1;
+				memcpy(b + i + 40, &blockno, 4);
+				blockno += (size >> 12) + 1;
+				memcpy(b + i + 100, &inode, 4);
+				inode++;
+			}
+			mtime += 600;
+		} else if (kind == 2) {
+			/* Allocation bitmap: long runs of set bits */
+			i = rng_range(LZJODY_BSIZE);
+			memset(b, 0xff, i);
+			if (i < LZJODY_BSIZE) b[i] = (unsigned char)(0xff >> rng_range(8));
+		} else {
+			/* Directory entries: inode, rec_len, name_len, type, name */
+			i = 0;
+			while (i + 32 <= LZJODY_BSIZE) {
+				const char *w = words[rng_range(NUM_WORDS)];
+				size_t wl = strlen(w);
+				uint16_t rec = (uint16_t)((8 + wl + 3) & ~3U);
+
+				memcpy(b + i, &inode, 4);
+				inode++;
+				memcpy(b + i + 4, &rec, 2);
+				b[i + 6] = (unsigned char)wl;
+				b[i + 7] = (unsigned char)(1 + rng_range(2));
+				memcpy(b + i + 8, w, wl);
+				i += rec;
+			}
+		}
+		pos += LZJODY_BSIZE;
+	}
+	if (pos < len) memset(p + pos, 0, len - pos);
+}
+
+/* Executable code: repetitive instruction idioms with random operands */
+static void gen_exec(unsigned char *p, size_t len)
+{
+	static const unsigned char prologue[] = { 0x55, 0x48, 0x89, 0xe5, 0x41, 0x57, 0x41, 0x56 };
+	static const unsigned char epilogue[] = { 0x41, 0x5e, 0x41, 0x5f, 0x5d, 0xc3 };
+	size_t pos = 0;
+	unsigned int i, n;
+
+	while (pos + 32 < len) {
+		switch (rng_range(8)) {
+		case 0:
+			memcpy(p + pos, prologue, sizeof(prologue));
+			pos += sizeof(prologue);
+			break;
+		case 1:
+			memcpy(p + pos, epilogue, sizeof(epilogue));
+			pos += sizeof(epilogue);
+			/* Alignment padding */
+			n = rng_range(12);
+			memset(p + pos, 0xcc, n);
+			pos += n;
+			break;
+		case 2:
+			/* call rel32 */
+			p[pos++] = 0xe8;
+			gen_random(p + pos, 2);
+			p[pos + 2] = 0xff;
+			p[pos + 3] = 0xff;
+			pos += 4;
+			break;
+		case 3:
+			/* mov reg, [rbp-disp8] */
+			p[pos++] = 0x48;
+			p[pos++] = 0x8b;
+			p[pos++] = (unsigned char)(0x45 + (rng_range(4) << 3));
+			p[pos++] = (unsigned char)(0xf8 - (rng_range(8) << 3));
+			break;
+		case 4:
+			/* mov reg, imm32 with a small constant */
+			p[pos++] = (unsigned char)(0xb8 + rng_range(8));
+			p[pos++] = (unsigned char)rng_range(64);
+			p[pos++] = 0; p[pos++] = 0; p[pos++] = 0;
+			break;
+		case 5:
+			/* Relocation/pointer table entries */
+			n = 1 + rng_range(6);
+			for (i = 0; i < n; i++) {
+				uint64_t ptr = 0x401000 + ((uint64_t)rng_range(0x4000) << 4);
+				memcpy(p + pos, &ptr, 8);
+				pos += 8;
+			}
+			break;
+		default:
+			/* Short random instruction bytes */
+			n = 1 + rng_range(6);
+			gen_random(p + pos, n);
+			pos += n;
+			break;
+		}
+	}
+	while (pos < len) p[pos++] = 0xcc;
+}
+
+/* Column-structured tables that only compress after a byte plane transform */
+static void gen_tables(unsigned char *p, size_t len)
+{
+	size_t pos = 0;
+	uint8_t counter = (uint8_t)rng();
+	uint8_t flags = 0x80;
+
+	while (pos + 4 <= len) {
+		if ((pos & (LZJODY_BSIZE - 1)) == 0) flags = (uint8_t)rng();
+		p[pos] = counter++;
+		p[pos + 1] = 0xff;
+		p[pos + 2] = flags;
+		p[pos + 3] = (unsigned char)(0xb0 + rng_range(0x40));
+		pos += 4;
+	}
+	while (pos < len) p[pos++] = 0;
+}
+
+static const struct {
+	const char *name;
+	void (*gen)(unsigned char *, size_t);
+} generators[] = {
+	{ "zero", gen_zero },
+	{ "fsmeta", gen_fsmeta },
+	{ "text", gen_text },
+	{ "exec", gen_exec },
+	{ "random", gen_random },
+	{ "tables", gen_tables },
+	{ NULL, NULL }
+};
+
+
+/* Load a user-supplied corpus from a file */
+static int load_file(struct corpus_t * const c, const char * const name)
+{
+	FILE *fp;
+	long size;
+
+	fp = fopen(name, "rb");
+	if (!fp) goto error_open;
+	if (fseek(fp, 0, SEEK_END) != 0) goto error_read;
+	size = ftell(fp);
+	if (size <= 0) goto error_read;
+	rewind(fp);
+	c->data = (unsigned char *)malloc((size_t)size);
+	if (!c->data) goto error_read;
+	if (fread(c->data, 1, (size_t)size, fp) != (size_t)size) goto error_read;
+	fclose(fp);
+	c->name = name;
+	c->length = (size_t)size;
+	return 0;
+
+error_read:
+	fclose(fp);
+error_open:
+	fprintf(stderr, "lzjody_bench: cannot load corpus file %s\n", name);
+	return -1;
+}
+
+/* Compress a corpus or decompress its compressed jobs through the job
+ * queue, submitting until the queue pushes back and then reaping
+ * Returns the elapsed nanoseconds, or 0 if a job failed */
+static uint64_t queue_pass(const struct corpus_t * const c,
+		const unsigned int options, const int type)
+{
+	const size_t jobs = (c->length + QUEUE_JOB_SIZE - 1) / QUEUE_JOB_SIZE;
+	struct lzjody_job *done[QUEUE_REAP];
+	struct lzjody_job *job;
+	size_t next = 0, finished = 0, idx;
+	uint64_t t;
+	unsigned int n, k;
+	int r;
+
+	t = now_ns();
+	while (finished < jobs) {
+		for (; next < jobs; next++) {
+			job = qjob + next;
+			job->type = type;
+			job->options = options;
+			job->done = NULL;
+			if (type == LZJODY_JOB_COMPRESS) {
+				job->in = c->data + next * QUEUE_JOB_SIZE;
+				job->length = QUEUE_JOB_SIZE;
+				if ((next + 1) * QUEUE_JOB_SIZE > c->length)
+					job->length = c->length - next * QUEUE_JOB_SIZE;
+				job->out = qcomp + next * QUEUE_JOB_BOUND;
+				job->out_size = QUEUE_JOB_BOUND;
+			} else {
+				job->in = qcomp + next * QUEUE_JOB_BOUND;
+				job->length = (size_t)qcomp_len[next];
+				job->out = dec + next * QUEUE_JOB_SIZE;
+				job->out_size = QUEUE_JOB_SIZE;
+				if ((next + 1) * QUEUE_JOB_SIZE > c->length)
+					job->out_size = c->length - next * QUEUE_JOB_SIZE;
+			}
+			r = lzjody_queue_submit(queue, job);
+			if (r < 0) return 0;
+			if (r > 0) break;
+		}
+		n = lzjody_queue_reap(queue, done, QUEUE_REAP, 1);
+		for (k = 0; k < n; k++) {
+			if (done[k]->result < 0) return 0;
+			idx = (size_t)(done[k] - qjob);
+			if (type == LZJODY_JOB_COMPRESS) qcomp_len[idx] = done[k]->result;
+		}
+		finished += n;
+	}
+	t = now_ns() - t;
+	return t ? t : 1;
+}
+
+/* Run one corpus and print its JSON object */
+static int bench_corpus(const struct corpus_t * const c,
+		const unsigned int options, const int passes)
+{
+	const size_t blocks = (c->length + LZJODY_BSIZE - 1) / LZJODY_BSIZE;
+	uint64_t t, best_c = UINT64_MAX, best_d = UINT64_MAX, best_r = UINT64_MAX;
+	uint64_t best_e = UINT64_MAX, best_qc = UINT64_MAX, best_qd = UINT64_MAX;
+	unsigned char range_out[LZJODY_BSIZE];
+	size_t blk, total_c = 0, total_e = 0, reads = 0, within = 0;
+	double err, err_sum = 0.0, err_max = 0.0;
+	unsigned int bsize, start;
+	int pass, i;
+
+	for (pass = 0; pass < passes; pass++) {
+		total_c = 0;
+		t = now_ns();
+		for (blk = 0; blk < blocks; blk++) {
+			bsize = LZJODY_BSIZE;
+			if ((blk + 1) * LZJODY_BSIZE > c->length)
+				bsize = (unsigned int)(c->length - blk * LZJODY_BSIZE);
+			i = lzjody_compress(c->data + blk * LZJODY_BSIZE,
+					comp + blk * (LZJODY_BSIZE + 4), options, bsize);
+			if (i < 0) goto error_compress;
+			comp_len[blk] = i;
+			total_c += (size_t)i;
+		}
+		t = now_ns() - t;
+		if (t < best_c) best_c = t;
+
+		t = now_ns();
+		for (blk = 0; blk < blocks; blk++) {
+			/* Skip the two-byte length prefix */
+			i = lzjody_decompress(comp + blk * (LZJODY_BSIZE + 4) + 2,
+					dec + blk * LZJODY_BSIZE,
+					(unsigned int)comp_len[blk] - 2, 0);
+			if (i < 0) goto error_decompress;
+		}
+		t = now_ns() - t;
+		if (t < best_d) best_d = t;
+
+		if (memcmp(c->data, dec, c->length) != 0) goto error_verify;
+
+		if (estimates) {
+			total_e = 0;
+			t = now_ns();
+			for (blk = 0; blk < blocks; blk++) {
+				bsize = LZJODY_BSIZE;
+				if ((blk + 1) * LZJODY_BSIZE > c->length)
+					bsize = (unsigned int)(c->length - blk * LZJODY_BSIZE);
+				est_len[blk] = lzjody_estimate(c->data + blk * LZJODY_BSIZE,
+						options, bsize);
+				if (est_len[blk] < 0) goto error_estimate;
+				total_e += (size_t)est_len[blk];
+			}
+			t = now_ns() - t;
+			if (t < best_e) best_e = t;
+		}
+
+		if (queue) {
+			t = queue_pass(c, options, LZJODY_JOB_COMPRESS);
+			if (t == 0) goto error_queue;
+			if (t < best_qc) best_qc = t;
+			memset(dec, 0, c->length);
+			t = queue_pass(c, options, LZJODY_JOB_DECOMPRESS);
+			if (t == 0) goto error_queue;
+			if (t < best_qd) best_qd = t;
+			if (memcmp(c->data, dec, c->length) != 0) goto error_verify;
+		}
+
+		if (!range_reads) continue;
+		/* Read every RANGE_READ_SIZE piece of every block separately */
+		reads = 0;
+		t = now_ns();
+		for (blk = 0; blk < blocks; blk++) {
+			for (start = 0; blk * LZJODY_BSIZE + start < c->length; start += RANGE_READ_SIZE) {
+				if (start >= LZJODY_BSIZE) break;
+				i = lzjody_decompress_range(comp + blk * (LZJODY_BSIZE + 4) + 2,
+						range_out, (unsigned int)comp_len[blk] - 2, 0,
+						start, RANGE_READ_SIZE);
+				if (i < 0) goto error_decompress;
+				if (memcmp(range_out + start, c->data + blk * LZJODY_BSIZE + start,
+						(size_t)i) != 0) goto error_verify;
+				reads++;
+			}
+		}
+		t = now_ns() - t;
+		if (t < best_r) best_r = t;
+	}
+
+	/* Avoid dividing by zero on tiny corpora with coarse clocks */
+	if (best_c == 0) best_c = 1;
+	if (best_d == 0) best_d = 1;
+
+	/* Estimate errors as a fraction of each block's size */
+	if (estimates) {
+		for (blk = 0; blk < blocks; blk++) {
+			bsize = LZJODY_BSIZE;
+			if ((blk + 1) * LZJODY_BSIZE > c->length)
+				bsize = (unsigned int)(c->length - blk * LZJODY_BSIZE);
+			err = (double)(est_len[blk] - comp_len[blk]) / (double)bsize;
+			if (err < 0) err = -err;
+			err_sum += err;
+			if (err > err_max) err_max = err;
+			if (err <= ESTIMATE_BAND) within++;
+		}
+	}
+
+	printf("    {\n");
+	printf("      \"name\": \"%s\",\n", c->name);
+	printf("      \"bytes\": %zu,\n", c->length);
+	printf("      \"blocks\": %zu,\n", blocks);
+	printf("      \"compressed_bytes\": %zu,\n", total_c);
+	printf("      \"ratio\": %.4f,\n", (double)total_c / (double)c->length);
+	printf("      \"compress_mbps\": %.2f,\n",
+			(double)c->length * 1000.0 / (double)best_c);
+	printf("      \"decompress_mbps\": %.2f,\n",
+			(double)c->length * 1000.0 / (double)best_d);
+	printf("      \"compress_ns_per_block\": %.1f,\n",
+			(double)best_c / (double)blocks);
+	printf("      \"decompress_ns_per_block\": %.1f%s\n",
+			(double)best_d / (double)blocks, (range_reads || estimates || queue) ? "," : "");
+	if (range_reads) {
+		if (best_r == 0) best_r = 1;
+		printf("      \"range_ns_per_read\": %.1f%s\n",
+				(double)best_r / (double)reads, (estimates || queue) ? "," : "");
+	}
+	if (estimates) {
+		if (best_e == 0) best_e = 1;
+		printf("      \"estimate_ratio\": %.4f,\n", (double)total_e / (double)c->length);
+		printf("      \"estimate_mean_abs_error\": %.4f,\n", err_sum / (double)blocks);
+		printf("      \"estimate_max_abs_error\": %.4f,\n", err_max);
+		printf("      \"estimate_within_band\": %.4f,\n", (double)within / (double)blocks);
+		printf("      \"estimate_ns_per_block\": %.1f%s\n", (double)best_e / (double)blocks,
+				queue ? "," : "");
+	}
+	if (queue) {
+		printf("      \"queue_compress_mbps\": %.2f,\n",
+				(double)c->length * 1000.0 / (double)best_qc);
+		printf("      \"queue_decompress_mbps\": %.2f\n",
+				(double)c->length * 1000.0 / (double)best_qd);
+	}
+	printf("    }");
+	return 0;
+
+error_compress:
+	fprintf(stderr, "lzjody_bench: %s: compression failed at block %zu\n", c->name, blk);
+	return -1;
+error_decompress:
+	fprintf(stderr, "lzjody_bench: %s: decompression failed at block %zu\n", c->name, blk);
+	return -1;
+error_verify:
+	fprintf(stderr, "lzjody_bench: %s: decompressed data does not match input\n", c->name);
+	return -1;
+error_estimate:
+	fprintf(stderr, "lzjody_bench: %s: estimate failed at block %zu\n", c->name, blk);
+	return -1;
+error_queue:
+	fprintf(stderr, "lzjody_bench: %s: a queued job failed\n", c->name);
+	return -1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "lzjody_bench %s (%s)\n", BENCH_VER, BENCH_VERDATE);
+	fprintf(stderr, "\nusage: lzjody_bench [-s size_kib] [-p passes] [-f] [-a] [-e] [-x] [-r] [-m] [-q threads] [file ...]\n\n");
+	fprintf(stderr, "  -s   size of each synthetic corpus in KiB (default %d)\n",
+			DEF_CORPUS_SIZE / 1024);
+	fprintf(stderr, "  -p   timed passes per corpus; the fastest is reported (default %d)\n",
+			DEF_PASSES);
+	fprintf(stderr, "  -f   compress with O_FAST_LZ\n");
+	fprintf(stderr, "  -a   compress with O_SA_LZ (suffix array match finder)\n");
+	fprintf(stderr, "  -e   compress with O_HUFFMAN (entropy coded blocks)\n");
+	fprintf(stderr, "  -x   compress with O_SPLIT (split stream blocks)\n");
+	fprintf(stderr, "  -r   also time %d-byte reads with lzjody_decompress_range()\n",
+			RANGE_READ_SIZE);
+	fprintf(stderr, "  -m   also check lzjody_estimate() against the real compressed sizes\n");
+	fprintf(stderr, "  -q   also time %d KiB jobs through a job queue with this many worker\n",
+			QUEUE_JOB_SIZE / 1024);
+	fprintf(stderr, "       threads (0 for one per processor)\n");
+	fprintf(stderr, "\nFiles given on the command line are benchmarked after the synthetic corpora.\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct corpus_t *corpora;
+	size_t size = DEF_CORPUS_SIZE;
+	size_t max_len = 0;
+	unsigned int options = 0;
+	int passes = DEF_PASSES;
+	int count = 0, i, files = 0;
+	int first_file = argc;
+	int threads = -1;	/* Job queue workers for -q */
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			size = (size_t)strtoul(argv[++i], NULL, 10) * 1024;
+		} else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+			passes = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-f")) {
+			options |= O_FAST_LZ;
+		} else if (!strcmp(argv[i], "-a")) {
+			options |= O_SA_LZ;
+		} else if (!strcmp(argv[i], "-e")) {
+			options |= O_HUFFMAN;
+		} else if (!strcmp(argv[i], "-x")) {
+			options |= O_SPLIT;
+		} else if (!strcmp(argv[i], "-r")) {
+			range_reads = 1;
+		} else if (!strcmp(argv[i], "-m")) {
+			estimates = 1;
+		} else if (!strcmp(argv[i], "-q") && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if (argv[i][0] == '-') {
+			usage();
+			exit(EXIT_FAILURE);
+		} else {
+			first_file = i;
+			files = argc - i;
+			break;
+		}
+	}
+	if (size < LZJODY_BSIZE || passes < 1 || threads < -1) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	corpora = (struct corpus_t *)calloc(sizeof(generators) / sizeof(generators[0]) + (size_t)files,
+			sizeof(struct corpus_t));
+	if (!corpora) goto oom;
+
+	/* Build the synthetic corpora */
+	for (i = 0; generators[i].name != NULL; i++) {
+		corpora[count].name = generators[i].name;
+		corpora[count].length = size;
+		corpora[count].data = (unsigned char *)malloc(size);
+		if (!corpora[count].data) goto oom;
+		generators[i].gen(corpora[count].data, size);
+		count++;
+	}
+	for (i = first_file; i < argc; i++) {
+		if (load_file(&corpora[count], argv[i]) < 0) exit(EXIT_FAILURE);
+		count++;
+	}
+
+	for (i = 0; i < count; i++)
+		if (corpora[i].length > max_len) max_len = corpora[i].length;
+	comp = (unsigned char *)malloc((max_len / LZJODY_BSIZE + 1) * (LZJODY_BSIZE + 4));
+	comp_len = (int *)malloc((max_len / LZJODY_BSIZE + 1) * sizeof(int));
+	est_len = (int *)malloc((max_len / LZJODY_BSIZE + 1) * sizeof(int));
+	dec = (unsigned char *)malloc(max_len + LZJODY_BSIZE);
+	if (!comp || !comp_len || !est_len || !dec) goto oom;
+	if (threads >= 0) {
+		qjob = (struct lzjody_job *)calloc(max_len / QUEUE_JOB_SIZE + 1, sizeof(struct lzjody_job));
+		qcomp = (unsigned char *)malloc((max_len / QUEUE_JOB_SIZE + 1) * QUEUE_JOB_BOUND);
+		qcomp_len = (int64_t *)malloc((max_len / QUEUE_JOB_SIZE + 1) * sizeof(int64_t));
+		if (!qjob || !qcomp || !qcomp_len) goto oom;
+		queue = lzjody_queue_new((unsigned int)threads, 0);
+		if (!queue) exit(EXIT_FAILURE);
+	}
+
+	printf("{\n");
+	printf("  \"lzjody_version\": \"%s\",\n", LZJODY_VER);
+	printf("  \"lzjody_verdate\": \"%s\",\n", LZJODY_VERDATE);
+	printf("  \"block_size\": %d,\n", LZJODY_BSIZE);
+	printf("  \"options\": %u,\n", options);
+	printf("  \"passes\": %d,\n", passes);
+	printf("  \"corpora\": [\n");
+	for (i = 0; i < count; i++) {
+		fprintf(stderr, "lzjody_bench: %s (%zu bytes)\n", corpora[i].name, corpora[i].length);
+		if (bench_corpus(&corpora[i], options, passes) < 0) exit(EXIT_FAILURE);
+		printf("%s\n", (i + 1 < count) ? "," : "");
+	}
+	printf("  ]\n}\n");
+
+	for (i = 0; i < count; i++) free(corpora[i].data);
+	free(corpora);
+	free(comp);
+	free(comp_len);
+	free(est_len);
+	free(dec);
+	lzjody_queue_free(queue);
+	free(qjob);
+	free(qcomp);
+	free(qcomp_len);
+	exit(EXIT_SUCCESS);
+
+oom:
+	fprintf(stderr, "lzjody_bench: out of memory\n");
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,172 @@
+/*
+ * Lempel-Ziv-JodyBruchon compression library
+ * Checks of library guarantees that the utility can't exercise
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ *
+ * Run by "make test" before test.sh. Prints one line per check and
+ * exits with failure if any of them fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "lzjody.h"
+#include "huffman.h"
+
+/* Huffman coding must not give up on skewed symbol counts: Fibonacci
+ * counts build trees far deeper than HUFF_MAX_BITS, and symbols seen
+ * once in front of them vary how much the length limit has to repair */
+static int check_huffman_deep(void)
+{
+	static unsigned char in[LZJODY_BSIZE], out[LZJODY_CBSIZE], dec[LZJODY_BSIZE];
+	unsigned int a, b, t, i, n, sym, ones;
+	int length;
+
+	for (ones = 0; ones < 128; ones++) {
+		n = 0;
+		for (sym = 0; sym < ones; sym++) in[n++] = (unsigned char)sym;
+		a = 1;
+		b = 1;
+		while (n < LZJODY_BSIZE) {
+			for (i = 0; (i < a) && (n < LZJODY_BSIZE); i++) in[n++] = (unsigned char)sym;
+			t = a + b;
+			a = b;
+			b = t;
+			sym++;
+		}
+		length = huff_encode(in, LZJODY_BSIZE, out, LZJODY_CBSIZE);
+		if (length < 0) goto error_encode;
+		if (huff_decode(out, (unsigned int)length, dec, LZJODY_BSIZE) < 0) goto error_decode;
+		if (memcmp(in, dec, LZJODY_BSIZE) != 0) goto error_decode;
+	}
+	return 0;
+
+error_encode:
+	fprintf(stderr, "lzjody_check: huff_encode() failed on %u symbols (%u seen once)\n",
+			sym, ones);
+	return -1;
+error_decode:
+	fprintf(stderr, "lzjody_check: Huffman round trip doesn't match (%u seen once)\n", ones);
+	return -1;
+}
+
+/* Simple deterministic PRNG (xorshift32) so inputs are reproducible */
+static uint32_t rng_state = 0x2545f491;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+/* Fill a block with a mix of text, runs, counters and noise */
+static void gen_mixed(unsigned char * const p, const unsigned int length)
+{
+	static const char text[] = "the quick brown fox jumps over the lazy dog ";
+	unsigned int i = 0, n, k;
+
+	while (i < length) {
+		n = 16 + (rng() % 256);
+		if (n > length - i) n = length - i;
+		switch (rng() % 4) {
+		case 0:
+			for (k = 0; k < n; k++) p[i + k] = (unsigned char)text[(i + k) % (sizeof(text) - 1)];
+			break;
+		case 1:
+			memset(p + i, (int)(rng() & 0xff), n);
+			break;
+		case 2:
+			for (k = 0; k < n; k++) p[i + k] = (unsigned char)(i + k);
+			break;
+		default:
+			for (k = 0; k < n; k++) p[i + k] = (unsigned char)rng();
+			break;
+		}
+		i += n;
+	}
+	return;
+}
+
+/* Decompressing in place with lzjody_inplace_margin() must give the same
+ * data: each block goes at the very end of a heap buffer of exactly its
+ * decompressed length plus the margin and is decoded to the start */
+static int check_inplace(void)
+{
+	static const unsigned int option_sets[] = {
+		0, O_CHECKSUM, O_HUFFMAN, O_SPLIT, O_SA_LZ | O_HUFFMAN | O_CHECKSUM,
+		O_SPLIT | O_CHECKSUM, O_FAST_LZ | O_ACCEL(4)
+	};
+	static unsigned char in[LZJODY_BSIZE], comp[LZJODY_CBSIZE];
+	unsigned char *buf;
+	unsigned int set, blk, length, size, flags;
+	int clen, margin, got;
+
+	for (set = 0; set < sizeof(option_sets) / sizeof(option_sets[0]); set++) {
+		for (blk = 0; blk < 64; blk++) {
+			/* Every eighth block is short like a stream's last one */
+			length = (blk % 8 == 7) ? 1 + (rng() % LZJODY_BSIZE) : LZJODY_BSIZE;
+			gen_mixed(in, length);
+			clen = lzjody_compress(in, comp, option_sets[set], length);
+			if (clen < 0) goto error_compress;
+			flags = comp[0] & 0xe0;
+			size = (unsigned int)clen - 2;
+			margin = lzjody_inplace_margin(comp + 2, size, flags);
+			if (margin < 0) goto error_margin;
+
+			buf = (unsigned char *)malloc(length + (unsigned int)margin);
+			if (!buf) goto error_oom;
+			memcpy(buf + length + (unsigned int)margin - size, comp + 2, size);
+			got = lzjody_decompress(buf + length + (unsigned int)margin - size, buf, size, flags);
+			if ((got != (int)length) || (memcmp(buf, in, length) != 0)) {
+				free(buf);
+				goto error_decode;
+			}
+			free(buf);
+		}
+	}
+	return 0;
+
+error_compress:
+	fprintf(stderr, "lzjody_check: compression failed (options 0x%x)\n", option_sets[set]);
+	return -1;
+error_margin:
+	fprintf(stderr, "lzjody_check: no in-place margin for block %u (options 0x%x)\n",
+			blk, option_sets[set]);
+	return -1;
+error_decode:
+	fprintf(stderr, "lzjody_check: block %u decoded in place doesn't match (options 0x%x, margin %d)\n",
+			blk, option_sets[set], margin);
+	return -1;
+error_oom:
+	fprintf(stderr, "lzjody_check: out of memory\n");
+	return -1;
+}
+
+static const struct {
+	const char *name;
+	int (*run)(void);
+} checks[] = {
+	{ "Huffman coding of a deep tree", check_huffman_deep },
+	{ "in-place decompression", check_inplace },
+	{ NULL, NULL }
+};
+
+int main(void)
+{
+	int i, failed = 0;
+
+	for (i = 0; checks[i].name != NULL; i++) {
+		printf("Checking %s...", checks[i].name);
+		fflush(stdout);
+		if (checks[i].run() < 0) {
+			printf("FAILED\n");
+			failed = 1;
+		} else printf("passed\n");
+	}
+	exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
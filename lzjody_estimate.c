@@ -0,0 +1,235 @@
+/*
+ * Lempel-Ziv-JodyBruchon compression library
+ * Fast compressed size estimation
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ *
+ * lzjody_estimate() predicts what lzjody_compress() would return for a
+ * block without compressing it. One greedy pass looks for byte runs and
+ * 8-bit sequences with exact tests and probes one or two LZ candidates
+ * per position; each item is charged what the compressor would write for
+ * it. Positions where nothing is found count as literals, and the pass
+ * steps further ahead the longer it goes without finding anything, so
+ * incompressible data is only sampled. Long literal runs are checked for
+ * table columns that a byte plane transform would expose, and a
+ * histogram of the literal bytes visited predicts what O_HUFFMAN saves.
+ *
+ * 16/32-bit sequences and the suffix array's longest matches are not
+ * modelled, so the estimate errs towards too large a size. README has
+ * the measured error; "lzjody_bench -m" measures it again.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "lzjody.h"
+
+/* Hash table of 4-byte prefixes for O_SA_LZ (positions + 1; 0 is empty) */
+#define EST_HASH_BITS 10
+/* Literals in a row before the probe starts skipping ahead */
+#define EST_SKIP_SHIFT 5
+/* Shortest items worth estimating (match the compressor's choices) */
+#define EST_MIN_MATCH 4
+#define EST_MAX_MATCH 4095
+/* Longest literal run one control can carry */
+#define EST_MAX_LITERALS 4095
+/* Short control forms hold lengths up to this */
+#define EST_SHORT_MAX 0x0f
+/* Literal runs long enough to try a byte plane estimate, and the
+ * predictable plane bytes that one RLE or sequence command covers */
+#define EST_MIN_PLANE 32
+#define EST_PLANE_PACK 16
+/* Fewer predictable bytes than 1/n of a run are taken for chance */
+#define EST_PLANE_MIN_SHARE 4
+/* Smallest stream worth Huffman coding and the table overhead */
+#define EST_MIN_HUFF 64
+#define EST_HUFF_TABLE 32
+/* Huffman coding saves about 1/n of the command and argument bytes */
+#define EST_HUFF_CMD_SAVE 4
+
+static inline uint32_t load32(const unsigned char * const p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline unsigned int est_hash(const uint32_t v)
+{
+	return (unsigned int)((v * 2654435761U) >> (32 - EST_HASH_BITS));
+}
+
+/* Bytes needed to store a run of literals */
+static inline unsigned int literal_cost(unsigned int n)
+{
+	unsigned int cost = n;
+
+	while (n > EST_MAX_LITERALS) {
+		cost += 2;
+		n -= EST_MAX_LITERALS;
+	}
+	if (n > EST_SHORT_MAX) cost += 2;
+	else if (n > 0) cost += 1;
+	return cost;
+}
+
+/* Account for a run of n literals at start. Long runs are stored as a
+ * byte plane transform instead if enough bytes look predictable from the
+ * byte four places back (equal or one more), as in table columns. */
+static void flush_literals(const unsigned char * const blk,
+		const unsigned int start, const unsigned int n,
+		unsigned int * const cmd, unsigned int * const lits)
+{
+	unsigned int i, p = 0, plane;
+
+	if (n >= EST_MIN_PLANE) {
+		/* Every third byte visits all four columns */
+		for (i = start + 4; i < start + n; i += 3)
+			p += ((unsigned char)(blk[i] - blk[i - 4]) <= 1);
+		p *= 3;
+		if (p > n - 4) p = n - 4;
+		plane = literal_cost(n - p) + p / EST_PLANE_PACK + 3;
+		/* Chance hits on random data are not worth a transform */
+		if ((p >= n / EST_PLANE_MIN_SHARE) && (plane < literal_cost(n))) {
+			*cmd += plane - (n - p);
+			*lits += n - p;
+			return;
+		}
+	}
+	*cmd += literal_cost(n) - n;
+	*lits += n;
+	return;
+}
+
+/* log2(x) in 1/256 bit units, linear between powers of two */
+static unsigned int log2_q8(const unsigned int x)
+{
+	unsigned int n = 0;
+
+	while ((x >> n) > 1) n++;
+	if (n >= 8) return (n << 8) + ((x >> (n - 8)) & 0xff);
+	return (n << 8) + ((x << (8 - n)) & 0xff);
+}
+
+/* Order-0 coded size in bytes of n literals with the sampled histogram */
+static unsigned int coded_literals(const unsigned int * const hist,
+		const unsigned int sampled, const unsigned int n)
+{
+	const unsigned int total = log2_q8(sampled);
+	uint64_t bits = 0;
+	unsigned int i, symbols = 0;
+
+	if (sampled == 0) return 0;
+	for (i = 0; i < 256; i++) {
+		if (hist[i] == 0) continue;
+		symbols++;
+		bits += (uint64_t)hist[i] * (total - log2_q8(hist[i]));
+	}
+	/* A single symbol still takes a bit per byte */
+	if (symbols == 1) bits = (uint64_t)sampled << 8;
+	/* Small samples look more skewed than the data they come from; add
+	 * the usual (symbols - 1) / 2ln2 bits of bias correction */
+	else bits += (uint64_t)(symbols - 1) * 185;
+	return (unsigned int)((bits * n / sampled + 2047) >> 11) + symbols / 2;
+}
+
+
+/* Predict the size lzjody_compress() returns for a block. Only the
+ * O_SA_LZ, O_HUFFMAN, O_CHECKSUM and O_NOPREFIX options change it.
+ * Returns the predicted size or -1 for a bad length. */
+extern int lzjody_estimate(const unsigned char * const blk,
+		const unsigned int options, const unsigned int length)
+{
+	uint16_t table[1 << EST_HASH_BITS];
+	uint16_t first[256];
+	unsigned int hist[256];
+	unsigned int ipos = 0, cmd = 0, lits = 0, lit_run = 0, sampled = 0;
+	unsigned int misses = 0, step, cand, h, n, huff;
+	uint32_t v;
+
+	if (length == 0 || length > LZJODY_BSIZE) goto error_length;
+	if (options & O_SA_LZ) memset(table, 0, sizeof(table));
+	memset(first, 0, sizeof(first));
+	memset(hist, 0, sizeof(hist));
+
+	while (ipos + EST_MIN_MATCH <= length) {
+		v = load32(blk + ipos);
+
+		/* Byte runs and 8-bit sequences */
+		if ((blk[ipos + 1] == blk[ipos]) && (v == blk[ipos] * 0x01010101U)) {
+			for (n = EST_MIN_MATCH; (ipos + n < length) && (n < LZJODY_BSIZE)
+					&& (blk[ipos + n] == blk[ipos]); n++);
+			goto found_run;
+		}
+		if ((unsigned char)(blk[ipos] + 1) == blk[ipos + 1]
+				&& (unsigned char)(blk[ipos] + 2) == blk[ipos + 2]
+				&& (unsigned char)(blk[ipos] + 3) == blk[ipos + 3]) {
+			for (n = EST_MIN_MATCH; (ipos + n < length) && (n < LZJODY_BSIZE)
+					&& (blk[ipos + n] == (unsigned char)(blk[ipos] + n)); n++);
+			goto found_run;
+		}
+
+		/* LZ probe: the default match finder mostly settles for the
+		 * first earlier occurrence of the byte, the suffix array finds
+		 * the longest match, for which the latest 4-byte match stands in */
+		cand = first[blk[ipos]];
+		if (cand == 0) first[blk[ipos]] = (uint16_t)(ipos + 1);
+		if (options & O_SA_LZ) {
+			h = est_hash(v);
+			if ((cand == 0) || (load32(blk + cand - 1) != v)) cand = table[h];
+			table[h] = (uint16_t)(ipos + 1);
+		}
+		if (cand != 0 && load32(blk + cand - 1) == v) {
+			cand--;
+			for (n = EST_MIN_MATCH; (ipos + n < length) && (n < EST_MAX_MATCH)
+					&& (blk[cand + n] == blk[ipos + n]); n++);
+			flush_literals(blk, ipos - lit_run, lit_run, &cmd, &lits);
+			cmd += (n > 0xff) ? 4 : 3;
+			lit_run = 0;
+			misses = 0;
+			ipos += n;
+			/* Index near the end of the match for the next probe */
+			if ((options & O_SA_LZ) && (ipos + EST_MIN_MATCH <= length))
+				table[est_hash(load32(blk + ipos - 2))] = (uint16_t)(ipos - 1);
+			continue;
+		}
+
+		/* Nothing here: a literal, skipping ahead after many misses */
+		hist[blk[ipos]]++;
+		sampled++;
+		step = 1 + (misses++ >> EST_SKIP_SHIFT);
+		if (ipos + step > length) step = length - ipos;
+		lit_run += step;
+		ipos += step;
+		continue;
+
+found_run:
+		flush_literals(blk, ipos - lit_run, lit_run, &cmd, &lits);
+		cmd += (n > EST_SHORT_MAX) ? 3 : 2;
+		lit_run = 0;
+		misses = 0;
+		ipos += n;
+	}
+	/* The tail is too short for anything but literals */
+	for (; ipos < length; ipos++, sampled++, lit_run++) hist[blk[ipos]]++;
+	flush_literals(blk, ipos - lit_run, lit_run, &cmd, &lits);
+
+	/* Huffman coding replaces the stream if it gets smaller */
+	n = cmd + lits;
+	if ((options & O_HUFFMAN) && (n >= EST_MIN_HUFF)) {
+		huff = cmd - cmd / EST_HUFF_CMD_SAVE + coded_literals(hist, sampled, lits)
+				+ EST_HUFF_TABLE + 1;
+		if (huff < n) n = huff;
+	}
+
+	if (!(options & O_NOPREFIX)) n += 2;
+	if (options & O_CHECKSUM) n += 4;
+	return (int)n;
+
+error_length:
+	fprintf(stderr, "liblzjody: error: cannot estimate block length %u (maximum %d)\n",
+			length, LZJODY_BSIZE);
+	return -1;
+}
@@ -0,0 +1,377 @@
+/*
+ * Lempel-Ziv-JodyBruchon compression library
+ * Random access reads from compressed streams
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ *
+ * A stream written by "lzjody -c" is a series of length-prefixed blocks
+ * that each decode to LZJODY_BSIZE bytes except the last one, so the
+ * offset of every block is found at open time by walking the prefixes
+ * without decoding anything. lzjody_pread() serves reads from a cache of
+ * decoded blocks with least recently used replacement that is shared by
+ * every thread reading through the same handle. Misses are read and
+ * decoded outside the cache lock, so they never stall readers of blocks
+ * that are already cached. Streams compressed against a reference image
+ * are read with lzjody_open_ref() and the same reference. Windows has no
+ * pread(), so there reads seek and read under a per-handle lock instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "lzjody.h"
+
+/* Detect Windows and modify as needed */
+#if defined _WIN32 || defined __CYGWIN__
+ #define ON_WINDOWS 1
+ #include <io.h>
+#endif
+
+#ifndef O_BINARY
+ #define O_BINARY 0
+#endif
+
+/* Decoded blocks cached per handle if the caller doesn't say */
+#define DEF_CACHE_BLOCKS 256
+/* Bytes read at a time while walking block prefixes */
+#define INDEX_READ_SIZE 65536
+/* Largest payload a block prefix may claim (as in lzjody -d) */
+#define MAX_PAYLOAD (LZJODY_BSIZE + 8)
+/* Empty cache slot or list end */
+#define NO_SLOT UINT32_MAX
+
+struct cache_slot_t {
+	unsigned char data[LZJODY_BSIZE];
+	uint32_t block;	/* Block held in data */
+	uint32_t prev;	/* More recently used slot */
+	uint32_t next;	/* Less recently used slot */
+};
+
+struct lzjody_file {
+	int fd;
+	uint64_t *offset;	/* Prefix offset of each block, then the stream end */
+	uint32_t blocks;	/* Number of blocks in the stream */
+	uint64_t size;	/* Decoded size of the stream */
+	pthread_mutex_t lock;	/* Protects the cache */
+	struct cache_slot_t *slot;
+	uint32_t *slot_of;	/* Slot caching each block or NO_SLOT */
+	uint32_t slots;	/* Cache capacity in blocks */
+	uint32_t used;	/* Slots filled so far */
+	uint32_t head;	/* Most recently used slot */
+	uint32_t tail;	/* Least recently used slot */
+	const struct lzjody_ref *ref;	/* Reference image the stream was compressed against */
+#ifdef ON_WINDOWS
+	pthread_mutex_t io_lock;	/* Keeps each seek and read together */
+#endif
+};
+
+
+/* Read len bytes at offset off of the compressed file */
+static ssize_t file_pread(struct lzjody_file * const f, void * const buf,
+		const size_t len, const uint64_t off)
+{
+#ifdef ON_WINDOWS
+	ssize_t got = -1;
+
+	pthread_mutex_lock(&f->io_lock);
+	if (lseek(f->fd, (off_t)off, SEEK_SET) == (off_t)off)
+		got = read(f->fd, buf, (unsigned int)len);
+	pthread_mutex_unlock(&f->io_lock);
+	return got;
+#else
+	return pread(f->fd, buf, len, (off_t)off);
+#endif /* ON_WINDOWS */
+}
+
+
+/* Record the offset of every block by walking the length prefixes */
+static int index_stream(struct lzjody_file * const f, const char * const path)
+{
+	unsigned char buf[INDEX_READ_SIZE];
+	struct stat st;
+	uint64_t pos = 0, *tmp;
+	uint32_t alloc = 0;
+	unsigned int i, length;
+	ssize_t got;
+
+	if (fstat(f->fd, &st) != 0) goto error_read;
+	while (pos < (uint64_t)st.st_size) {
+		got = file_pread(f, buf, INDEX_READ_SIZE, pos);
+		if (got < 0) goto error_read;
+		if (got < 2) goto error_truncated;
+		i = 0;
+		while (i + 2 <= (unsigned int)got) {
+			length = ((unsigned int)(buf[i] & 0x1f) << 8) | buf[i + 1];
+			if (length == 0 || length > MAX_PAYLOAD) goto error_prefix;
+			/* Blocks can't be read alone if they need earlier ones */
+			if (buf[i] & O_FARREF) goto error_farref;
+			if (f->blocks + 1 >= alloc) {
+				alloc = alloc ? alloc << 1 : 1024;
+				tmp = (uint64_t *)realloc(f->offset, alloc * sizeof(uint64_t));
+				if (!tmp) goto error_oom;
+				f->offset = tmp;
+			}
+			f->offset[f->blocks++] = pos;
+			pos += 2 + length;
+			i += 2 + length;
+		}
+	}
+	if (pos != (uint64_t)st.st_size) goto error_truncated;
+	if (f->blocks == 0) goto error_empty;
+	f->offset[f->blocks] = pos;
+	return 0;
+
+error_read:
+	fprintf(stderr, "liblzjody: cannot read %s\n", path);
+	return -1;
+error_truncated:
+	fprintf(stderr, "liblzjody: %s: last block is truncated\n", path);
+	return -1;
+error_prefix:
+	fprintf(stderr, "liblzjody: %s: bad block length 0x%x at offset %llu\n",
+			path, length, (unsigned long long)pos);
+	return -1;
+error_farref:
+	fprintf(stderr, "liblzjody: %s: block %u refers to earlier blocks (compressed with -l)\n",
+			path, f->blocks);
+	return -1;
+error_empty:
+	fprintf(stderr, "liblzjody: %s: no compressed blocks\n", path);
+	return -1;
+error_oom:
+	fprintf(stderr, "liblzjody: out of memory indexing %s\n", path);
+	return -1;
+}
+
+
+/* Read and decode one block; returns its decoded length or -1 */
+static int load_block(struct lzjody_file * const f, const uint32_t blk,
+		unsigned char * const out)
+{
+	unsigned char in[MAX_PAYLOAD + 2];
+	const size_t length = (size_t)(f->offset[blk + 1] - f->offset[blk]);
+	unsigned char flags;
+	int i;
+
+	if (file_pread(f, in, length, f->offset[blk]) != (ssize_t)length) goto error_read;
+	flags = in[0] & 0xe0;
+	if (flags & O_NOCOMPRESS) {
+		if (length - 2 > LZJODY_BSIZE) goto error_decompress;
+		memcpy(out, in + 2, length - 2);
+		return (int)(length - 2);
+	}
+	if (f->ref) i = lzjody_decompress_ref(f->ref, (uint64_t)blk * LZJODY_BSIZE,
+			in + 2, out, (unsigned int)(length - 2), flags);
+	else i = lzjody_decompress(in + 2, out, (unsigned int)(length - 2), flags);
+	if (i < 0) goto error_decompress;
+	return i;
+
+error_read:
+	fprintf(stderr, "liblzjody: read error at block %u\n", blk);
+	return -1;
+error_decompress:
+	fprintf(stderr, "liblzjody: cannot decompress block %u\n", blk);
+	return -1;
+}
+
+
+/* Cache LRU list maintenance; the caller holds the lock */
+static void lru_unlink(struct lzjody_file * const f, const uint32_t s)
+{
+	struct cache_slot_t * const slot = f->slot + s;
+
+	if (slot->prev != NO_SLOT) f->slot[slot->prev].next = slot->next;
+	else f->head = slot->next;
+	if (slot->next != NO_SLOT) f->slot[slot->next].prev = slot->prev;
+	else f->tail = slot->prev;
+	return;
+}
+
+static void lru_push(struct lzjody_file * const f, const uint32_t s)
+{
+	struct cache_slot_t * const slot = f->slot + s;
+
+	slot->prev = NO_SLOT;
+	slot->next = f->head;
+	if (f->head != NO_SLOT) f->slot[f->head].prev = s;
+	else f->tail = s;
+	f->head = s;
+	return;
+}
+
+
+/* Copy n bytes at start within block blk to out through the cache */
+static int read_cached(struct lzjody_file * const f, const uint32_t blk,
+		const unsigned int start, const unsigned int n,
+		unsigned char * const out)
+{
+	unsigned char data[LZJODY_BSIZE];
+	const uint64_t expect = (blk + 1 < f->blocks) ? LZJODY_BSIZE
+			: f->size - (uint64_t)blk * LZJODY_BSIZE;
+	uint32_t s;
+	int length;
+
+	pthread_mutex_lock(&f->lock);
+	s = f->slot_of[blk];
+	if (s != NO_SLOT) {
+		lru_unlink(f, s);
+		lru_push(f, s);
+		memcpy(out, f->slot[s].data + start, n);
+		pthread_mutex_unlock(&f->lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&f->lock);
+
+	length = load_block(f, blk, data);
+	if (length < 0) return -1;
+	if ((uint64_t)length != expect) goto error_length;
+	memcpy(out, data + start, n);
+
+	/* Another reader may have cached the block in the meantime */
+	pthread_mutex_lock(&f->lock);
+	if (f->slot_of[blk] == NO_SLOT) {
+		if (f->used < f->slots) s = f->used++;
+		else {
+			s = f->tail;
+			lru_unlink(f, s);
+			f->slot_of[f->slot[s].block] = NO_SLOT;
+		}
+		memcpy(f->slot[s].data, data, (size_t)length);
+		f->slot[s].block = blk;
+		f->slot_of[blk] = s;
+		lru_push(f, s);
+	}
+	pthread_mutex_unlock(&f->lock);
+	return 0;
+
+error_length:
+	fprintf(stderr, "liblzjody: block %u decoded to %d bytes, expected %llu\n",
+			blk, length, (unsigned long long)expect);
+	return -1;
+}
+
+
+/* Open a compressed stream for random access reads, caching up to
+ * cache_blocks decoded blocks (0 for the default) */
+extern struct lzjody_file *lzjody_open(const char * const path,
+		unsigned int cache_blocks)
+{
+	return lzjody_open_ref(path, cache_blocks, NULL);
+}
+
+
+/* Same as lzjody_open() for a stream compressed against a reference
+ * image, which must stay valid until the stream is closed */
+extern struct lzjody_file *lzjody_open_ref(const char * const path,
+		unsigned int cache_blocks, const struct lzjody_ref * const ref)
+{
+	unsigned char last[LZJODY_BSIZE];
+	struct lzjody_file *f;
+	uint32_t i;
+	int length;
+
+	if (cache_blocks == 0) cache_blocks = DEF_CACHE_BLOCKS;
+	f = (struct lzjody_file *)calloc(1, sizeof(struct lzjody_file));
+	if (!f) goto error_oom;
+#ifdef ON_WINDOWS
+	if (pthread_mutex_init(&f->io_lock, NULL) != 0) {
+		free(f);
+		goto error_oom;
+	}
+#endif /* ON_WINDOWS */
+	f->fd = open(path, O_RDONLY | O_BINARY);
+	if (f->fd < 0) goto error_open;
+	f->ref = ref;
+	if (index_stream(f, path) < 0) goto error_close;
+
+	/* Only the last block can be short */
+	length = load_block(f, f->blocks - 1, last);
+	if (length < 0) goto error_close;
+	f->size = (uint64_t)(f->blocks - 1) * LZJODY_BSIZE + (uint64_t)length;
+
+	if (cache_blocks > f->blocks) cache_blocks = f->blocks;
+	f->slots = cache_blocks;
+	f->slot = (struct cache_slot_t *)malloc(cache_blocks * sizeof(struct cache_slot_t));
+	f->slot_of = (uint32_t *)malloc(f->blocks * sizeof(uint32_t));
+	if (!f->slot || !f->slot_of) goto error_oom_close;
+	for (i = 0; i < f->blocks; i++) f->slot_of[i] = NO_SLOT;
+	f->head = NO_SLOT;
+	f->tail = NO_SLOT;
+	if (pthread_mutex_init(&f->lock, NULL) != 0) goto error_oom_close;
+	return f;
+
+error_oom_close:
+	fprintf(stderr, "liblzjody: out of memory opening %s\n", path);
+error_close:
+	close(f->fd);
+	free(f->slot);
+	free(f->slot_of);
+	free(f->offset);
+#ifdef ON_WINDOWS
+	pthread_mutex_destroy(&f->io_lock);
+#endif
+	free(f);
+	return NULL;
+error_open:
+	fprintf(stderr, "liblzjody: cannot open %s\n", path);
+#ifdef ON_WINDOWS
+	pthread_mutex_destroy(&f->io_lock);
+#endif
+	free(f);
+	return NULL;
+error_oom:
+	fprintf(stderr, "liblzjody: out of memory opening %s\n", path);
+	return NULL;
+}
+
+
+/* Decoded size of an open stream */
+extern uint64_t lzjody_file_size(const struct lzjody_file * const f)
+{
+	return f->size;
+}
+
+
+/* Read up to len decoded bytes at offset off; safe to call from several
+ * threads on one handle. Returns the bytes read (0 past the end) or -1 */
+extern int64_t lzjody_pread(struct lzjody_file * const f, void * const buf,
+		const size_t len, const uint64_t off)
+{
+	unsigned char * const out = (unsigned char *)buf;
+	uint64_t pos = off, end;
+	unsigned int start, n;
+
+	if (off >= f->size) return 0;
+	end = (len > f->size - off) ? f->size : off + len;
+	while (pos < end) {
+		start = (unsigned int)(pos % LZJODY_BSIZE);
+		n = LZJODY_BSIZE - start;
+		if (n > end - pos) n = (unsigned int)(end - pos);
+		if (read_cached(f, (uint32_t)(pos / LZJODY_BSIZE), start, n, out + (pos - off)) < 0)
+			return -1;
+		pos += n;
+	}
+	return (int64_t)(end - off);
+}
+
+
+extern void lzjody_close(struct lzjody_file * const f)
+{
+	if (!f) return;
+	pthread_mutex_destroy(&f->lock);
+#ifdef ON_WINDOWS
+	pthread_mutex_destroy(&f->io_lock);
+#endif
+	close(f->fd);
+	free(f->slot);
+	free(f->slot_of);
+	free(f->offset);
+	free(f);
+	return;
+}
@@ -0,0 +1,165 @@
+/*
+ * Lempel-Ziv-JodyBruchon compression library
+ * Checks of the C++ interface (lzjody.hpp)
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ *
+ * Run by "make test": round trips blocks through compressors and
+ * decompressors that were moved around, including pmr objects with
+ * different memory resources. Exits with failure on the first problem.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+#include "lzjody.hpp"
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { \
+	std::fprintf(stderr, "lzjody_hpp_check: line %d: %s\n", __LINE__, #cond); \
+	failures++; } } while (0)
+
+/* Compressible test block: text with some structure */
+static std::vector<unsigned char> make_block()
+{
+	std::vector<unsigned char> b(lzjody::max_block_size);
+
+	for (std::size_t i = 0; i < b.size(); i++)
+		b[i] = static_cast<unsigned char>("lzjody block "[i % 13] + (i / 512));
+	return b;
+}
+
+/* Compress and decompress one block; true if it came back intact */
+template <typename C, typename D>
+static bool round_trip(C &comp, D &decomp, const std::vector<unsigned char> &in)
+{
+	std::vector<unsigned char> packed(lzjody::compress_bound(in.size(), comp.options()));
+	std::vector<unsigned char> out(lzjody::max_block_size);
+
+	const auto c = comp.compress(std::span<const unsigned char>(in), std::span<unsigned char>(packed));
+	const auto d = decomp.decompress(std::span<const unsigned char>(c), std::span<unsigned char>(out));
+	return d.size() == in.size() && std::memcmp(d.data(), in.data(), in.size()) == 0;
+}
+
+/* A moved-from compressor must refuse to work, not use the library's
+ * shared default context */
+/* Likewise for a moved-from decompressor, with an output buffer small
+ * enough that it would need its scratch block */
+template <typename C, typename D>
+static bool throws_on_decompress(C &comp, D &decomp, const std::vector<unsigned char> &in)
+{
+	std::vector<unsigned char> packed(lzjody::compress_bound(in.size(), comp.options()));
+	std::vector<unsigned char> out(in.size());
+
+	const auto c = comp.compress(std::span<const unsigned char>(in), std::span<unsigned char>(packed));
+	try {
+		decomp.decompress(std::span<const unsigned char>(c), std::span<unsigned char>(out));
+	} catch (const lzjody::error &) {
+		return true;
+	}
+	return false;
+}
+
+template <typename C>
+static bool throws_on_compress(C &comp, const std::vector<unsigned char> &in)
+{
+	std::vector<unsigned char> packed(lzjody::compress_bound(in.size(), comp.options()));
+
+	try {
+		comp.compress(std::span<const unsigned char>(in), std::span<unsigned char>(packed));
+	} catch (const lzjody::error &) {
+		return true;
+	}
+	return false;
+}
+
+static void check_default()
+{
+	const auto in = make_block();
+	lzjody::compressor a(O_CHECKSUM);
+	lzjody::decompressor d;
+
+	CHECK(round_trip(a, d, in));
+
+	/* Move construction takes the context */
+	lzjody::compressor b(std::move(a));
+	CHECK(b.native_handle() != nullptr);
+	CHECK(a.native_handle() == nullptr);
+	CHECK(round_trip(b, d, in));
+	CHECK(throws_on_compress(a, in));
+
+	/* Move assignment back into the moved-from object */
+	a = std::move(b);
+	CHECK(a.native_handle() != nullptr);
+	CHECK(a.options() == O_CHECKSUM);
+	CHECK(round_trip(a, d, in));
+
+	lzjody::decompressor e(std::move(d));
+	lzjody::decompressor f;
+	f = std::move(e);
+	CHECK(round_trip(a, f, in));
+
+	/* A short block needs the scratch block, which moved away */
+	const std::vector<unsigned char> small(in.begin(), in.begin() + 100);
+	CHECK(throws_on_decompress(a, d, small));
+	CHECK(round_trip(a, f, small));
+	d = std::move(f);
+	CHECK(round_trip(a, d, small));
+}
+
+static void check_pmr()
+{
+	const auto in = make_block();
+	std::pmr::monotonic_buffer_resource r1, r2;
+	lzjody::pmr::compressor a(0, &r1);
+	lzjody::pmr::compressor b(0, &r2);
+	lzjody::pmr::decompressor d(&r1);
+
+	CHECK(round_trip(a, d, in));
+
+	/* Moved from, then assigned from an unequal resource: the context
+	 * can't be taken, so a new one comes from this object's resource */
+	lzjody::pmr::compressor c(std::move(a));
+	CHECK(a.native_handle() == nullptr);
+	a = std::move(b);
+	CHECK(a.native_handle() != nullptr);
+	CHECK(a.get_allocator().resource() == &r1);
+	CHECK(round_trip(a, d, in));
+	CHECK(round_trip(c, d, in));
+
+	/* A moved-from decompressor assigned from an unequal resource gets
+	 * new scratch from its own */
+	const std::vector<unsigned char> small(in.begin(), in.begin() + 100);
+	lzjody::pmr::decompressor g(std::move(d));
+	CHECK(throws_on_decompress(a, d, small));
+	lzjody::pmr::decompressor h(&r2);
+	d = std::move(h);
+	CHECK(d.get_allocator().resource() == &r1);
+	CHECK(round_trip(a, d, small));
+	CHECK(round_trip(a, g, small));
+
+	/* Equal resources hand the context over */
+	lzjody::pmr::compressor e(0, &r1);
+	lzjody_ctx *const ctx = e.native_handle();
+	c = std::move(e);
+	CHECK(c.native_handle() == ctx);
+	CHECK(round_trip(c, d, in));
+}
+
+int main()
+{
+	try {
+		check_default();
+		check_pmr();
+	} catch (const std::exception &ex) {
+		std::fprintf(stderr, "lzjody_hpp_check: unexpected exception: %s\n", ex.what());
+		failures++;
+	}
+	std::printf("Checking the C++ interface...%s\n", failures ? "FAILED" : "passed");
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
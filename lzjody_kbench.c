@@ -0,0 +1,648 @@
+/*
+ * Lempel-Ziv-JodyBruchon compression library
+ * Per-kernel microbenchmark
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ *
+ * Drives the compressor's internal kernels (the byte indexer, each match
+ * finder and the byte plane transform) directly on fixed corpora, and the
+ * decompressor on corpora built so that nearly all output comes from one
+ * command type. The library source is included here so that its static
+ * functions can be called.
+ *
+ * On Linux, hardware counters (cycles, instructions, branch misses and
+ * cache misses) are read with perf_event_open() when the kernel allows
+ * it; otherwise only the cycle counter (TSC on x86, nanoseconds
+ * elsewhere) is used. Each kernel runs over the whole corpus several
+ * times and the pass with the fewest cycles is reported as one line of
+ * a plain text table, so that the output of two versions can be diffed.
+ */
+
+#include "lzjody.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+ #include <unistd.h>
+ #include <sys/ioctl.h>
+ #include <sys/syscall.h>
+ #include <linux/perf_event.h>
+#endif
+#if defined __x86_64__ || defined __i386__
+ #include <x86intrin.h>
+#endif
+
+#ifdef __GNUC__
+ #define NOINLINE __attribute__((noinline))
+#else
+ #define NOINLINE
+#endif
+
+#define KBENCH_VER "0.1"
+#define KBENCH_VERDATE "2020-07-14"
+
+/* Default corpus size in blocks and timed passes per kernel */
+#define DEF_BLOCKS 64
+#define DEF_PASSES 5
+
+/* Counters: cycles, instructions, branch misses, cache misses */
+#define CNT_CYCLES 0
+#define CNT_INSNS 1
+#define CNT_BRMISS 2
+#define CNT_CMISS 3
+#define CNT_MAX 4
+
+struct counts_t {
+	uint64_t v[CNT_MAX];
+};
+
+struct corpus_t {
+	const char *name;
+	unsigned char *data;
+	unsigned int blocks;
+	unsigned char *comp;	/* Compressed blocks, LZJODY_CBSIZE apart */
+	int *comp_len;	/* Payload length of each compressed block */
+};
+
+static struct lzjody_ctx ctx;
+static unsigned char out[LZJODY_CBSIZE * 2];
+static volatile int sink;	/* Keeps kernel results alive */
+
+/* perf_event file descriptors or -1; perf_fd[0] leads the group */
+static int perf_fd[CNT_MAX] = { -1, -1, -1, -1 };
+static struct counts_t meter;	/* Accumulated by meter_start()/meter_stop() */
+static uint64_t tsc_start;
+
+
+/*** Counters ***/
+
+static inline uint64_t read_cycles(void)
+{
+#if defined __x86_64__ || defined __i386__
+	return __rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+#ifdef __linux__
+static int perf_open(const uint64_t config, const int group)
+{
+	struct perf_event_attr pe;
+
+	memset(&pe, 0, sizeof(pe));
+	pe.size = sizeof(pe);
+	pe.type = PERF_TYPE_HARDWARE;
+	pe.config = config;
+	pe.disabled = (group == -1);
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	pe.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
+	return (int)syscall(__NR_perf_event_open, &pe, 0, -1, group, 0);
+}
+#endif
+
+/* Open whichever hardware counters the kernel allows; returns nonzero
+ * if at least the cycle counter is available */
+static int perf_init(void)
+{
+#ifdef __linux__
+	static const uint64_t config[CNT_MAX] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES
+	};
+	int i;
+
+	perf_fd[0] = perf_open(config[0], -1);
+	if (perf_fd[0] < 0) return 0;
+	for (i = 1; i < CNT_MAX; i++) perf_fd[i] = perf_open(config[i], perf_fd[0]);
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+static void meter_reset(void)
+{
+	memset(&meter, 0, sizeof(meter));
+#ifdef __linux__
+	if (perf_fd[0] >= 0) ioctl(perf_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+#endif
+	return;
+}
+
+static inline void meter_start(void)
+{
+#ifdef __linux__
+	if (perf_fd[0] >= 0) {
+		ioctl(perf_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		return;
+	}
+#endif
+	tsc_start = read_cycles();
+	return;
+}
+
+static inline void meter_stop(void)
+{
+#ifdef __linux__
+	if (perf_fd[0] >= 0) {
+		ioctl(perf_fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+		return;
+	}
+#endif
+	meter.v[CNT_CYCLES] += read_cycles() - tsc_start;
+	return;
+}
+
+/* Collect the totals since meter_reset() into meter */
+static void meter_read(void)
+{
+#ifdef __linux__
+	struct {
+		uint64_t nr;
+		struct { uint64_t value, id; } cnt[CNT_MAX];
+	} group;
+	uint64_t id[CNT_MAX];
+	uint64_t n;
+	int i;
+
+	if (perf_fd[0] < 0) return;
+	for (i = 0; i < CNT_MAX; i++) {
+		id[i] = UINT64_MAX;
+		if (perf_fd[i] >= 0) ioctl(perf_fd[i], PERF_EVENT_IOC_ID, &id[i]);
+	}
+	if (read(perf_fd[0], &group, sizeof(group)) <= 0) return;
+	for (n = 0; n < group.nr && n < CNT_MAX; n++)
+		for (i = 0; i < CNT_MAX; i++)
+			if (group.cnt[n].id == id[i]) meter.v[i] = group.cnt[n].value;
+#endif
+	return;
+}
+
+
+/*** Corpora ***/
+
+/* Simple deterministic PRNG (xorshift64*) so corpora are reproducible */
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static inline uint64_t rng(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static inline unsigned int rng_range(const unsigned int max)
+{
+	return (unsigned int)(rng() % max);
+}
+
+static void gen_random(unsigned char *p, size_t len)
+{
+	while (len--) *p++ = (unsigned char)(rng() >> 56);
+}
+
+static const char * const words[] = {
+	"the", "of", "and", "to", "a", "in", "is", "it", "that", "for",
+	"file", "system", "block", "data", "disk", "image", "error", "kernel",
+	"device", "mount", "user", "root", "config", "value", "return", "with",
+	"partition", "sector", "compression", "buffer", "network", "address"
+};
+#define NUM_WORDS (sizeof(words) / sizeof(char *))
+
+static void gen_text(unsigned char *p, size_t len)
+{
+	size_t pos = 0, wl;
+	const char *w;
+
+	while (pos < len) {
+		w = words[rng_range(rng_range(NUM_WORDS) + 1)];
+		wl = strlen(w);
+		if (pos + wl + 1 > len) break;
+		memcpy(p + pos, w, wl);
+		pos += wl;
+		p[pos++] = (rng_range(10) == 0) ? '\n' : ' ';
+	}
+	while (pos < len) p[pos++] = '\n';
+}
+
+/* Column-structured records that need a byte plane transform */
+static void gen_tables(unsigned char *p, size_t len)
+{
+	size_t pos = 0;
+	uint8_t counter = (uint8_t)rng();
+	uint8_t flags = 0x80;
+
+	while (pos + 4 <= len) {
+		if ((pos & (LZJODY_BSIZE - 1)) == 0) flags = (uint8_t)rng();
+		p[pos] = counter++;
+		p[pos + 1] = 0xff;
+		p[pos + 2] = flags;
+		p[pos + 3] = (unsigned char)(0xb0 + rng_range(0x40));
+		pos += 4;
+	}
+	while (pos < len) p[pos++] = 0;
+}
+
+/* Runs of random bytes */
+static void gen_runs(unsigned char *p, size_t len)
+{
+	unsigned int n;
+
+	while (len) {
+		n = 8 + rng_range(57);
+		if (n > len) n = (unsigned int)len;
+		memset(p, (int)(rng() >> 56), n);
+		p += n;
+		len -= n;
+	}
+}
+
+/* Fills of random 2-, 4- and 8-byte patterns */
+static void gen_fills(unsigned char *p, size_t len)
+{
+	unsigned char pat[8];
+	unsigned int n, period, i;
+
+	while (len) {
+		period = 2U << rng_range(3);
+		gen_random(pat, period);
+		n = 32 + rng_range(97);
+		if (n > len) n = (unsigned int)len;
+		for (i = 0; i < n; i++) p[i] = pat[i & (period - 1)];
+		p += n;
+		len -= n;
+	}
+}
+
+/* Slices of a random dictionary at the start of each block */
+static void gen_copies(unsigned char *p, size_t len)
+{
+	size_t pos = 0;
+	unsigned int n, off;
+
+	while (pos < len) {
+		if ((pos & (LZJODY_BSIZE - 1)) == 0) {
+			gen_random(p + pos, 512);
+			pos += 512;
+			continue;
+		}
+		n = 8 + rng_range(57);
+		off = rng_range(512 - n);
+		/* Don't run into the next block's dictionary */
+		if (n > LZJODY_BSIZE - (pos & (LZJODY_BSIZE - 1)))
+			n = LZJODY_BSIZE - (unsigned int)(pos & (LZJODY_BSIZE - 1));
+		if (pos + n > len) n = (unsigned int)(len - pos);
+		memmove(p + pos, p + (pos & ~(size_t)(LZJODY_BSIZE - 1)) + off, n);
+		pos += n;
+	}
+}
+
+/* Incrementing 8-, 16- and 32-bit values from random starting points */
+static void gen_seq(unsigned char *p, size_t len, const unsigned int width)
+{
+	uint32_t v = 0;
+	unsigned int n = 0;
+	size_t pos;
+
+	for (pos = 0; pos + width <= len; pos += width) {
+		if (n == 0) {
+			v = (uint32_t)rng();
+			n = 8 + rng_range(25);
+		}
+		memcpy(p + pos, &v, width);
+		v++;
+		n--;
+	}
+	memset(p + pos, 0, len - pos);
+}
+static void gen_seq8(unsigned char *p, size_t len) { gen_seq(p, len, 1); }
+static void gen_seq16(unsigned char *p, size_t len) { gen_seq(p, len, 2); }
+static void gen_seq32(unsigned char *p, size_t len) { gen_seq(p, len, 4); }
+
+static const struct {
+	const char *name;
+	void (*gen)(unsigned char *, size_t);
+	unsigned int options;	/* Compressor options for decoder corpora */
+	int mode;	/* Command the decoder corpus exercises, 0 if none */
+} generators[] = {
+	{ "text", gen_text, 0, 0 },
+	{ "random", gen_random, 0, P_LIT },
+	{ "tables", gen_tables, 0, P_PLANE },
+	{ "runs", gen_runs, 0, P_RLE },
+	{ "copies", gen_copies, 0, P_LZ },
+	{ "fills", gen_fills, 0, P_PATTERN },
+	{ "seq8", gen_seq8, 0, P_SEQ8 },
+	{ "seq16", gen_seq16, 0, P_SEQ16 },
+	{ "seq32", gen_seq32, 0, P_SEQ32 },
+	{ "huffman", gen_text, O_HUFFMAN, P_HUFF },
+	{ NULL, NULL, 0, 0 }
+};
+
+
+/*** Kernels ***/
+
+/* Point the context's block state at block blk of a corpus */
+static struct comp_data_t *setup(const struct corpus_t * const c, const unsigned int blk)
+{
+	struct comp_data_t * const data = &ctx.data;
+
+	data->in = c->data + (size_t)blk * LZJODY_BSIZE;
+	data->out = out;
+	data->ipos = 0;
+	data->opos = 2;
+	data->literals = 0;
+	data->literal_start = 0;
+	data->skipped = 0;
+	data->length = LZJODY_BSIZE;
+	data->options = O_REALFLUSH;
+	data->ctx = &ctx;
+	data->stats = NULL;
+	data->trace = NULL;
+	return data;
+}
+
+/* Each finder parses the block greedily on its own: a hit skips the
+ * input it covered and a miss moves on by one byte */
+#define FINDER_LOOP(call) do { \
+		data->ipos = 0; \
+		while (data->ipos < LZJODY_BSIZE) { \
+			pos = data->ipos; \
+			data->opos = 2; \
+			data->literals = 0; \
+			calls++; \
+			r = (call); \
+			if (r < 0) break; \
+			if (r == 0) data->ipos = pos + 1; \
+		} \
+	} while (0)
+
+static NOINLINE uint64_t k_index(const struct corpus_t * const c)
+{
+	unsigned int blk;
+	int r = 0;
+
+	for (blk = 0; blk < c->blocks; blk++) {
+		setup(c, blk);
+		meter_start();
+		r += index_bytes(&ctx.data, &ctx.idx);
+		meter_stop();
+	}
+	sink = r;
+	return c->blocks;
+}
+
+static NOINLINE uint64_t k_lz(const struct corpus_t * const c)
+{
+	struct comp_data_t *data;
+	unsigned int blk, pos;
+	uint64_t calls = 0;
+	int r = 0;
+
+	for (blk = 0; blk < c->blocks; blk++) {
+		data = setup(c, blk);
+		index_bytes(data, &ctx.idx);
+		meter_start();
+		FINDER_LOOP(lzjody_find_lz(data, &ctx.idx, O_REALFLUSH, 0));
+		meter_stop();
+	}
+	sink = r;
+	return calls;
+}
+
+#define FINDER_KERNEL(name, finder) \
+static NOINLINE uint64_t name(const struct corpus_t * const c) \
+{ \
+	struct comp_data_t *data; \
+	unsigned int blk, pos; \
+	uint64_t calls = 0; \
+	int r = 0; \
+	for (blk = 0; blk < c->blocks; blk++) { \
+		data = setup(c, blk); \
+		meter_start(); \
+		FINDER_LOOP(finder(data, O_REALFLUSH, 0)); \
+		meter_stop(); \
+	} \
+	sink = r; \
+	return calls; \
+}
+FINDER_KERNEL(k_rle, lzjody_find_rle)
+FINDER_KERNEL(k_seq8, lzjody_find_seq8)
+FINDER_KERNEL(k_seq16, lzjody_find_seq16)
+FINDER_KERNEL(k_seq32, lzjody_find_seq32)
+
+static NOINLINE uint64_t k_pattern(const struct corpus_t * const c)
+{
+	struct comp_data_t *data;
+	unsigned int blk, pos;
+	uint64_t calls = 0;
+	int r = 0;
+
+	for (blk = 0; blk < c->blocks; blk++) {
+		data = setup(c, blk);
+		meter_start();
+		FINDER_LOOP(lzjody_find_pattern(data, &ctx.idx, O_REALFLUSH, 0));
+		meter_stop();
+	}
+	sink = r;
+	return calls;
+}
+
+static NOINLINE uint64_t k_plane(const struct corpus_t * const c, const int dir)
+{
+	unsigned int blk;
+	int r = 0;
+
+	for (blk = 0; blk < c->blocks; blk++) {
+		meter_start();
+		r += byteplane_transform(c->data + (size_t)blk * LZJODY_BSIZE, out, LZJODY_BSIZE, dir);
+		meter_stop();
+	}
+	sink = r;
+	return c->blocks;
+}
+static NOINLINE uint64_t k_plane_fwd(const struct corpus_t * const c) { return k_plane(c, 4); }
+static NOINLINE uint64_t k_plane_inv(const struct corpus_t * const c) { return k_plane(c, -4); }
+
+static NOINLINE uint64_t k_decode(const struct corpus_t * const c)
+{
+	unsigned int blk;
+	int r = 0;
+
+	meter_start();
+	for (blk = 0; blk < c->blocks; blk++)
+		r += lzjody_decompress(c->comp + (size_t)blk * LZJODY_CBSIZE + 2, out,
+				(unsigned int)c->comp_len[blk], 0);
+	meter_stop();
+	sink = r;
+	return c->blocks;
+}
+
+/* Which corpora each kernel runs on: encoder kernels on everything
+ * that isn't only meant for the decoder, decode on the decoder corpora */
+#define ON_ENCODER 1
+#define ON_DECODER 2
+
+static const struct {
+	const char *name;
+	uint64_t (*run)(const struct corpus_t * const);	/* Returns calls made */
+	int on;
+} kernels[] = {
+	{ "index_bytes", k_index, ON_ENCODER },
+	{ "find_lz", k_lz, ON_ENCODER },
+	{ "find_rle", k_rle, ON_ENCODER },
+	{ "find_seq8", k_seq8, ON_ENCODER },
+	{ "find_seq16", k_seq16, ON_ENCODER },
+	{ "find_seq32", k_seq32, ON_ENCODER },
+	{ "find_pattern", k_pattern, ON_ENCODER },
+	{ "plane_fwd", k_plane_fwd, ON_ENCODER },
+	{ "plane_inv", k_plane_inv, ON_ENCODER },
+	{ "decode", k_decode, ON_DECODER },
+	{ NULL, NULL, 0 }
+};
+
+
+/* Percentage of a corpus's decoded bytes produced by one command type */
+static double command_share(const struct corpus_t * const c, const int mode)
+{
+	struct cmd_info_t cmd;
+	unsigned int blk, ipos;
+	uint64_t hit = 0, total = 0;
+	const unsigned char *in;
+
+	for (blk = 0; blk < c->blocks; blk++) {
+		in = c->comp + (size_t)blk * LZJODY_CBSIZE + 2;
+		for (ipos = 0; ipos < (unsigned int)c->comp_len[blk]; ipos = cmd.next) {
+			if (lzjody_parse_command(in, (unsigned int)c->comp_len[blk], ipos, &cmd) < 0) break;
+			if (cmd.mode == (unsigned int)mode) hit += cmd.length;
+			total += cmd.length;
+			if (cmd.mode == P_HUFF) break;
+		}
+	}
+	return total ? 100.0 * (double)hit / (double)total : 0.0;
+}
+
+/* Print a counter per unit, or "-" if it wasn't measured */
+static void print_rate(const int cnt, const uint64_t value, const double unit)
+{
+	if (cnt != CNT_CYCLES && perf_fd[cnt] < 0) printf(" %9s", "-");
+	else printf(" %9.2f", (double)value / unit);
+	return;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "lzjody_kbench %s (%s)\n", KBENCH_VER, KBENCH_VERDATE);
+	fprintf(stderr, "\nusage: lzjody_kbench [-b blocks] [-p passes] [-t]\n\n");
+	fprintf(stderr, "  -b   blocks in each corpus (default %d)\n", DEF_BLOCKS);
+	fprintf(stderr, "  -p   timed passes per kernel; the fastest is reported (default %d)\n",
+			DEF_PASSES);
+	fprintf(stderr, "  -t   use only the cycle counter, not perf_event counters\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct corpus_t corpora[sizeof(generators) / sizeof(generators[0])];
+	struct counts_t best;
+	unsigned int blocks = DEF_BLOCKS;
+	unsigned int blk;
+	int passes = DEF_PASSES, use_perf = 1;
+	int count = 0, i, k, pass;
+	uint64_t calls = 0, bytes;
+	double share;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+			blocks = (unsigned int)strtoul(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+			passes = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-t")) {
+			use_perf = 0;
+		} else {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (blocks < 1 || passes < 1) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	lzjody_ctx_init(&ctx);
+	for (i = 0; generators[i].name != NULL; i++) {
+		struct corpus_t * const c = &corpora[count++];
+
+		c->name = generators[i].name;
+		c->blocks = blocks;
+		c->data = (unsigned char *)malloc((size_t)blocks * LZJODY_BSIZE);
+		c->comp = (unsigned char *)malloc((size_t)blocks * LZJODY_CBSIZE);
+		c->comp_len = (int *)malloc(blocks * sizeof(int));
+		if (!c->data || !c->comp || !c->comp_len) goto oom;
+		generators[i].gen(c->data, (size_t)blocks * LZJODY_BSIZE);
+		for (blk = 0; blk < blocks; blk++) {
+			c->comp_len[blk] = lzjody_compress_ctx(&ctx, c->data + (size_t)blk * LZJODY_BSIZE,
+					c->comp + (size_t)blk * LZJODY_CBSIZE,
+					generators[i].options, LZJODY_BSIZE) - 2;
+			if (c->comp_len[blk] < 0) goto error_compress;
+		}
+	}
+
+	if (!use_perf || !perf_init()) use_perf = 0;
+	printf("# lzjody_kbench %s, block size %d, %u blocks per corpus, best of %d passes\n",
+			KBENCH_VER, LZJODY_BSIZE, blocks, passes);
+	printf("# counters: %s; rates are per input byte (branch and cache misses per KiB)\n",
+			use_perf ? "perf_event" : "cycle counter only");
+	printf("%-12s %-8s %5s %9s %9s %9s %9s %9s\n", "kernel", "corpus", "share",
+			"calls", "cyc/B", "ins/B", "brmis/KB", "cmis/KB");
+
+	for (k = 0; kernels[k].name != NULL; k++) {
+		for (i = 0; i < count; i++) {
+			const struct corpus_t * const c = &corpora[i];
+
+			if (kernels[k].on == ON_DECODER && generators[i].mode == 0) continue;
+			if (kernels[k].on == ON_ENCODER && generators[i].options != 0) continue;
+			memset(&best, 0xff, sizeof(best));
+			for (pass = 0; pass < passes; pass++) {
+				meter_reset();
+				calls = kernels[k].run(c);
+				meter_read();
+				if (meter.v[CNT_CYCLES] < best.v[CNT_CYCLES]) best = meter;
+			}
+			bytes = (uint64_t)c->blocks * LZJODY_BSIZE;
+			printf("%-12s %-8s", kernels[k].name, c->name);
+			if (kernels[k].on == ON_DECODER) {
+				share = command_share(c, generators[i].mode);
+				printf(" %4.0f%%", share);
+			} else printf(" %5s", "-");
+			printf(" %9llu", (unsigned long long)calls);
+			print_rate(CNT_CYCLES, best.v[CNT_CYCLES], (double)bytes);
+			print_rate(CNT_INSNS, best.v[CNT_INSNS], (double)bytes);
+			print_rate(CNT_BRMISS, best.v[CNT_BRMISS], (double)bytes / 1024.0);
+			print_rate(CNT_CMISS, best.v[CNT_CMISS], (double)bytes / 1024.0);
+			printf("\n");
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		free(corpora[i].data);
+		free(corpora[i].comp);
+		free(corpora[i].comp_len);
+	}
+	exit(EXIT_SUCCESS);
+
+error_compress:
+	fprintf(stderr, "lzjody_kbench: compression failed\n");
+	exit(EXIT_FAILURE);
+oom:
+	fprintf(stderr, "lzjody_kbench: out of memory\n");
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,354 @@
+/*
+ * Lempel-Ziv-JodyBruchon compression library
+ * Asynchronous compression jobs on a pool of worker threads
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ *
+ * Callers hand struct lzjody_job requests to a queue and get on with
+ * their own work. Each worker thread owns a compression context, so jobs
+ * never share compressor state. lzjody_queue_submit() never blocks: once
+ * "depth" jobs are in flight it refuses new ones until some are reaped,
+ * which gives I/O threads backpressure without stalling them. A finished
+ * job either has its callback run on the worker or waits on a ready list
+ * for lzjody_queue_reap(); the read end of a pipe becomes readable when
+ * that list stops being empty, so callers can wait for jobs in the same
+ * poll() or epoll loop as their other descriptors. Windows has no pipe()
+ * or fcntl(); there the pipe comes from _pipe() and can't be polled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "lzjody.h"
+
+/* Detect Windows and modify as needed (Cygwin has pipe() and fcntl()) */
+#ifdef _WIN32
+ #define ON_WINDOWS 1
+ #include <io.h>
+#endif
+
+/* Jobs allowed in flight per worker if the caller doesn't say */
+#define DEF_DEPTH_PER_THREAD 4
+
+struct queue_worker_t {
+	struct lzjody_queue *q;
+	struct lzjody_ctx *ctx;	/* This worker's compression context */
+	pthread_t id;
+	int started;	/* Was the thread created? */
+};
+
+struct lzjody_queue {
+	pthread_mutex_t lock;	/* Protects everything below */
+	pthread_cond_t work;	/* A job was submitted or the queue is stopping */
+	pthread_cond_t ready;	/* A job joined the ready list */
+	struct lzjody_job *head;	/* Submitted jobs waiting for a worker */
+	struct lzjody_job *tail;
+	struct lzjody_job *ready_head;	/* Finished jobs waiting to be reaped */
+	struct lzjody_job *ready_tail;
+	unsigned int depth;	/* Most jobs in flight */
+	unsigned int in_flight;	/* Jobs submitted and not yet reaped */
+	unsigned int threads;
+	int stop;	/* Workers exit once the submitted jobs are done */
+	int fd[2];	/* Notification pipe: readable while jobs are ready */
+	int notified;	/* A byte is waiting in the pipe */
+	struct queue_worker_t *worker;
+};
+
+
+/* Compress a job's input into prefixed blocks; returns the output length */
+static int64_t run_compress(struct lzjody_ctx * const ctx,
+		const struct lzjody_job * const job)
+{
+	/* Blocks are always prefixed so that they can be found again */
+	const unsigned int options = job->options & ~(unsigned int)O_NOPREFIX;
+	const unsigned int slack = (options & O_CHECKSUM) ? 8 : 4;
+	size_t ipos = 0, opos = 0;
+	unsigned int bsize;
+	int i;
+
+	while (ipos < job->length) {
+		bsize = LZJODY_BSIZE;
+		if (job->length - ipos < LZJODY_BSIZE) bsize = (unsigned int)(job->length - ipos);
+		if (job->out_size - opos < (size_t)bsize + slack) goto error_space;
+		i = lzjody_compress_ctx(ctx, job->in + ipos, job->out + opos, options, bsize);
+		if (i < 0) return -1;
+		ipos += bsize;
+		opos += (size_t)i;
+	}
+	return (int64_t)opos;
+
+error_space:
+	fprintf(stderr, "liblzjody: job output buffer too small (%zu bytes)\n", job->out_size);
+	return -1;
+}
+
+
+/* Decompress a job's prefixed blocks; returns the output length */
+static int64_t run_decompress(const struct lzjody_job * const job)
+{
+	unsigned char blk[LZJODY_BSIZE];
+	unsigned char *dest;
+	size_t ipos = 0, opos = 0;
+	unsigned int length;
+	unsigned char flags;
+	int i;
+
+	while (ipos < job->length) {
+		if (job->length - ipos < 2) goto error_truncated;
+		flags = job->in[ipos] & 0xe0;
+		length = ((unsigned int)(job->in[ipos] & 0x1f) << 8) | job->in[ipos + 1];
+		ipos += 2;
+		if (length > job->length - ipos) goto error_truncated;
+
+		/* Decode straight to the output unless a short last block
+		 * might not fit */
+		dest = (job->out_size - opos >= LZJODY_BSIZE) ? job->out + opos : blk;
+		if (flags & O_NOCOMPRESS) {
+			if (length > LZJODY_BSIZE) goto error_truncated;
+			memcpy(dest, job->in + ipos, length);
+			i = (int)length;
+		} else {
+			i = lzjody_decompress(job->in + ipos, dest, length, flags);
+			if (i < 0) return -1;
+		}
+		if (dest == blk) {
+			if ((size_t)i > job->out_size - opos) goto error_space;
+			memcpy(job->out + opos, blk, (size_t)i);
+		}
+		ipos += length;
+		opos += (size_t)i;
+	}
+	return (int64_t)opos;
+
+error_truncated:
+	fprintf(stderr, "liblzjody: job input has a bad block at offset %zu\n", ipos);
+	return -1;
+error_space:
+	fprintf(stderr, "liblzjody: job output buffer too small (%zu bytes)\n", job->out_size);
+	return -1;
+}
+
+
+static void *queue_worker(void *arg)
+{
+	struct queue_worker_t * const w = (struct queue_worker_t *)arg;
+	struct lzjody_queue * const q = w->q;
+	struct lzjody_job *job;
+	const char wake = 1;
+
+	pthread_mutex_lock(&q->lock);
+	while (1) {
+		while (!q->head && !q->stop) pthread_cond_wait(&q->work, &q->lock);
+		job = q->head;
+		if (!job) break;
+		q->head = job->next;
+		if (!q->head) q->tail = NULL;
+		pthread_mutex_unlock(&q->lock);
+
+		if (job->type == LZJODY_JOB_COMPRESS) job->result = run_compress(w->ctx, job);
+		else job->result = run_decompress(job);
+
+		/* A callback owns the job from here on; its slot is freed after
+		 * it returns so that it can't be overrun by new submissions */
+		if (job->done) {
+			job->done(job);
+			pthread_mutex_lock(&q->lock);
+			q->in_flight--;
+			/* Wake reapers waiting on nothing but callback jobs */
+			pthread_cond_broadcast(&q->ready);
+			continue;
+		}
+
+		pthread_mutex_lock(&q->lock);
+		job->next = NULL;
+		if (q->ready_tail) q->ready_tail->next = job;
+		else q->ready_head = job;
+		q->ready_tail = job;
+		if (!q->notified) {
+			/* The pipe only ever holds one byte, so it can't fill */
+			if (write(q->fd[1], &wake, 1) == 1) q->notified = 1;
+		}
+		pthread_cond_broadcast(&q->ready);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
+
+
+/* Start a queue with a number of worker threads (0 for one per online
+ * processor) that accepts up to depth jobs in flight (0 for a default) */
+extern struct lzjody_queue *lzjody_queue_new(unsigned int threads, unsigned int depth)
+{
+	struct lzjody_queue *q;
+	unsigned int i;
+	long n;
+
+	if (threads == 0) {
+		threads = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+		if (n > 0) threads = (unsigned int)n;
+#else
+		(void)n;
+#endif
+	}
+	if (depth == 0) depth = threads * DEF_DEPTH_PER_THREAD;
+
+	q = (struct lzjody_queue *)calloc(1, sizeof(struct lzjody_queue));
+	if (!q) goto error_oom;
+	q->depth = depth;
+	q->threads = threads;
+	q->worker = (struct queue_worker_t *)calloc(threads, sizeof(struct queue_worker_t));
+	if (!q->worker) goto error_oom_free;
+	/* The pipe never holds more than one byte and is only read while
+	 * holding one, so non-blocking mode is only a safeguard */
+#ifdef ON_WINDOWS
+	if (_pipe(q->fd, 64, _O_BINARY | _O_NOINHERIT) != 0) goto error_pipe;
+#else
+	if (pipe(q->fd) != 0) goto error_pipe;
+	for (i = 0; i < 2; i++) {
+		fcntl(q->fd[i], F_SETFL, fcntl(q->fd[i], F_GETFL) | O_NONBLOCK);
+		fcntl(q->fd[i], F_SETFD, FD_CLOEXEC);
+	}
+#endif /* ON_WINDOWS */
+	if (pthread_mutex_init(&q->lock, NULL) != 0) goto error_init;
+	if (pthread_cond_init(&q->work, NULL) != 0) goto error_init_lock;
+	if (pthread_cond_init(&q->ready, NULL) != 0) goto error_init_work;
+
+	for (i = 0; i < threads; i++) {
+		q->worker[i].q = q;
+		q->worker[i].ctx = lzjody_ctx_new();
+		if (!q->worker[i].ctx) goto error_workers;
+		if (pthread_create(&q->worker[i].id, NULL, queue_worker, &q->worker[i]) != 0)
+			goto error_workers;
+		q->worker[i].started = 1;
+	}
+	return q;
+
+error_workers:
+	fprintf(stderr, "liblzjody: cannot start job queue worker %u\n", i);
+	lzjody_queue_free(q);
+	return NULL;
+error_init_work:
+	pthread_cond_destroy(&q->work);
+error_init_lock:
+	pthread_mutex_destroy(&q->lock);
+error_init:
+	close(q->fd[0]);
+	close(q->fd[1]);
+error_pipe:
+	fprintf(stderr, "liblzjody: cannot set up job queue notification\n");
+	free(q->worker);
+	free(q);
+	return NULL;
+error_oom_free:
+	free(q);
+error_oom:
+	fprintf(stderr, "liblzjody: out of memory allocating a job queue\n");
+	return NULL;
+}
+
+
+/* Queue a job without blocking
+ * Returns 0 if it was queued, 1 if depth jobs are already in flight
+ * (reap some and try again) or -1 if the job is invalid */
+extern int lzjody_queue_submit(struct lzjody_queue * const q, struct lzjody_job * const job)
+{
+	if ((job->type != LZJODY_JOB_COMPRESS) && (job->type != LZJODY_JOB_DECOMPRESS))
+		goto error_type;
+	if (!job->in || !job->out) goto error_buffer;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->stop) goto error_stopped;
+	if (q->in_flight >= q->depth) {
+		pthread_mutex_unlock(&q->lock);
+		return 1;
+	}
+	q->in_flight++;
+	job->result = -1;
+	job->next = NULL;
+	if (q->tail) q->tail->next = job;
+	else q->head = job;
+	q->tail = job;
+	pthread_cond_signal(&q->work);
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+
+error_type:
+	fprintf(stderr, "liblzjody: invalid job type %d\n", job->type);
+	return -1;
+error_buffer:
+	fprintf(stderr, "liblzjody: job has no input or output buffer\n");
+	return -1;
+error_stopped:
+	pthread_mutex_unlock(&q->lock);
+	fprintf(stderr, "liblzjody: job submitted to a queue that is shutting down\n");
+	return -1;
+}
+
+
+/* Take up to max finished jobs (those without a callback) in the order
+ * they finished. If wait is nonzero, block until at least one is ready
+ * unless no job is in flight. Returns the number of jobs stored in jobs */
+extern unsigned int lzjody_queue_reap(struct lzjody_queue * const q,
+		struct lzjody_job ** const jobs, const unsigned int max, const int wait)
+{
+	unsigned int n = 0;
+	char drain;
+
+	pthread_mutex_lock(&q->lock);
+	if (wait) while (!q->ready_head && (q->in_flight > 0) && (max > 0))
+		pthread_cond_wait(&q->ready, &q->lock);
+	while ((n < max) && q->ready_head) {
+		jobs[n] = q->ready_head;
+		q->ready_head = jobs[n]->next;
+		jobs[n]->next = NULL;
+		n++;
+	}
+	if (!q->ready_head) {
+		q->ready_tail = NULL;
+		if (q->notified && (read(q->fd[0], &drain, 1) == 1)) q->notified = 0;
+	}
+	q->in_flight -= n;
+	pthread_mutex_unlock(&q->lock);
+	return n;
+}
+
+
+/* Descriptor that polls readable while finished jobs wait to be reaped
+ * (on Windows a CRT pipe descriptor, which can't be polled) */
+extern int lzjody_queue_fd(const struct lzjody_queue * const q)
+{
+	return q->fd[0];
+}
+
+
+/* Run every submitted job to completion, then stop the workers and free
+ * the queue; jobs that were never reaped are left to the caller */
+extern void lzjody_queue_free(struct lzjody_queue * const q)
+{
+	unsigned int i;
+
+	if (!q) return;
+	pthread_mutex_lock(&q->lock);
+	q->stop = 1;
+	pthread_cond_broadcast(&q->work);
+	pthread_mutex_unlock(&q->lock);
+	for (i = 0; i < q->threads; i++) {
+		if (q->worker[i].started) pthread_join(q->worker[i].id, NULL);
+		if (q->worker[i].ctx) lzjody_ctx_free(q->worker[i].ctx);
+	}
+	pthread_cond_destroy(&q->ready);
+	pthread_cond_destroy(&q->work);
+	pthread_mutex_destroy(&q->lock);
+	close(q->fd[0]);
+	close(q->fd[1]);
+	free(q->worker);
+	free(q);
+	return;
+}
@@ -0,0 +1,199 @@
+/*
+ * Lempel-Ziv-JodyBruchon compression library
+ * Delta compression against a reference image
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ *
+ * A clone of a disk image differs from its base in a few places, so each
+ * block of the clone mostly equals the base at the same offset. With a
+ * reference attached, a block is first compared with the reference at
+ * its own offset: an identical block becomes one copy, and any runs of
+ * at least REF_MIN_MATCH equal bytes become copies. Where gaps remain,
+ * the reference from REF_NEAR bytes before the block to REF_NEAR bytes
+ * after it is indexed with the same gear hash anchors the stream window
+ * uses (see lzjody_window.c) to catch data that moved a little. Copies
+ * only name a distance from their own offset, so blocks still decompress
+ * independently of each other, given the same reference.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "lzjody_ref.h"
+
+/* One position in 2^n is an anchor */
+#define REF_ANCHOR_BITS 3
+#define REF_IS_ANCHOR(h) (((h) >> (32 - REF_ANCHOR_BITS)) == 0)
+
+static inline unsigned int ref_slot(const uint32_t h)
+{
+	return (unsigned int)((h * 2654435761U) >> (32 - REF_HASH_BITS));
+}
+
+
+/* Wrap a reference image; the caller keeps the memory until the
+ * reference is freed */
+extern struct lzjody_ref *lzjody_ref_new(const unsigned char * const data,
+		const uint64_t size)
+{
+	struct lzjody_ref *r;
+	uint32_t x = 0x2545f491;
+	int i;
+
+	r = (struct lzjody_ref *)malloc(sizeof(struct lzjody_ref));
+	if (!r) goto error_oom;
+	r->data = data;
+	r->size = size;
+	for (i = 0; i < 256; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		r->gear[i] = x;
+	}
+	return r;
+
+error_oom:
+	fprintf(stderr, "liblzjody: out of memory allocating a reference\n");
+	return NULL;
+}
+
+
+extern void lzjody_ref_free(struct lzjody_ref * const r)
+{
+	free(r);
+	return;
+}
+
+
+/* Is every byte of a match the same value? RLE does those better. */
+static int one_value(const unsigned char * const p, const unsigned int length)
+{
+	unsigned int i;
+
+	for (i = 1; (i < length) && (p[i] == p[0]); i++);
+	return i == length;
+}
+
+
+/* Find runs where a block equals the reference at its own offset */
+static unsigned int find_same(const unsigned char * const restrict blk,
+		const unsigned char * const restrict ref, const unsigned int avail,
+		struct ref_match_t * const restrict m)
+{
+	unsigned int i = 0, j, n = 0;
+
+	while (i < avail) {
+		if (blk[i] != ref[i]) {
+			i++;
+			continue;
+		}
+		for (j = i + 1; (j < avail) && (blk[j] == ref[j]); j++);
+		if ((j - i >= REF_MIN_MATCH) && !one_value(blk + i, j - i)) {
+			m[n].start = (uint16_t)i;
+			m[n].length = (uint16_t)(j - i);
+			m[n].delta = 0;
+			n++;
+		}
+		i = j;
+	}
+	return n;
+}
+
+
+/* Find matches of at least REF_MIN_MATCH bytes between the block at
+ * stream offset pos and the reference, in block order and not
+ * overlapping. Returns the number of matches. */
+extern unsigned int ref_find(const struct lzjody_ref * const restrict r,
+		const uint64_t pos, const unsigned char * const restrict blk,
+		const unsigned int length, struct ref_scratch_t * const restrict s,
+		struct ref_match_t * const restrict m)
+{
+	const unsigned char * const data = r->data;
+	uint64_t lo, hi, src;
+	unsigned int avail, nsame, k = 0, n = 0, i, fwd, back;
+	unsigned int gap_start = 0, gap_end, done = 0;
+	uint32_t h = 0;
+	uint16_t at;
+
+	if (pos >= r->size) return 0;
+	avail = (r->size - pos < length) ? (unsigned int)(r->size - pos) : length;
+
+	/* Unchanged blocks are the common case */
+	if ((avail == length) && !memcmp(blk, data + pos, length)) {
+		m[0].start = 0;
+		m[0].length = (uint16_t)length;
+		m[0].delta = 0;
+		return 1;
+	}
+	nsame = find_same(blk, data + pos, avail, s->same);
+
+	/* Search the nearby reference only if a long enough gap is left */
+	for (i = 0; i <= nsame; i++) {
+		gap_start = i ? (unsigned int)(s->same[i - 1].start + s->same[i - 1].length) : 0;
+		gap_end = (i < nsame) ? s->same[i].start : length;
+		if (gap_end - gap_start >= REF_MIN_MATCH) break;
+	}
+	if (i > nsame) {
+		memcpy(m, s->same, nsame * sizeof(struct ref_match_t));
+		return nsame;
+	}
+
+	lo = (pos > REF_NEAR) ? pos - REF_NEAR : 0;
+	hi = pos + length + REF_NEAR;
+	if (hi > r->size) hi = r->size;
+	memset(s->table, 0, sizeof(s->table));
+	for (src = lo; src < hi; src++) {
+		h = (h << 1) + r->gear[data[src]];
+		if (REF_IS_ANCHOR(h)) s->table[ref_slot(h)] = (uint16_t)(src - lo + 1);
+	}
+
+	/* Walk the block, passing same-offset matches through in order and
+	 * looking up anchors in the gaps between them */
+	h = 0;
+	gap_start = 0;
+	gap_end = nsame ? s->same[0].start : length;
+	for (i = 0; i < length; i++) {
+		h = (h << 1) + r->gear[blk[i]];
+		if (i == gap_end) {
+			m[n++] = s->same[k];
+			gap_start = gap_end + s->same[k].length;
+			k++;
+			gap_end = (k < nsame) ? s->same[k].start : length;
+			done = gap_start;
+		}
+		if ((i < done) || !REF_IS_ANCHOR(h)) continue;
+		at = s->table[ref_slot(h)];
+		if (at == 0) continue;
+		src = lo + at - 1;
+		if (data[src] != blk[i]) continue;
+
+		for (fwd = 1; (i + fwd < gap_end) && (src + fwd < r->size)
+				&& (data[src + fwd] == blk[i + fwd]); fwd++);
+		for (back = 0; (i - back > done) && (src - back > 0)
+				&& (data[src - back - 1] == blk[i - back - 1]); back++);
+		if (back + fwd < REF_MIN_MATCH) continue;
+		done = i + fwd;
+		if (one_value(blk + i - back, back + fwd)) continue;
+
+		m[n].start = (uint16_t)(i - back);
+		m[n].length = (uint16_t)(back + fwd);
+		m[n].delta = (int32_t)((int64_t)src - (int64_t)(pos + i));
+		n++;
+	}
+	return n;
+}
+
+
+/* Copy length reference bytes for output at stream offset pos that were
+ * found delta bytes away. Returns -1 if they aren't all in the reference */
+extern int ref_copy(const struct lzjody_ref * const restrict r, const uint64_t pos,
+		const int32_t delta, const unsigned int length, unsigned char * const restrict out)
+{
+	const int64_t src = (int64_t)pos + delta;
+
+	if ((src < 0) || ((uint64_t)src > r->size) || (length > r->size - (uint64_t)src)) return -1;
+	memcpy(out, r->data + src, length);
+	return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * Delta compression against a reference image
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ *
+ * See lzjody_ref.c for more information.
+ */
+
+#ifndef LZJODY_REF_H
+#define LZJODY_REF_H
+
+#include <stdint.h>
+#include "lzjody.h"
+
+/* Shortest match worth a reference copy */
+#define REF_MIN_MATCH 32
+/* Most reference copies one block can hold */
+#define REF_MAX_MATCHES (LZJODY_BSIZE / REF_MIN_MATCH)
+/* Reference bytes searched on each side of a block's own offset */
+#define REF_NEAR LZJODY_BSIZE
+/* Farthest a copy can be from its own offset (24-bit signed) */
+#define REF_MAX_DELTA 0x7fffff
+/* Sign-extend a 24-bit delta read from a P_REF command */
+#define REF_DELTA(v) ((int32_t)(((v) & 0x800000) ? (int32_t)(v) - 0x1000000 : (int32_t)(v)))
+/* Anchor hash table size for the nearby search */
+#define REF_HASH_BITS 12
+
+struct lzjody_ref {
+	const unsigned char *data;	/* The caller's reference image */
+	uint64_t size;
+	uint32_t gear[256];	/* Rolling hash byte values */
+};
+
+/* One match of a block against the reference: block bytes start to
+ * start + length - 1 equal the reference bytes delta bytes away from
+ * their own offset */
+struct ref_match_t {
+	uint16_t start;
+	uint16_t length;
+	int32_t delta;
+};
+
+/* Compressor scratch space for ref_find(), kept in each context */
+struct ref_scratch_t {
+	uint16_t table[1 << REF_HASH_BITS];	/* Region offset + 1 of the latest anchor per hash */
+	struct ref_match_t same[REF_MAX_MATCHES];	/* Matches at the block's own offset */
+};
+
+extern unsigned int ref_find(const struct lzjody_ref * const restrict,
+		const uint64_t, const unsigned char * const restrict, const unsigned int,
+		struct ref_scratch_t * const restrict, struct ref_match_t * const restrict);
+extern int ref_copy(const struct lzjody_ref * const restrict, const uint64_t,
+		const int32_t, const unsigned int, unsigned char * const restrict);
+
+#endif	/* LZJODY_REF_H */
@@ -0,0 +1,349 @@
+/*
+ * Lempel-Ziv-JodyBruchon compression library
+ * Analyzer for "lzjody -c --trace=file" output
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ *
+ * Reads a trace and prints what each command type covered and cost, a
+ * heatmap of where in the stream and where in each block the data was
+ * left as literals, and the places compression came close to or fell
+ * short of paying off: byte plane retries that were rejected or filtered,
+ * short literal runs and commands that saved at most a byte or two. With
+ * -d it prints every event instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "lzjody.h"
+#include "lzjody_util.h"
+
+#define TRACE_VER "0.1"
+#define TRACE_VERDATE "2020-07-21"
+
+/* Heatmap shape: block offsets per column and the default row count */
+#define HEAT_COLS 16
+#define HEAT_COL_BYTES (LZJODY_BSIZE / HEAT_COLS)
+#define DEF_ROWS 24
+#define MAX_ROWS 1000
+/* Literal share shown by each heatmap character, lowest first */
+static const char heat[] = " .:-=+*#%@";
+
+/* Literal run length classes: runs up to each limit */
+static const unsigned int run_limit[] = { 3, 15, 63, 255, LZJODY_BSIZE };
+#define RUN_CLASSES (sizeof(run_limit) / sizeof(run_limit[0]))
+
+/* Commands saving at most this many bytes are counted as marginal */
+#define MARGINAL_SAVING 2
+
+static const char * const names[LZJODY_ST_MAX] = {
+	"literal", "rle", "seq8", "seq16", "seq32", "lz", "plane", "huffman", "far",
+	"pattern", "ref"
+};
+
+static struct lzjody_trace_event *ev;
+static size_t nev;
+static uint32_t blocks;
+
+
+static uint32_t get16(const unsigned char * const p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t get32(const unsigned char * const p)
+{
+	return get16(p) | (get16(p + 2) << 16);
+}
+
+/* Read every event of a trace file into memory */
+static int load_trace(const char * const name)
+{
+	unsigned char r[LZJODY_TRACE_RECORD];
+	struct lzjody_trace_event *p;
+	size_t alloc = 0;
+	FILE *fp;
+
+	fp = fopen(name, "rb");
+	if (!fp) goto error_open;
+	if ((fread(r, 1, LZJODY_TRACE_HEADER, fp) != LZJODY_TRACE_HEADER)
+			|| memcmp(r, LZJODY_TRACE_MAGIC, 4)
+			|| (r[4] != LZJODY_TRACE_VERSION)) goto error_format;
+	while (fread(r, 1, LZJODY_TRACE_RECORD, fp) == LZJODY_TRACE_RECORD) {
+		if (nev == alloc) {
+			alloc = alloc ? alloc * 2 : 4096;
+			p = (struct lzjody_trace_event *)realloc(ev, alloc * sizeof(*ev));
+			if (!p) goto error_oom;
+			ev = p;
+		}
+		p = ev + nev;
+		p->block = get32(r);
+		p->pos = (uint16_t)get16(r + 4);
+		p->length = (uint16_t)get16(r + 6);
+		p->offset = get32(r + 8);
+		p->out = (uint16_t)get16(r + 12);
+		p->type = r[14];
+		p->flags = r[15];
+		if ((p->type >= LZJODY_ST_MAX) || ((uint32_t)p->pos + p->length > LZJODY_BSIZE))
+			goto error_format;
+		if (p->block >= blocks) blocks = p->block + 1;
+		nev++;
+	}
+	if (ferror(fp)) goto error_open;
+	fclose(fp);
+	return 0;
+
+error_open:
+	fprintf(stderr, "lzjody_trace: cannot read %s\n", name);
+	if (fp) fclose(fp);
+	return -1;
+error_format:
+	fprintf(stderr, "lzjody_trace: %s is not an lzjody trace (version %d)\n",
+			name, LZJODY_TRACE_VERSION);
+	fclose(fp);
+	return -1;
+error_oom:
+	fprintf(stderr, "lzjody_trace: out of memory\n");
+	fclose(fp);
+	return -1;
+}
+
+/* Does this event stand for bytes actually written to the output? */
+static int covers(const struct lzjody_trace_event * const e)
+{
+	if (e->type == LZJODY_ST_HUFF) return 0;
+	return !(e->flags & (LZJODY_TR_REJECTED | LZJODY_TR_FILTERED));
+}
+
+static void dump(void)
+{
+	size_t i;
+
+	printf("%10s %5s %5s %8s %5s %-8s %s\n",
+			"block", "pos", "len", "offset", "out", "type", "flags");
+	for (i = 0; i < nev; i++) {
+		const struct lzjody_trace_event * const e = ev + i;
+
+		printf("%10lu %5u %5u %8lu %5u %-8s %s\n",
+				(unsigned long)e->block, e->pos, e->length,
+				(unsigned long)e->offset, e->out, names[e->type],
+				(e->flags & LZJODY_TR_REJECTED) ? "rejected" :
+				(e->flags & LZJODY_TR_FILTERED) ? "filtered" : "");
+	}
+	return;
+}
+
+/* Commands, bytes covered and bytes written for each command type */
+static void type_table(void)
+{
+	uint64_t cmds[LZJODY_ST_MAX], in[LZJODY_ST_MAX], out[LZJODY_ST_MAX];
+	uint64_t total_in = 0, total_out = 0;
+	size_t i;
+	int t;
+
+	memset(cmds, 0, sizeof(cmds));
+	memset(in, 0, sizeof(in));
+	memset(out, 0, sizeof(out));
+	for (i = 0; i < nev; i++) {
+		const struct lzjody_trace_event * const e = ev + i;
+
+		if (!covers(e) && (e->type != LZJODY_ST_HUFF)) continue;
+		cmds[e->type]++;
+		in[e->type] += e->length;
+		out[e->type] += e->out;
+		if (e->type == LZJODY_ST_HUFF) continue;
+		total_in += e->length;
+		total_out += e->out;
+	}
+
+	printf("%lu blocks, %lu events, %llu -> %llu bytes before Huffman coding (%.2f%%)\n\n",
+			(unsigned long)blocks, (unsigned long)nev,
+			(unsigned long long)total_in, (unsigned long long)total_out,
+			total_in ? (double)total_out * 100.0 / (double)total_in : 0.0);
+	printf("%-8s %10s %12s %12s %8s %8s %8s\n",
+			"command", "count", "bytes in", "bytes out", "avg len", "out %", "input %");
+	for (t = 0; t < LZJODY_ST_MAX; t++) {
+		if (cmds[t] == 0) continue;
+		printf("%-8s %10llu %12llu %12llu %8.1f %8.2f %8.2f\n", names[t],
+				(unsigned long long)cmds[t], (unsigned long long)in[t],
+				(unsigned long long)out[t],
+				(double)in[t] / (double)cmds[t],
+				in[t] ? (double)out[t] * 100.0 / (double)in[t] : 0.0,
+				(t == LZJODY_ST_HUFF || !total_in) ? 0.0 :
+				(double)in[t] * 100.0 / (double)total_in);
+	}
+	return;
+}
+
+/* Share of bytes left as literals, by stream position (rows) and block
+ * offset (columns) */
+static int heatmap(unsigned int rows)
+{
+	uint64_t *lit, *all;
+	uint32_t per_row;
+	unsigned int row, col, a, b, c;
+	size_t i;
+	double share;
+
+	if (blocks == 0) return 0;
+	if (rows > blocks) rows = blocks;
+	per_row = (blocks + rows - 1) / rows;
+	rows = (blocks + per_row - 1) / per_row;
+	lit = (uint64_t *)calloc((size_t)rows * HEAT_COLS, sizeof(uint64_t));
+	all = (uint64_t *)calloc((size_t)rows * HEAT_COLS, sizeof(uint64_t));
+	if (!lit || !all) goto error_oom;
+
+	for (i = 0; i < nev; i++) {
+		const struct lzjody_trace_event * const e = ev + i;
+
+		if (!covers(e)) continue;
+		row = e->block / per_row;
+		/* Split the bytes covered among the columns they fall in */
+		for (a = e->pos; a < (unsigned int)e->pos + e->length; a = b) {
+			col = a / HEAT_COL_BYTES;
+			b = (col + 1) * HEAT_COL_BYTES;
+			if (b > (unsigned int)e->pos + e->length) b = e->pos + e->length;
+			all[row * HEAT_COLS + col] += b - a;
+			if (e->type == LZJODY_ST_LIT) lit[row * HEAT_COLS + col] += b - a;
+		}
+	}
+
+	printf("\nLiteral bytes by stream position (rows of %lu blocks) and block offset\n",
+			(unsigned long)per_row);
+	printf("('%c' none ... '%c' all; columns are %d bytes)\n\n",
+			heat[0], heat[sizeof(heat) - 2], HEAT_COL_BYTES);
+	for (row = 0; row < rows; row++) {
+		printf("%10lu |", (unsigned long)row * per_row);
+		for (col = 0; col < HEAT_COLS; col++) {
+			c = row * HEAT_COLS + col;
+			if (all[c] == 0) {
+				putchar(' ');
+				continue;
+			}
+			share = (double)lit[c] / (double)all[c];
+			putchar(heat[(int)(share * (double)(sizeof(heat) - 2) + 0.5)]);
+		}
+		printf("|\n");
+	}
+	free(lit);
+	free(all);
+	return 0;
+
+error_oom:
+	fprintf(stderr, "lzjody_trace: out of memory\n");
+	free(lit);
+	free(all);
+	return -1;
+}
+
+/* Byte plane retries, short literal runs and marginal commands */
+static void missed(void)
+{
+	uint64_t tried = 0, kept = 0, rejected = 0, filtered = 0;
+	uint64_t rejected_bytes = 0, filtered_bytes = 0;
+	uint64_t runs[RUN_CLASSES], run_bytes[RUN_CLASSES];
+	uint64_t marginal[LZJODY_ST_MAX], marginal_bytes[LZJODY_ST_MAX];
+	unsigned int k;
+	size_t i;
+	int t;
+
+	memset(runs, 0, sizeof(runs));
+	memset(run_bytes, 0, sizeof(run_bytes));
+	memset(marginal, 0, sizeof(marginal));
+	memset(marginal_bytes, 0, sizeof(marginal_bytes));
+	for (i = 0; i < nev; i++) {
+		const struct lzjody_trace_event * const e = ev + i;
+
+		if (e->type == LZJODY_ST_PLANE) {
+			if (e->flags & LZJODY_TR_FILTERED) {
+				filtered++;
+				filtered_bytes += e->length;
+				continue;
+			}
+			tried++;
+			if (e->flags & LZJODY_TR_REJECTED) {
+				rejected++;
+				rejected_bytes += e->length;
+				continue;
+			}
+			kept++;
+		}
+		if (e->type == LZJODY_ST_LIT) {
+			for (k = 0; e->length > run_limit[k]; k++);
+			runs[k]++;
+			run_bytes[k] += e->length;
+			continue;
+		}
+		if (covers(e) && (e->out + MARGINAL_SAVING >= e->length)) {
+			marginal[e->type]++;
+			marginal_bytes[e->type] += e->length;
+		}
+	}
+
+	printf("\nByte plane retries: %llu tried, %llu kept, %llu rejected (%llu bytes),"
+			" %llu filtered (%llu bytes)\n",
+			(unsigned long long)tried, (unsigned long long)kept,
+			(unsigned long long)rejected, (unsigned long long)rejected_bytes,
+			(unsigned long long)filtered, (unsigned long long)filtered_bytes);
+
+	printf("\nLiteral runs\n%-12s %10s %12s\n", "length", "runs", "bytes");
+	for (k = 0; k < RUN_CLASSES; k++) {
+		printf("%4u .. %-4u %10llu %12llu\n", k ? run_limit[k - 1] + 1 : 1,
+				run_limit[k], (unsigned long long)runs[k],
+				(unsigned long long)run_bytes[k]);
+	}
+
+	printf("\nCommands saving %d bytes or less\n%-8s %10s %12s\n",
+			MARGINAL_SAVING, "command", "count", "bytes in");
+	for (t = 0; t < LZJODY_ST_MAX; t++) {
+		if (marginal[t] == 0) continue;
+		printf("%-8s %10llu %12llu\n", names[t],
+				(unsigned long long)marginal[t],
+				(unsigned long long)marginal_bytes[t]);
+	}
+	return;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "lzjody_trace %s (%s): analyze an 'lzjody -c --trace=file' trace\n",
+			TRACE_VER, TRACE_VERDATE);
+	fprintf(stderr, "\nusage: lzjody_trace [-d] [-r rows] file\n");
+	fprintf(stderr, "\n  -d       print every event instead of the summary\n");
+	fprintf(stderr, "  -r rows  heatmap rows (default %d)\n", DEF_ROWS);
+	return;
+}
+
+int main(int argc, char **argv)
+{
+	const char *name = NULL;
+	unsigned int rows = DEF_ROWS;
+	int dump_events = 0;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-d")) dump_events = 1;
+		else if (!strcmp(argv[i], "-r") && (i + 1 < argc)) {
+			rows = (unsigned int)strtoul(argv[++i], NULL, 0);
+			if ((rows == 0) || (rows > MAX_ROWS)) goto error_usage;
+		} else if ((argv[i][0] != '-') && !name) name = argv[i];
+		else goto error_usage;
+	}
+	if (!name) goto error_usage;
+	if (load_trace(name) < 0) return EXIT_FAILURE;
+
+	if (dump_events) dump();
+	else {
+		type_table();
+		if (heatmap(rows) < 0) return EXIT_FAILURE;
+		missed();
+	}
+	free(ev);
+	return EXIT_SUCCESS;
+
+error_usage:
+	usage();
+	return EXIT_FAILURE;
+}
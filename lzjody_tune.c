@@ -0,0 +1,305 @@
+/*
+ * Lempel-Ziv-JodyBruchon compression library
+ * Compressor threshold tuning over a corpus
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ *
+ * Sweeps the struct lzjody_params thresholds over a grid of values,
+ * compresses the corpus named on the command line with each point
+ * through lzjody_ctx_set_params(), checks that it round-trips, and
+ * prints the points on the Pareto frontier of compressed ratio versus
+ * compression speed: those that no other point beats on both. The
+ * built-in defaults are always measured and marked with '*'. The output
+ * is a plain text table, fastest first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "lzjody.h"
+
+#define TUNE_VER "0.1"
+#define TUNE_VERDATE "2020-07-14"
+
+/* Timed passes per point and grid points sampled by default */
+#define DEF_PASSES 3
+#define DEF_POINTS 200
+
+/* Values tried for each threshold; the first is always the default.
+ * Sequence minimums move together as multiples of their defaults. */
+static const unsigned int v_lz[] = { 3, 4, 5, 6, 8 };
+static const unsigned int v_rle[] = { 3, 4, 6, 8 };
+static const unsigned int v_seq[] = { 1, 2 };
+static const unsigned int v_plane[] = { 8, 16, 32, 64 };
+static const unsigned int v_scans[] = { 0x800, 0x100, 0x200, 0x400, 0x1000 };
+#define COUNT(a) (sizeof(a) / sizeof(a[0]))
+#define GRID_SIZE (COUNT(v_lz) * COUNT(v_rle) * COUNT(v_seq) * COUNT(v_plane) * COUNT(v_scans))
+
+struct point_t {
+	struct lzjody_params params;
+	double ratio;	/* Compressed size / corpus size */
+	double mbps;	/* Compression speed */
+	int pareto;	/* On the frontier? */
+	int defaults;	/* The built-in thresholds? */
+};
+
+static unsigned char *corpus;
+static size_t corpus_len;
+static unsigned char *comp;	/* Compressed blocks, LZJODY_CBSIZE apart */
+static int *comp_len;
+static unsigned char *dec;
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static inline uint64_t rng(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Append a file to the corpus */
+static int load_file(const char * const name)
+{
+	unsigned char *p;
+	FILE *fp;
+	long size;
+
+	fp = fopen(name, "rb");
+	if (!fp) goto error_open;
+	if (fseek(fp, 0, SEEK_END) != 0) goto error_read;
+	size = ftell(fp);
+	if (size <= 0) goto error_read;
+	rewind(fp);
+	p = (unsigned char *)realloc(corpus, corpus_len + (size_t)size);
+	if (!p) goto error_read;
+	corpus = p;
+	if (fread(corpus + corpus_len, 1, (size_t)size, fp) != (size_t)size) goto error_read;
+	fclose(fp);
+	corpus_len += (size_t)size;
+	return 0;
+
+error_read:
+	fclose(fp);
+error_open:
+	fprintf(stderr, "lzjody_tune: cannot load corpus file %s\n", name);
+	return -1;
+}
+
+/* Grid point n in mixed radix, the first digit varying fastest */
+static void grid_point(unsigned int n, struct lzjody_params * const p)
+{
+	unsigned int seq;
+
+	lzjody_params_default(p);
+	p->min_lz_match = v_lz[n % COUNT(v_lz)];
+	n /= COUNT(v_lz);
+	p->min_rle_length = v_rle[n % COUNT(v_rle)];
+	n /= COUNT(v_rle);
+	seq = v_seq[n % COUNT(v_seq)];
+	p->min_seq8_length *= seq;
+	p->min_seq16_length *= seq;
+	p->min_seq32_length *= seq;
+	n /= COUNT(v_seq);
+	p->min_plane_length = v_plane[n % COUNT(v_plane)];
+	n /= COUNT(v_plane);
+	p->max_lz_byte_scans = v_scans[n % COUNT(v_scans)];
+	return;
+}
+
+/* Compress the corpus with a point's thresholds, keeping the fastest
+ * pass, and verify that it decompresses */
+static int measure(struct lzjody_ctx * const ctx, struct point_t * const pt,
+		const unsigned int options, const int passes)
+{
+	const size_t blocks = (corpus_len + LZJODY_BSIZE - 1) / LZJODY_BSIZE;
+	uint64_t t, best = UINT64_MAX;
+	size_t blk, total = 0;
+	unsigned int bsize;
+	int pass, i;
+
+	if (lzjody_ctx_set_params(ctx, &pt->params) < 0) return -1;
+	for (pass = 0; pass < passes; pass++) {
+		total = 0;
+		t = now_ns();
+		for (blk = 0; blk < blocks; blk++) {
+			bsize = LZJODY_BSIZE;
+			if ((blk + 1) * LZJODY_BSIZE > corpus_len)
+				bsize = (unsigned int)(corpus_len - blk * LZJODY_BSIZE);
+			i = lzjody_compress_ctx(ctx, corpus + blk * LZJODY_BSIZE,
+					comp + blk * LZJODY_CBSIZE, options, bsize);
+			if (i < 0) goto error_compress;
+			comp_len[blk] = i;
+			total += (size_t)i;
+		}
+		t = now_ns() - t;
+		if (t < best) best = t;
+	}
+
+	for (blk = 0; blk < blocks; blk++) {
+		/* Stored blocks need no decoding */
+		if (comp[blk * LZJODY_CBSIZE] & O_NOCOMPRESS) {
+			memcpy(dec + blk * LZJODY_BSIZE, comp + blk * LZJODY_CBSIZE + 2,
+					(size_t)comp_len[blk] - 2);
+			continue;
+		}
+		i = lzjody_decompress(comp + blk * LZJODY_CBSIZE + 2, dec + blk * LZJODY_BSIZE,
+				(unsigned int)comp_len[blk] - 2, comp[blk * LZJODY_CBSIZE] & 0xe0);
+		if (i < 0) goto error_decompress;
+	}
+	if (memcmp(corpus, dec, corpus_len) != 0) goto error_verify;
+
+	if (best == 0) best = 1;
+	pt->ratio = (double)total / (double)corpus_len;
+	pt->mbps = (double)corpus_len * 1000.0 / (double)best;
+	return 0;
+
+error_compress:
+	fprintf(stderr, "lzjody_tune: compression failed at block %zu\n", blk);
+	return -1;
+error_decompress:
+	fprintf(stderr, "lzjody_tune: decompression failed at block %zu\n", blk);
+	return -1;
+error_verify:
+	fprintf(stderr, "lzjody_tune: decompressed data does not match the corpus\n");
+	return -1;
+}
+
+/* Fastest first; equal speeds by ratio */
+static int cmp_speed(const void *a, const void *b)
+{
+	const struct point_t * const pa = (const struct point_t *)a;
+	const struct point_t * const pb = (const struct point_t *)b;
+
+	if (pa->mbps > pb->mbps) return -1;
+	if (pa->mbps < pb->mbps) return 1;
+	if (pa->ratio < pb->ratio) return -1;
+	if (pa->ratio > pb->ratio) return 1;
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "lzjody_tune %s (%s)\n", TUNE_VER, TUNE_VERDATE);
+	fprintf(stderr, "\nusage: lzjody_tune [-1 .. -9] [-p passes] [-n points] [-a] file ...\n\n");
+	fprintf(stderr, "  -1 .. -9   compression speed level (default -%d)\n", LZJODY_LEVEL_DEFAULT);
+	fprintf(stderr, "  -p   timed passes per point; the fastest is kept (default %d)\n", DEF_PASSES);
+	fprintf(stderr, "  -n   grid points to sample, 0 for all %u (default %d)\n",
+			(unsigned int)GRID_SIZE, DEF_POINTS);
+	fprintf(stderr, "  -a   print every point, not just the Pareto frontier\n");
+	fprintf(stderr, "\nThe files are joined into one corpus.\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct lzjody_ctx *ctx;
+	struct point_t *pts;
+	unsigned char *picked;
+	unsigned int options, n, count = 0, points = DEF_POINTS;
+	int level = LZJODY_LEVEL_DEFAULT, passes = DEF_PASSES, all = 0;
+	int i, j, files = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+			passes = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			points = (unsigned int)strtoul(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "-a")) {
+			all = 1;
+		} else if ((argv[i][0] == '-') && (argv[i][1] >= '1') && (argv[i][1] <= '9')
+				&& (argv[i][2] == '\0')) {
+			level = argv[i][1] - '0';
+		} else if (argv[i][0] == '-') {
+			usage();
+			exit(EXIT_FAILURE);
+		} else {
+			if (load_file(argv[i]) < 0) exit(EXIT_FAILURE);
+			files++;
+		}
+	}
+	if (files == 0 || passes < 1) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	if (points == 0 || points > GRID_SIZE) points = GRID_SIZE;
+	options = lzjody_level_options(level);
+
+	comp = (unsigned char *)malloc((corpus_len / LZJODY_BSIZE + 1) * LZJODY_CBSIZE);
+	comp_len = (int *)malloc((corpus_len / LZJODY_BSIZE + 1) * sizeof(int));
+	dec = (unsigned char *)malloc(corpus_len + LZJODY_BSIZE);
+	pts = (struct point_t *)calloc(points, sizeof(struct point_t));
+	picked = (unsigned char *)calloc(GRID_SIZE, 1);
+	ctx = lzjody_ctx_new();
+	if (!comp || !comp_len || !dec || !pts || !picked || !ctx) goto oom;
+
+	/* Grid point 0 is the defaults; the rest are sampled without repeats */
+	picked[0] = 1;
+	pts[0].defaults = 1;
+	grid_point(0, &pts[count++].params);
+	while (count < points) {
+		n = (points == GRID_SIZE) ? count : (unsigned int)(rng() % GRID_SIZE);
+		if (picked[n]) continue;
+		picked[n] = 1;
+		grid_point(n, &pts[count++].params);
+	}
+
+	fprintf(stderr, "lzjody_tune: %zu bytes, level %d, %u points\n", corpus_len, level, count);
+	for (n = 0; n < count; n++) {
+		if (measure(ctx, &pts[n], options, passes) < 0) exit(EXIT_FAILURE);
+		if ((n + 1) % 10 == 0) fprintf(stderr, "lzjody_tune: %u/%u\n", n + 1, count);
+	}
+
+	/* A point is dominated if another is at least as good on both
+	 * counts and better on one */
+	for (i = 0; i < (int)count; i++) {
+		pts[i].pareto = 1;
+		for (j = 0; j < (int)count; j++) {
+			if ((pts[j].mbps >= pts[i].mbps) && (pts[j].ratio <= pts[i].ratio)
+					&& ((pts[j].mbps > pts[i].mbps) || (pts[j].ratio < pts[i].ratio))) {
+				pts[i].pareto = 0;
+				break;
+			}
+		}
+	}
+	qsort(pts, count, sizeof(struct point_t), cmp_speed);
+
+	printf("# lzjody_tune %s, %zu bytes, level %d, best of %d passes, %s\n", TUNE_VER,
+			corpus_len, level, passes, all ? "all points" : "Pareto frontier");
+	printf("%-1s %9s %7s %4s %4s %5s %6s %6s %6s %6s %5s\n", "", "MB/s", "ratio",
+			"lz", "rle", "seq8", "seq16", "seq32", "plane", "scans", "front");
+	for (n = 0; n < count; n++) {
+		const struct lzjody_params * const p = &pts[n].params;
+
+		if (!all && !pts[n].pareto && !pts[n].defaults) continue;
+		printf("%-1s %9.2f %7.4f %4u %4u %5u %6u %6u %6u %6u %5s\n",
+				pts[n].defaults ? "*" : "", pts[n].mbps, pts[n].ratio,
+				p->min_lz_match, p->min_rle_length, p->min_seq8_length,
+				p->min_seq16_length, p->min_seq32_length, p->min_plane_length,
+				p->max_lz_byte_scans, pts[n].pareto ? "yes" : "no");
+	}
+
+	lzjody_ctx_free(ctx);
+	free(picked);
+	free(pts);
+	free(dec);
+	free(comp_len);
+	free(comp);
+	free(corpus);
+	exit(EXIT_SUCCESS);
+
+oom:
+	fprintf(stderr, "lzjody_tune: out of memory\n");
+	exit(EXIT_FAILURE);
+}
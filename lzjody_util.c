@@ -11,6 +11,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "lzjody.h"
 #include "lzjody_util.h"
 
@@ -22,6 +24,8 @@
  #endif
  #include <windows.h>
  #include <io.h>
+#else
+ #include <sys/mman.h>
 #endif
 
 #ifdef THREADED
@@ -54,7 +58,7 @@ static void *compress_thread(void *arg)
 
 	while (remain) {
 		if (remain < LZJODY_BSIZE) bsize = remain;
-		i = lzjody_compress(ipos, opos, thr->options, bsize);
+		i = lzjody_compress_ctx(thr->ctx, ipos, opos, thr->options, bsize);
 		if (i < 0) {
 			thread_error = 1;
 			pthread_cond_signal(&cond);
@@ -71,15 +75,266 @@ static void *compress_thread(void *arg)
 }
 #endif /* THREADED */
 
+/* Read the two-byte prefix and payload of the next compressed block
+ * Returns the payload length, 0 at end of stream, or -1 on error */
+static int read_block(FILE * const fp, unsigned char * const blk,
+		unsigned char * const options)
+{
+	int length, limit, i;
+
+	if (fread(blk, 1, 2, fp) != 2) {
+		if (ferror(fp)) goto error_read;
+		return 0;
+	}
+	/* Get block-level decompression options */
+	*options = *blk & 0xe0;
+
+	/* Read the length of the compressed data */
+	length = *(blk + 1);
+	length |= ((*blk & 0x1f) << 8);
+	limit = LZJODY_BSIZE + 4 + ((*options & O_CHECKSUM) ? 4 : 0);
+	if (length > limit) goto error_blocksize_d_prefix;
+
+	i = fread(blk, 1, length, fp);
+	if (ferror(fp)) goto error_read;
+	if (i != length) goto error_shortread;
+	return length;
+
+error_read:
+	fprintf(stderr, "Error reading file %s\n", "stdin");
+	return -1;
+error_shortread:
+	fprintf(stderr, "Error: short read: %d < %d (eof %d, error %d)\n",
+			i, length, feof(fp), ferror(fp));
+	return -1;
+error_blocksize_d_prefix:
+	fprintf(stderr, "Error: decompressor prefix too large (%d > %d)\n",
+			length, limit);
+	return -1;
+}
+
+/* Decompress every block of a batch to scratch memory and discard it */
+static void *test_batch(void *arg)
+{
+	struct test_batch * const b = arg;
+	unsigned char out[LZJODY_BSIZE];
+	const unsigned char *p = b->data;
+	int blocknum, length;
+	unsigned char options;
+
+	for (blocknum = 0; blocknum < b->blocks; blocknum++) {
+		options = *p & 0xe0;
+		length = *(p + 1) | ((*p & 0x1f) << 8);
+		p += 2;
+		if (options & O_NOCOMPRESS) {
+			/* Stored blocks have nothing to verify */
+		} else if (options & O_FARREF) {
+			fprintf(stderr, "Error: block %d refers to earlier blocks (test with -t -l)\n",
+					b->first + blocknum);
+			b->error = 1;
+			break;
+		} else if ((b->ref ? lzjody_decompress_ref(b->ref,
+					(uint64_t)(b->first + blocknum) * LZJODY_BSIZE, p, out, length, options)
+				: lzjody_decompress(p, out, length, options)) < 0) {
+			fprintf(stderr, "Error: block %d failed the integrity test\n",
+					b->first + blocknum);
+			b->error = 1;
+		}
+		if (options & O_CHECKSUM) b->checksums++;
+		p += length;
+	}
+	return NULL;
+}
+
+/* Fill a test batch with up to CHUNK blocks from the input stream
+ * Returns the number of blocks read or -1 on error */
+static int fill_batch(struct test_batch * const b, FILE * const fp, const int first)
+{
+	unsigned char options;
+	int length;
+
+	b->length = 0;
+	b->blocks = 0;
+	b->first = first;
+	b->checksums = 0;
+	b->error = 0;
+	while (b->blocks < CHUNK) {
+		length = read_block(fp, b->data + b->length + 2, &options);
+		if (length < 0) return -1;
+		if (length == 0) break;
+		/* Rebuild the prefix in front of the payload */
+		*(b->data + b->length) = (unsigned char)(options | ((length >> 8) & 0x1f));
+		*(b->data + b->length + 1) = (unsigned char)length;
+		b->length += length + 2;
+		b->blocks++;
+	}
+	return b->blocks;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Account for one block compressed with --adapt and return the options
+ * for the next one. A compressor that waits on a slow source or sink
+ * has time to spare for a smaller output; one that never waits is the
+ * slowest stage and should go faster. */
+static unsigned int adapt_block(struct adapt_t * const a,
+		const uint64_t busy, const uint64_t wait)
+{
+	a->used[a->level]++;
+	a->busy += busy;
+	a->wait += wait;
+	if (++a->blocks == ADAPT_BLOCKS) {
+		if ((a->wait > a->busy) && (a->level < LZJODY_LEVEL_MAX)) a->level++;
+		else if ((a->wait * ADAPT_LOWER < a->busy) && (a->level > LZJODY_LEVEL_MIN)) a->level--;
+		a->blocks = 0;
+		a->busy = 0;
+		a->wait = 0;
+	}
+	return a->options | lzjody_level_options(a->level);
+}
+
+/* Map a reference image file (--ref) into memory
+ * Returns NULL on error */
+static struct lzjody_ref *load_ref(const char * const path)
+{
+	struct lzjody_ref *ref;
+	struct stat st;
+	unsigned char *data;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) goto error_open;
+	if ((fstat(fd, &st) != 0) || (st.st_size == 0)) goto error_read;
+#ifdef ON_WINDOWS
+	setmode(fd, _O_BINARY);
+	data = (unsigned char *)malloc((size_t)st.st_size);
+	if (!data) goto error_read;
+	if (read(fd, data, (size_t)st.st_size) != (ssize_t)st.st_size) goto error_short;
+#else
+	data = (unsigned char *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) goto error_read;
+#endif /* ON_WINDOWS */
+	close(fd);
+	ref = lzjody_ref_new(data, (uint64_t)st.st_size);
+	if (!ref) goto error_ref;
+	return ref;
+
+error_ref:
+	/* lzjody_ref_new() already said why */
+#ifdef ON_WINDOWS
+	free(data);
+#else
+	munmap(data, (size_t)st.st_size);
+#endif /* ON_WINDOWS */
+	return NULL;
+#ifdef ON_WINDOWS
+error_short:
+	free(data);
+#endif /* ON_WINDOWS */
+error_read:
+	close(fd);
+error_open:
+	fprintf(stderr, "lzjody: cannot read reference image %s\n", path);
+	return NULL;
+}
+
+/* Write a trace event to the --trace file (see lzjody_util.h) */
+static void write_trace(void *arg, const struct lzjody_trace_event *ev)
+{
+	unsigned char r[LZJODY_TRACE_RECORD];
+
+	r[0] = (unsigned char)ev->block;
+	r[1] = (unsigned char)(ev->block >> 8);
+	r[2] = (unsigned char)(ev->block >> 16);
+	r[3] = (unsigned char)(ev->block >> 24);
+	r[4] = (unsigned char)ev->pos;
+	r[5] = (unsigned char)(ev->pos >> 8);
+	r[6] = (unsigned char)ev->length;
+	r[7] = (unsigned char)(ev->length >> 8);
+	r[8] = (unsigned char)ev->offset;
+	r[9] = (unsigned char)(ev->offset >> 8);
+	r[10] = (unsigned char)(ev->offset >> 16);
+	r[11] = (unsigned char)(ev->offset >> 24);
+	r[12] = (unsigned char)ev->out;
+	r[13] = (unsigned char)(ev->out >> 8);
+	r[14] = ev->type;
+	r[15] = ev->flags;
+	fwrite(r, 1, LZJODY_TRACE_RECORD, (FILE *)arg);
+	return;
+}
+
+/* Print a summary of compressor statistics for -v */
+static void print_stats(const struct lzjody_stats * const st)
+{
+	static const char * const names[LZJODY_ST_MAX] = {
+		"literal", "rle", "seq8", "seq16", "seq32", "lz", "plane", "huffman", "far",
+		"pattern", "ref"
+	};
+	int i;
+
+	fprintf(stderr, "lzjody: %llu blocks, %llu -> %llu bytes (%.2f%%)\n",
+			(unsigned long long)st->blocks,
+			(unsigned long long)st->bytes_in,
+			(unsigned long long)st->bytes_out,
+			st->bytes_in ? (double)st->bytes_out * 100.0 / (double)st->bytes_in : 0.0);
+	fprintf(stderr, "%-8s %10s %12s %12s %14s %10s\n",
+			"command", "emitted", "bytes in", "calls", "cycles", "cyc/call");
+	for (i = 0; i < LZJODY_ST_MAX; i++) {
+		fprintf(stderr, "%-8s %10llu %12llu %12llu %14llu %10.1f\n",
+				names[i],
+				(unsigned long long)st->cmds[i],
+				(unsigned long long)st->cmd_bytes[i],
+				(unsigned long long)st->calls[i],
+				(unsigned long long)st->cycles[i],
+				st->calls[i] ? (double)st->cycles[i] / (double)st->calls[i] : 0.0);
+	}
+	fprintf(stderr, "LZ linear scans: %llu, byte plane retries skipped: %llu, finder calls skipped: %llu\n",
+			(unsigned long long)st->lz_linear,
+			(unsigned long long)st->plane_skipped,
+			(unsigned long long)st->finder_skipped);
+	fprintf(stderr, "index cycles: %llu, total cycles: %llu\n",
+			(unsigned long long)st->index_cycles,
+			(unsigned long long)st->total_cycles);
+	return;
+}
+
 int main(int argc, char **argv)
 {
-	static unsigned char blk[LZJODY_BSIZE];
-	static unsigned char out[LZJODY_BSIZE + 4];
+	static unsigned char blk[LZJODY_CBSIZE];
+	static unsigned char out[LZJODY_CBSIZE];
 	int i;
 	int length = 0;	/* Incoming data block length counter */
-	int c_length;   /* Compressed block length temp variable */
 	int blocknum = 0;	/* Current block number */
-	unsigned char options = 0;	/* Compressor options */
+	unsigned int options = 0;	/* Compressor options */
+	int level = LZJODY_LEVEL_DEFAULT;	/* Compression speed level */
+	unsigned char flags;	/* Block header flags */
+	char mode = 0;	/* 'c' compress, 'd' decompress, 't' test, 'r' read range */
+	const char *rfile = NULL;	/* Compressed file for -r */
+	uint64_t roff = 0, rlen = 0;	/* Byte range for -r */
+	struct lzjody_file *rf;
+	int64_t got;
+	int verbose = 0;	/* Print compression statistics */
+	struct lzjody_stats stats;
+	struct test_batch *batch;	/* Integrity test batches */
+	int nbatch = 1;	/* Number of test batches */
+	int checksums = 0;	/* Checksummed blocks seen by -t */
+	int far = 0;	/* Match against the whole stream (-l) */
+	struct lzjody_window *window = NULL;	/* Stream window for -l */
+	struct batch_names names = { NULL, 0, 0 };	/* Files for batch mode */
+	const char *tfile = NULL;	/* Trace file for --trace */
+	FILE *trace = NULL;
+	const char *reffile = NULL;	/* Reference image for --ref */
+	struct lzjody_ref *ref = NULL;
+	uint64_t pos = 0;	/* Stream offset of the next block for --ref */
+	int adapt = 0;	/* Pick the level per block (--adapt) */
+	struct adapt_t ad;
+	uint64_t t0, t1, t2;	/* --adapt block timestamps */
 #ifdef THREADED
 	struct thread_info *thr;
 	int nprocs = 1;		/* Number of processors */
@@ -87,7 +342,60 @@ int main(int argc, char **argv)
 	char running = 0;	/* Number of threads running */
 #endif /* THREADED */
 
-	if (argc < 2) goto usage;
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-c")) mode = 'c';
+		else if (!strcmp(argv[i], "-d")) mode = 'd';
+		else if (!strcmp(argv[i], "-t")) mode = 't';
+		else if (!strcmp(argv[i], "-r") && (i + 3 < argc)) {
+			mode = 'r';
+			rfile = argv[++i];
+			roff = strtoull(argv[++i], NULL, 0);
+			rlen = strtoull(argv[++i], NULL, 0);
+		}
+		else if (!strcmp(argv[i], "-k")) options |= O_CHECKSUM;
+		else if (!strcmp(argv[i], "-e")) options |= O_HUFFMAN;
+		else if (!strcmp(argv[i], "-s")) options |= O_SPLIT;
+		else if (!strcmp(argv[i], "-l")) far = 1;
+		else if (!strcmp(argv[i], "-v")) verbose = 1;
+		else if (!strcmp(argv[i], "--adapt")) adapt = 1;
+		else if (!strncmp(argv[i], "--trace=", 8) && (argv[i][8] != '\0'))
+			tfile = argv[i] + 8;
+		else if (!strncmp(argv[i], "--ref=", 6) && (argv[i][6] != '\0'))
+			reffile = argv[i] + 6;
+		else if (!strcmp(argv[i], "--ref") && (i + 1 < argc))
+			reffile = argv[++i];
+		else if (!strcmp(argv[i], "-i") && (i + 1 < argc)) {
+			if (batch_read_list(&names, argv[++i]) < 0) exit(EXIT_FAILURE);
+		}
+		else if ((argv[i][0] == '-') && (argv[i][1] >= '1') && (argv[i][1] <= '9')
+				&& (argv[i][2] == '\0'))
+			level = argv[i][1] - '0';
+		else if (argv[i][0] != '-') {
+			if (batch_add_name(&names, argv[i]) < 0) exit(EXIT_FAILURE);
+		} else goto usage;
+	}
+	memset(&ad, 0, sizeof(ad));
+	ad.level = level;
+	ad.options = options;
+	options |= lzjody_level_options(level);
+	if (mode == 0) goto usage;
+	if (tfile && ((mode != 'c') || (names.count > 0))) goto usage;
+	if (adapt && ((mode != 'c') || (names.count > 0))) goto usage;
+	if (reffile && (far || (names.count > 0))) goto usage;
+
+	/* Named files are all processed on one shared worker pool */
+	if (names.count > 0) {
+		if ((mode != 'c' && mode != 'd') || far) goto usage;
+		if (batch_files(mode, &names, options, verbose) < 0) exit(EXIT_FAILURE);
+		exit(EXIT_SUCCESS);
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	if (adapt && verbose) adapt = 2;	/* Report levels used even without STATS=1 */
+	if (verbose && mode == 'c' && lzjody_ctx_set_stats(NULL, &stats) < 0) {
+		fprintf(stderr, "lzjody: statistics not available (build with STATS=1)\n");
+		verbose = 0;
+	}
 
 	/* Windows requires that data streams be put into binary mode */
 #ifdef ON_WINDOWS
@@ -98,23 +406,53 @@ int main(int argc, char **argv)
 	files.in = stdin;
 	files.out = stdout;
 
-	if (!strncmp(argv[1], "-c", 2)) {
-#ifndef THREADED
-		/* Non-threaded compression */
-		/* fprintf(stderr, "blk %p, blkend %p, files %p\n",
-				blk, blk + LZJODY_BSIZE - 1, files); */
-		while((length = fread(blk, 1, LZJODY_BSIZE, files.in))) {
-			if (ferror(files.in)) goto error_read;
-			DLOG("\n--- Compressing block %d\n", blocknum);
-			i = lzjody_compress(blk, out, options, length);
-			if (i < 0) goto error_compression;
-			DLOG("c_size %d bytes\n", i);
-			i = fwrite(out, i, 1, files.out);
-			if (!i) goto error_write;
-			blocknum++;
+	/* Compression is traced through the single-threaded path */
+	if (tfile) {
+		trace = fopen(tfile, "wb");
+		if (!trace) goto error_trace;
+		fwrite(LZJODY_TRACE_MAGIC, 1, 4, trace);
+		fputc(LZJODY_TRACE_VERSION, trace);
+		lzjody_ctx_set_trace(NULL, write_trace, trace);
+	}
+
+	/* Blocks compressed against a reference only need the reference */
+	if (reffile) {
+		ref = load_ref(reffile);
+		if (!ref) exit(EXIT_FAILURE);
+		lzjody_ctx_set_ref(NULL, ref, 0);
+	}
+
+	if (far && (mode == 'c' || mode == 't' || mode == 'd')) {
+		window = lzjody_window_new();
+		if (!window) goto oom;
+		if ((mode == 'c') && (lzjody_ctx_set_window(NULL, window) < 0)) goto oom;
+	}
+
+	/* Read a byte range out of a compressed file */
+	if (mode == 'r') {
+		rf = lzjody_open_ref(rfile, 0, ref);
+		if (!rf) exit(EXIT_FAILURE);
+		while (rlen > 0) {
+			got = lzjody_pread(rf, out, (rlen < LZJODY_BSIZE) ? (size_t)rlen : LZJODY_BSIZE, roff);
+			if (got < 0) exit(EXIT_FAILURE);
+			if (got == 0) break;
+			i = fwrite(out, 1, (size_t)got, files.out);
+			if (i != (int)got) {
+				length = (int)got;
+				goto error_write;
+			}
+			roff += (uint64_t)got;
+			rlen -= (uint64_t)got;
 		}
+		lzjody_close(rf);
+		exit(EXIT_SUCCESS);
+	}
 
-#else /* Using POSIX threads */
+	if (mode == 'c') {
+#ifdef THREADED
+		/* Window matches need every earlier block compressed first, and
+		 * --adapt times each block against its own reads and writes */
+		if (window || trace || adapt) goto compress_serial;
 
  #ifdef _SC_NPROCESSORS_ONLN
 		/* Get number of online processors for pthreads */
@@ -132,8 +470,13 @@ int main(int argc, char **argv)
 		thr = (struct thread_info *)calloc(nprocs, sizeof(struct thread_info));
 		if (!thr) goto oom;
 
-		/* Set compressor options */
-		for (i = 0; i < nprocs; i++) (thr + i)->options = options;
+		/* Set compressor options and give each thread its own context */
+		for (i = 0; i < nprocs; i++) {
+			(thr + i)->options = options;
+			(thr + i)->ctx = lzjody_ctx_new();
+			if (!(thr + i)->ctx) goto oom;
+			if (verbose) lzjody_ctx_set_stats((thr + i)->ctx, &(thr + i)->stats);
+		}
 
 		thread_error = 0;
 		while (1) {
@@ -214,6 +557,8 @@ int main(int argc, char **argv)
 						cur->block = blocknum;
 						cur->length = length;
 						cur->o_length = 0;
+						if (ref) lzjody_ctx_set_ref(cur->ctx, ref,
+								(uint64_t)(blocknum - 1) * LZJODY_BSIZE * CHUNK);
 						running++;
 						DLOG("Thread %d start\n", open_thr);
 
@@ -230,48 +575,161 @@ int main(int argc, char **argv)
 				}
 			}
 		}
+		for (i = 0; i < nprocs; i++) {
+			const struct lzjody_stats * const st = &(thr + i)->stats;
+			int j;
+
+			stats.blocks += st->blocks;
+			stats.bytes_in += st->bytes_in;
+			stats.bytes_out += st->bytes_out;
+			for (j = 0; j < LZJODY_ST_MAX; j++) {
+				stats.cmds[j] += st->cmds[j];
+				stats.cmd_bytes[j] += st->cmd_bytes[j];
+				stats.calls[j] += st->calls[j];
+				stats.cycles[j] += st->cycles[j];
+			}
+			stats.lz_linear += st->lz_linear;
+			stats.plane_skipped += st->plane_skipped;
+			stats.finder_skipped += st->finder_skipped;
+			stats.index_cycles += st->index_cycles;
+			stats.total_cycles += st->total_cycles;
+			lzjody_ctx_free((thr + i)->ctx);
+		}
 		free(thr);
+		goto compress_done;
+compress_serial:
+#endif /* THREADED */
+		/* Non-threaded compression */
+		/* fprintf(stderr, "blk %p, blkend %p, files %p\n",
+				blk, blk + LZJODY_BSIZE - 1, files); */
+		t0 = adapt ? now_ns() : 0;
+		while((length = fread(blk, 1, LZJODY_BSIZE, files.in))) {
+			if (ferror(files.in)) goto error_read;
+			DLOG("\n--- Compressing block %d\n", blocknum);
+			t1 = adapt ? now_ns() : 0;
+			i = lzjody_compress(blk, out, options, length);
+			if (i < 0) goto error_compression;
+			DLOG("c_size %d bytes\n", i);
+			t2 = adapt ? now_ns() : 0;
+			i = fwrite(out, i, 1, files.out);
+			if (!i) goto error_write;
+			blocknum++;
+			/* Waiting is the read before and the write after the block */
+			if (adapt) {
+				const uint64_t t3 = now_ns();
+
+				options = adapt_block(&ad, t2 - t1, (t1 - t0) + (t3 - t2));
+				t0 = t3;
+			}
+		}
+		if (adapt == 2) {
+			fprintf(stderr, "lzjody: blocks per level:");
+			for (i = LZJODY_LEVEL_MIN; i <= LZJODY_LEVEL_MAX; i++)
+				fprintf(stderr, " -%d %llu", i, (unsigned long long)ad.used[i]);
+			fprintf(stderr, "\n");
+		}
+#ifdef THREADED
+compress_done:
 #endif /* THREADED */
+		if (verbose) print_stats(&stats);
+		if (trace) {
+			i = ferror(trace);
+			if ((fclose(trace) != 0) || i) goto error_trace;
+		}
 	}
 
 	/* Decompress */
-	if (!strncmp(argv[1], "-d", 2)) {
-		while(fread(blk, 1, 2, files.in)) {
-			/* Get block-level decompression options */
-			options = *blk & 0xc0;
+	if (mode == 'd') {
+		while ((i = read_block(files.in, blk, &flags))) {
+			const unsigned char *data = out;
+
+			if (i < 0) exit(EXIT_FAILURE);
+
+			DLOG("--- Decompressing block %d\n", blocknum);
+			if (ref) length = lzjody_decompress_ref(ref, pos, blk, out, i, flags);
+			/* Stored blocks are copied through the window too */
+			else if (window) length = lzjody_decompress_window(window, blk, out, i, flags);
+			else if (flags & O_FARREF) goto error_farref;
+			else if (flags & O_NOCOMPRESS) {
+				data = blk;
+				length = i;
+			} else length = lzjody_decompress(blk, out, i, flags);
+			if (length < 0) goto error_decompress;
+			if (length > LZJODY_BSIZE) goto error_blocksize_decomp;
+			i = fwrite(data, 1, length, files.out);
+			if (i != length) goto error_write;
+			pos += (uint64_t)length;
+ /*		     DLOG("Wrote %d bytes\n", i); */
 
-			/* Read the length of the compressed data */
-			length = *(blk + 1);
-			length |= ((*blk & 0x1f) << 8);
-			if (length > (LZJODY_BSIZE + 4)) goto error_blocksize_d_prefix;
+			blocknum++;
+		}
+	}
 
-			i = fread(blk, 1, length, files.in);
-			if (ferror(files.in)) goto error_read;
-			if (i != length) goto error_shortread;
-
-			if (options & O_NOCOMPRESS) {
-				c_length = *(blk + 1);
-				c_length |= ((*blk & 0x1f) << 8);
-				DLOG("--- Writing uncompressed block %d (%d bytes)\n", blocknum, c_length);
-				if (c_length > LZJODY_BSIZE) goto error_unc_length;
-				i = fwrite((blk + 2), 1, c_length, files.out);
-				if (i != c_length) {
-					length = c_length;
-					goto error_write;
-				}
-			} else {
-				DLOG("--- Decompressing block %d\n", blocknum);
-				length = lzjody_decompress(blk, out, i, options);
-				if (length < 0) goto error_decompress;
-				if (length > LZJODY_BSIZE) goto error_blocksize_decomp;
-				i = fwrite(out, 1, length, files.out);
-				if (i != length) goto error_write;
- /*			     DLOG("Wrote %d bytes\n", i); */
+	/* Integrity test of a -l stream: every block needs the ones before */
+	if ((mode == 't') && window) {
+		while ((i = read_block(files.in, blk, &flags))) {
+			if (i < 0) exit(EXIT_FAILURE);
+			if (lzjody_decompress_window(window, blk, out, i, flags) < 0) {
+				fprintf(stderr, "Error: block %d failed the integrity test\n", blocknum);
+				goto error_test;
 			}
+			if (flags & O_CHECKSUM) checksums++;
+			blocknum++;
+		}
+		if (verbose) fprintf(stderr, "lzjody: %d blocks OK (%d with checksums)\n",
+				blocknum, checksums);
+	}
 
+	/* Integrity test: decompress everything, write nothing */
+	if ((mode == 't') && !window) {
+#ifdef THREADED
+ #ifdef _SC_NPROCESSORS_ONLN
+		nbatch = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		if (nbatch < 1) nbatch = 1;
+ #endif /* _SC_NPROCESSORS_ONLN */
+#endif /* THREADED */
+		batch = (struct test_batch *)calloc(nbatch, sizeof(struct test_batch));
+		if (!batch) goto oom;
+		for (i = 0; i < nbatch; i++) (batch + i)->ref = ref;
 
-			blocknum++;
+		/* Hand batches to threads round-robin, reaping a batch's
+		 * previous thread before its buffer is refilled */
+		for (i = 0; ; i = (i + 1) % nbatch) {
+			struct test_batch * const b = batch + i;
+
+#ifdef THREADED
+			if (b->busy) {
+				pthread_join(b->id, NULL);
+				b->busy = 0;
+			}
+#endif /* THREADED */
+			if (b->error) goto error_test;
+			checksums += b->checksums;
+			b->checksums = 0;
+
+			length = fill_batch(b, files.in, blocknum);
+			if (length < 0) exit(EXIT_FAILURE);
+			if (length == 0) break;
+			blocknum += length;
+#ifdef THREADED
+			if (pthread_create(&b->id, NULL, test_batch, (void *)b) != 0) goto error_thread;
+			b->busy = 1;
+#else
+			test_batch(b);
+#endif /* THREADED */
 		}
+
+		/* Wait for the remaining batches */
+		for (i = 0; i < nbatch; i++) {
+#ifdef THREADED
+			if ((batch + i)->busy) pthread_join((batch + i)->id, NULL);
+#endif /* THREADED */
+			if ((batch + i)->error) goto error_test;
+			checksums += (batch + i)->checksums;
+		}
+		free(batch);
+		if (verbose) fprintf(stderr, "lzjody: %d blocks OK (%d with checksums)\n",
+				blocknum, checksums);
 	}
 
 	exit(EXIT_SUCCESS);
@@ -286,18 +744,6 @@ error_write:
 	fprintf(stderr, "Error writing file %s (%d of %d written)\n", "stdout",
 			i, length);
 	exit(EXIT_FAILURE);
-error_shortread:
-	fprintf(stderr, "Error: short read: %d < %d (eof %d, error %d)\n",
-			i, length, feof(files.in), ferror(files.in));
-	exit(EXIT_FAILURE);
-error_unc_length:
-	fprintf(stderr, "Error: uncompressed length too large (%d > %d)\n",
-			c_length, LZJODY_BSIZE);
-	exit(EXIT_FAILURE);
-error_blocksize_d_prefix:
-	fprintf(stderr, "Error: decompressor prefix too large (%d > %d)\n",
-			length, (LZJODY_BSIZE + 4));
-	exit(EXIT_FAILURE);
 error_blocksize_decomp:
 	fprintf(stderr, "Error: decompressor overflow (%d > %d)\n",
 			length, LZJODY_BSIZE);
@@ -305,15 +751,57 @@ error_blocksize_decomp:
 error_decompress:
 	fprintf(stderr, "Error: cannot decompress block %d\n", blocknum);
 	exit(EXIT_FAILURE);
+error_farref:
+	fprintf(stderr, "Error: block %d refers to earlier blocks (decompress with -d -l)\n",
+			blocknum);
+	exit(EXIT_FAILURE);
+error_test:
+	fprintf(stderr, "Error: integrity test failed\n");
+	exit(EXIT_FAILURE);
+error_trace:
+	fprintf(stderr, "Error writing trace file %s\n", tfile);
+	exit(EXIT_FAILURE);
 #ifdef THREADED
+error_thread:
+	fprintf(stderr, "Error: cannot create integrity test thread\n");
+	exit(EXIT_FAILURE);
+#endif
 oom:
 	fprintf(stderr, "Error: out of memory\n");
 	exit(EXIT_FAILURE);
-#endif
 usage:
 	fprintf(stderr, "lzjody %s, a compression utility by Jody Bruchon (%s)\n",
 			LZJODY_UTIL_VER, LZJODY_UTIL_VERDATE);
 	fprintf(stderr, "\nlzjody -c   compress stdin to stdout\n");
 	fprintf(stderr, "\nlzjody -d   decompress stdin to stdout\n");
+	fprintf(stderr, "\nlzjody -c|-d [-i list] file...\n");
+	fprintf(stderr, "            compress each file to file%s or decompress file%s to file,\n",
+			LZJODY_SUFFIX, LZJODY_SUFFIX);
+	fprintf(stderr, "            sharing one pool of worker threads; -i reads file names from\n");
+	fprintf(stderr, "            list, one per line (- for stdin); no -l\n");
+	fprintf(stderr, "\nlzjody -t   test integrity of compressed stdin\n");
+	fprintf(stderr, "\nlzjody -r file offset length\n");
+	fprintf(stderr, "            write a range of the decompressed contents of file to stdout\n");
+	fprintf(stderr, "\n       -k   store a CRC-32C checksum with each block\n");
+	fprintf(stderr, "\n       -e   Huffman code blocks where it helps (smaller, slower)\n");
+	fprintf(stderr, "\n       -s   store blocks as split streams (faster to decompress)\n");
+	fprintf(stderr, "\n       -l   also match data up to %d MiB back in the stream (no threads,\n",
+			LZJODY_WINDOW_SIZE >> 20);
+	fprintf(stderr, "            no -r; decompress with -d -l, test with -t -l)\n");
+	fprintf(stderr, "\n       --ref=file, --ref file\n");
+	fprintf(stderr, "            compress against the reference image file, copying data found\n");
+	fprintf(stderr, "            at or near the same offset in it; -d, -t and -r need the same\n");
+	fprintf(stderr, "            reference (no -l, no file names)\n");
+	fprintf(stderr, "\n       -1 .. -9   compression speed level: -1 is fastest, -9 smallest\n");
+	fprintf(stderr, "            (default -%d; -7 and up imply -e, -8 is the same as -9)\n",
+			LZJODY_LEVEL_DEFAULT);
+	fprintf(stderr, "\n       --adapt\n");
+	fprintf(stderr, "            with -c, start at the speed level given and change it as\n");
+	fprintf(stderr, "            blocks go: higher while reading stdin or writing stdout stalls,\n");
+	fprintf(stderr, "            lower while the compressor is the bottleneck (no threads)\n");
+	fprintf(stderr, "\n       -v   print compression statistics (build with STATS=1)\n");
+	fprintf(stderr, "\n       --trace=file\n");
+	fprintf(stderr, "            with -c, record every command emitted in file (no threads;\n");
+	fprintf(stderr, "            read it with lzjody_trace)\n");
 	exit(EXIT_FAILURE);
 }
@@ -30,15 +30,70 @@ struct files_t {
 	FILE *out;
 };
 
+/* Suffix added by "lzjody -c file..." and removed by "lzjody -d file..." */
+#define LZJODY_SUFFIX ".lzj"
+
+/* "lzjody -c --trace=file" output: LZJODY_TRACE_MAGIC, a version byte,
+ * then one LZJODY_TRACE_RECORD byte record per trace event with the
+ * fields of struct lzjody_trace_event in order, little-endian */
+#define LZJODY_TRACE_MAGIC "LZJT"
+#define LZJODY_TRACE_VERSION 1
+#define LZJODY_TRACE_HEADER 5
+#define LZJODY_TRACE_RECORD 16
+
+/* Files named on the command line or in a list file (-i) */
+struct batch_names {
+	const char **name;
+	int count;
+	int alloc;
+};
+
+extern int batch_add_name(struct batch_names * const list, const char * const name);
+extern int batch_read_list(struct batch_names * const list, const char * const path);
+extern int batch_files(const char mode, const struct batch_names * const list,
+		const unsigned int options, const int verbose);
+
+/* --adapt: every ADAPT_BLOCKS blocks the speed level is raised if more
+ * time went to waiting for input and output than to compressing, and
+ * lowered if waiting took under 1/ADAPT_LOWER of the compression time */
+#define ADAPT_BLOCKS 32
+#define ADAPT_LOWER 4
+
+struct adapt_t {
+	int level;	/* Speed level of the next block */
+	unsigned int options;	/* Options that don't come from the level */
+	int blocks;	/* Blocks since the last decision */
+	uint64_t wait;	/* Nanoseconds waiting on input and output */
+	uint64_t busy;	/* Nanoseconds compressing */
+	uint64_t used[LZJODY_LEVEL_MAX + 1];	/* Blocks compressed at each level */
+};
+
 /* Number of LZJODY_BSIZE blocks to process per thread */
 #define CHUNK 1024
 
+/* A batch of compressed blocks for integrity testing (-t) */
+struct test_batch {
+	unsigned char data[(LZJODY_CBSIZE + 2) * CHUNK];	/* Prefixed blocks */
+	int length;	/* Bytes used in data */
+	int blocks;	/* Number of blocks in data */
+	int first;	/* Stream block number of the first block */
+	int checksums;	/* Blocks that carried a checksum */
+	int error;	/* Nonzero if a block failed */
+	const struct lzjody_ref *ref;	/* Reference image (--ref) or NULL */
+#ifdef THREADED
+	pthread_t id;	/* Thread ID */
+	int busy;	/* Is a thread testing this batch? */
+#endif
+};
+
 #ifdef THREADED
 /* Per-thread working state */
 struct thread_info {
 	unsigned char blk[LZJODY_BSIZE * CHUNK];	/* Thread input blocks */
-	unsigned char out[(LZJODY_BSIZE + 4) * CHUNK];	/* Thread output blocks */
-	char options;	/* Compressor options */
+	unsigned char out[LZJODY_CBSIZE * CHUNK];	/* Thread output blocks */
+	unsigned int options;	/* Compressor options */
+	struct lzjody_ctx *ctx;	/* Per-thread compression context */
+	struct lzjody_stats stats;	/* Per-thread statistics */
 	pthread_t id;	/* Thread ID */
 	int block;	/* What block is thread working on? */
 	int length;	/* Total bytes in block */
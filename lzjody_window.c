@@ -0,0 +1,181 @@
+/*
+ * Lempel-Ziv-JodyBruchon compression library
+ * Long-distance matching against earlier blocks of a stream
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ *
+ * A window keeps the last LZJODY_WINDOW_SIZE bytes of a stream in a ring
+ * buffer so that a block can refer to data far beyond its own 4 KiB.
+ * The compressor runs a gear rolling hash over the stream; positions
+ * where the top hash bits are zero are anchors, and the latest stream
+ * position of each anchor hash is kept in a table. The hash only depends
+ * on the last 32 bytes, so any repeat of WINDOW_MIN_MATCH bytes almost
+ * always contains an anchor that both copies share. Each anchor in a new
+ * block is looked up, checked against the ring and extended both ways.
+ * The decompressor only needs the ring.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "lzjody_window.h"
+
+#define WINDOW_MASK (LZJODY_WINDOW_SIZE - 1)
+/* One position in 2^n is an anchor */
+#define WINDOW_ANCHOR_BITS 3
+#define WINDOW_IS_ANCHOR(h) (((h) >> (32 - WINDOW_ANCHOR_BITS)) == 0)
+
+static inline unsigned int window_slot(const uint32_t h)
+{
+	return (unsigned int)((h * 2654435761U) >> (32 - WINDOW_HASH_BITS));
+}
+
+
+/* Allocate an empty window */
+extern struct lzjody_window *lzjody_window_new(void)
+{
+	struct lzjody_window *w;
+	uint32_t x = 0x2545f491;
+	int i;
+
+	w = (struct lzjody_window *)calloc(1, sizeof(struct lzjody_window));
+	if (!w) goto error_oom;
+	w->ring = (unsigned char *)malloc(LZJODY_WINDOW_SIZE);
+	if (!w->ring) goto error_oom_free;
+	/* Any fixed random values do; both sides never exchange them */
+	for (i = 0; i < 256; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		w->gear[i] = x;
+	}
+	return w;
+
+error_oom_free:
+	free(w);
+error_oom:
+	fprintf(stderr, "liblzjody: out of memory allocating a stream window\n");
+	return NULL;
+}
+
+
+extern void lzjody_window_free(struct lzjody_window * const w)
+{
+	if (!w) return;
+	free(w->table);
+	free(w->ring);
+	free(w);
+	return;
+}
+
+
+/* Allocate the anchor table the first time a compressor uses a window */
+extern int window_alloc_table(struct lzjody_window * const w)
+{
+	if (w->table) return 0;
+	w->table = (uint32_t *)calloc((size_t)1 << WINDOW_HASH_BITS, sizeof(uint32_t));
+	if (!w->table) goto error_oom;
+	return 0;
+
+error_oom:
+	fprintf(stderr, "liblzjody: out of memory allocating a window hash table\n");
+	return -1;
+}
+
+
+/* Find matches of at least WINDOW_MIN_MATCH bytes between a block and
+ * the window, in block order and not overlapping. A match source always
+ * ends before the block starts. Returns the number of matches. */
+extern unsigned int window_find(const struct lzjody_window * const restrict w,
+		const unsigned char * const restrict blk, const unsigned int length,
+		struct window_match_t * const restrict m)
+{
+	const unsigned char * const ring = w->ring;
+	const uint64_t base = w->pos;
+	/* Oldest source the 24-bit distance can reach */
+	const uint64_t lo = (base >= WINDOW_MASK) ? base - WINDOW_MASK : 0;
+	uint64_t here, src;
+	uint32_t h = w->hash, dist;
+	unsigned int i, j, n = 0, done = 0, back, fwd;
+
+	if (!w->table || (length < WINDOW_MIN_MATCH)) return 0;
+	for (i = 0; i < length; i++) {
+		h = (h << 1) + w->gear[blk[i]];
+		if ((i < done) || !WINDOW_IS_ANCHOR(h)) continue;
+
+		/* The table holds the low 32 bits of positions; whatever
+		 * the bytes at that distance are, they are checked below */
+		here = base + i;
+		dist = (uint32_t)here - w->table[window_slot(h)];
+		if ((dist <= i) || (dist > here - lo)) continue;
+		src = here - dist;
+		if (ring[src & WINDOW_MASK] != blk[i]) continue;
+
+		for (fwd = 1; (i + fwd < length) && (src + fwd < base)
+				&& (ring[(src + fwd) & WINDOW_MASK] == blk[i + fwd]); fwd++);
+		for (back = 0; (i - back > done) && (src - back > lo)
+				&& (ring[(src - back - 1) & WINDOW_MASK] == blk[i - back - 1]); back++);
+		if (back + fwd < WINDOW_MIN_MATCH) continue;
+
+		/* Runs of one byte value are cheaper as RLE; skip past them,
+		 * where the hash often stays on an anchor for every byte */
+		done = i + fwd;
+		for (j = i - back + 1; (j < done) && (blk[j] == blk[i - back]); j++);
+		if (j == done) continue;
+
+		m[n].start = (uint16_t)(i - back);
+		m[n].length = (uint16_t)(back + fwd);
+		m[n].dist = (uint32_t)(base - (src - back));
+		n++;
+	}
+	return n;
+}
+
+
+/* Add a block to the end of the window, indexing its anchors if the
+ * window has a table */
+extern void window_append(struct lzjody_window * const restrict w,
+		const unsigned char * const restrict data, const unsigned int length)
+{
+	const unsigned int start = (unsigned int)(w->pos & WINDOW_MASK);
+	const unsigned int first = LZJODY_WINDOW_SIZE - start;
+	uint32_t h = w->hash;
+	unsigned int i;
+
+	if (w->table) {
+		for (i = 0; i < length; i++) {
+			h = (h << 1) + w->gear[data[i]];
+			if (WINDOW_IS_ANCHOR(h)) w->table[window_slot(h)] = (uint32_t)(w->pos + i);
+		}
+		w->hash = h;
+	}
+	if (length <= first) memcpy(w->ring + start, data, length);
+	else {
+		memcpy(w->ring + start, data, first);
+		memcpy(w->ring, data + first, length - first);
+	}
+	w->pos += length;
+	return;
+}
+
+
+/* Copy length bytes that start dist bytes before the end of the window
+ * Returns -1 if they aren't all in the window */
+extern int window_copy(const struct lzjody_window * const restrict w,
+		const unsigned int dist, const unsigned int length,
+		unsigned char * const restrict out)
+{
+	unsigned int start, first;
+
+	if ((dist < length) || (dist > WINDOW_MASK) || (dist > w->pos)) return -1;
+	start = (unsigned int)((w->pos - dist) & WINDOW_MASK);
+	first = LZJODY_WINDOW_SIZE - start;
+	if (length <= first) memcpy(out, w->ring + start, length);
+	else {
+		memcpy(out, w->ring + start, first);
+		memcpy(out + first, w->ring, length - first);
+	}
+	return 0;
+}
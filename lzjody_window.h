@@ -0,0 +1,48 @@
+/*
+ * Long-distance matching against earlier blocks of a stream
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ *
+ * See lzjody_window.c for more information.
+ */
+
+#ifndef LZJODY_WINDOW_H
+#define LZJODY_WINDOW_H
+
+#include <stdint.h>
+#include "lzjody.h"
+
+/* Shortest match worth a far reference */
+#define WINDOW_MIN_MATCH 64
+/* Most far matches one block can hold */
+#define WINDOW_MAX_MATCHES (LZJODY_BSIZE / WINDOW_MIN_MATCH)
+/* Anchor hash table size (compressor only) */
+#define WINDOW_HASH_BITS 20
+
+struct lzjody_window {
+	unsigned char *ring;	/* Last LZJODY_WINDOW_SIZE bytes of the stream */
+	uint64_t pos;	/* Stream bytes seen so far */
+	uint32_t *table;	/* Stream position of the latest anchor per hash, or NULL */
+	uint32_t hash;	/* Rolling hash at the end of the stream */
+	uint32_t gear[256];	/* Rolling hash byte values */
+};
+
+/* One match of a block against the window: block bytes start to
+ * start + length - 1 equal the stream bytes that start dist bytes
+ * before the block */
+struct window_match_t {
+	uint16_t start;
+	uint16_t length;
+	uint32_t dist;
+};
+
+extern int window_alloc_table(struct lzjody_window * const);
+extern unsigned int window_find(const struct lzjody_window * const restrict,
+		const unsigned char * const restrict, const unsigned int,
+		struct window_match_t * const restrict);
+extern void window_append(struct lzjody_window * const restrict,
+		const unsigned char * const restrict, const unsigned int);
+extern int window_copy(const struct lzjody_window * const restrict,
+		const unsigned int, const unsigned int, unsigned char * const restrict);
+
+#endif	/* LZJODY_WINDOW_H */
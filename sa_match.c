@@ -0,0 +1,150 @@
+/*
+ * Suffix array longest previous match finder
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ *
+ * For every position of a block this computes the longest match that
+ * starts at an earlier position (the "longest previous factor") and where
+ * it starts. The suffix array is built by prefix doubling with counting
+ * sorts, the LCP array with Kasai's algorithm, and the matches with one
+ * stack pass in each direction over the suffix array: the best earlier
+ * match for a suffix is always its nearest neighbor in suffix array order
+ * that starts earlier in the text, on one side or the other. Everything is
+ * linear except the O(n log n) sort, which is cheap for one block.
+ * Matches may overlap the position they are found for, like LZ matches.
+ */
+
+#include <stdint.h>
+#include "sa_match.h"
+
+/* Build the suffix array and its inverse */
+static void build_sa(struct sa_match_t * const restrict m,
+		const unsigned char * const restrict s, const unsigned int n)
+{
+	uint16_t * const sa = m->sa;
+	uint16_t * const rank = m->rank;
+	uint16_t * const tmp = m->tmp;
+	uint16_t * const cnt = m->cnt;
+	unsigned int i, r, p, k, classes, prev, cur;
+	int a1, a2;
+
+	/* Sort by first byte */
+	for (i = 0; i < 256; i++) cnt[i] = 0;
+	for (i = 0; i < n; i++) cnt[s[i]]++;
+	for (i = 1; i < 256; i++) cnt[i] += cnt[i - 1];
+	for (i = n; i > 0; i--) sa[--cnt[s[i - 1]]] = (uint16_t)(i - 1);
+	rank[sa[0]] = 0;
+	for (r = 1; r < n; r++)
+		rank[sa[r]] = (uint16_t)(rank[sa[r - 1]] + (s[sa[r]] != s[sa[r - 1]]));
+
+	/* Double the sorted prefix length until all ranks are distinct */
+	for (k = 1; rank[sa[n - 1]] < (n - 1); k <<= 1) {
+		/* Order by second key: suffixes too short for one go first */
+		p = 0;
+		for (i = n - k; i < n; i++) tmp[p++] = (uint16_t)i;
+		for (r = 0; r < n; r++) if (sa[r] >= k) tmp[p++] = (uint16_t)(sa[r] - k);
+
+		/* Stable counting sort by first key */
+		classes = rank[sa[n - 1]] + 1U;
+		for (i = 0; i < classes; i++) cnt[i] = 0;
+		for (i = 0; i < n; i++) cnt[rank[i]]++;
+		for (i = 1; i < classes; i++) cnt[i] += cnt[i - 1];
+		for (p = n; p > 0; p--) sa[--cnt[rank[tmp[p - 1]]]] = tmp[p - 1];
+
+		/* Re-rank by (first key, second key) pairs */
+		tmp[sa[0]] = 0;
+		for (r = 1; r < n; r++) {
+			prev = sa[r - 1];
+			cur = sa[r];
+			a1 = (prev + k < n) ? rank[prev + k] : -1;
+			a2 = (cur + k < n) ? rank[cur + k] : -1;
+			tmp[cur] = (uint16_t)(tmp[prev] + ((rank[prev] != rank[cur]) || (a1 != a2)));
+		}
+		for (i = 0; i < n; i++) rank[i] = tmp[i];
+	}
+	return;
+}
+
+/* Kasai's LCP construction */
+static void build_lcp(struct sa_match_t * const restrict m,
+		const unsigned char * const restrict s, const unsigned int n)
+{
+	unsigned int i, j, h = 0;
+
+	m->lcp[0] = 0;
+	for (i = 0; i < n; i++) {
+		if (m->rank[i] == 0) {
+			h = 0;
+			continue;
+		}
+		j = m->sa[m->rank[i] - 1];
+		while ((i + h < n) && (j + h < n) && (s[i + h] == s[j + h])) h++;
+		m->lcp[m->rank[i]] = (uint16_t)h;
+		if (h > 0) h--;
+	}
+	return;
+}
+
+/* Record a candidate match, preferring longer and then earlier sources */
+static inline void offer(struct sa_match_t * const restrict m,
+		const unsigned int i, const unsigned int len, const unsigned int src)
+{
+	if ((len > m->len[i]) || ((len == m->len[i]) && (len > 0) && (src < m->pos[i]))) {
+		m->len[i] = (uint16_t)len;
+		m->pos[i] = (uint16_t)src;
+	}
+	return;
+}
+
+/* Compute the longest previous match for every position of s */
+extern void sa_match_build(struct sa_match_t * const restrict m,
+		const unsigned char * const restrict s, const unsigned int n)
+{
+	unsigned int r, top, cur, h;
+
+	if (n == 0) return;
+	build_sa(m, s, n);
+	build_lcp(m, s, n);
+	for (r = 0; r < n; r++) m->len[r] = 0;
+
+	/* Left to right: nearest earlier-ranked suffix that starts earlier.
+	 * stk_lcp[k] is the LCP between stack entry k and the entry above it
+	 * (or the current suffix for the top entry). */
+	top = 0;
+	for (r = 0; r < n; r++) {
+		cur = m->sa[r];
+		if (top > 0) {
+			if (m->lcp[r] < m->stk_lcp[top - 1]) m->stk_lcp[top - 1] = m->lcp[r];
+			while ((top > 0) && (m->stk_pos[top - 1] > cur)) {
+				h = m->stk_lcp[top - 1];
+				top--;
+				if ((top > 0) && (h < m->stk_lcp[top - 1])) m->stk_lcp[top - 1] = (uint16_t)h;
+			}
+			if (top > 0) offer(m, cur, m->stk_lcp[top - 1], m->stk_pos[top - 1]);
+		}
+		m->stk_pos[top] = (uint16_t)cur;
+		m->stk_lcp[top] = UINT16_MAX;
+		top++;
+	}
+
+	/* Right to left: nearest later-ranked suffix that starts earlier */
+	top = 0;
+	for (r = n; r > 0; r--) {
+		cur = m->sa[r - 1];
+		if (top > 0) {
+			/* lcp[r] links sa[r - 1] and sa[r] */
+			if (m->lcp[r] < m->stk_lcp[top - 1]) m->stk_lcp[top - 1] = m->lcp[r];
+			while ((top > 0) && (m->stk_pos[top - 1] > cur)) {
+				h = m->stk_lcp[top - 1];
+				top--;
+				if ((top > 0) && (h < m->stk_lcp[top - 1])) m->stk_lcp[top - 1] = (uint16_t)h;
+			}
+			if (top > 0) offer(m, cur, m->stk_lcp[top - 1], m->stk_pos[top - 1]);
+		}
+		m->stk_pos[top] = (uint16_t)cur;
+		m->stk_lcp[top] = UINT16_MAX;
+		top++;
+	}
+	return;
+}
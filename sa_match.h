@@ -0,0 +1,31 @@
+/*
+ * Suffix array longest previous match finder
+ *
+ * Copyright (C) 2014-2020 by Jody Bruchon <jody@jodybruchon.com>
+ *
+ * See sa_match.c for more information.
+ */
+
+#ifndef SA_MATCH_H
+#define SA_MATCH_H
+
+#include <stdint.h>
+#include "lzjody.h"
+
+/* Working arrays and results for one block */
+struct sa_match_t {
+	uint16_t sa[LZJODY_BSIZE];	/* Suffix array */
+	uint16_t rank[LZJODY_BSIZE];	/* Inverse suffix array */
+	uint16_t tmp[LZJODY_BSIZE];	/* Sort/rank scratch */
+	uint16_t cnt[LZJODY_BSIZE + 1];	/* Counting sort buckets */
+	uint16_t lcp[LZJODY_BSIZE];	/* lcp[r] = LCP of suffixes sa[r - 1] and sa[r] */
+	uint16_t stk_pos[LZJODY_BSIZE];	/* PSV/NSV stack: text positions */
+	uint16_t stk_lcp[LZJODY_BSIZE];	/* PSV/NSV stack: LCP to the current suffix */
+	uint16_t len[LZJODY_BSIZE];	/* Longest earlier match for each position */
+	uint16_t pos[LZJODY_BSIZE];	/* ...and where that match starts */
+};
+
+extern void sa_match_build(struct sa_match_t * const restrict,
+		const unsigned char * const restrict, const unsigned int);
+
+#endif	/* SA_MATCH_H */
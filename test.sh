@@ -32,6 +32,123 @@ S1="$(sha1sum $IN | cut -d' ' -f1)"
 S2="$(sha1sum $OUT | cut -d' ' -f1)"
 test "$S1" != "$S2" && echo -e "\nCompressor/decompressor tests FAILED: mismatched hashes.\n" && clean_exit 1
 
+# Checksummed blocks and integrity testing
+echo -n "Testing block checksums...";
+$LZJODY -c -k < $IN > $COMP 2>log.test.checksum || clean_exit 1
+$LZJODY -t < $COMP 2>>log.test.checksum || { echo "FAILED"; clean_exit 1; }
+$LZJODY -d < $COMP 2>>log.test.checksum > $OUT || { echo "FAILED"; clean_exit 1; }
+S2="$(sha1sum $OUT | cut -d' ' -f1)"
+test "$S1" != "$S2" && echo "FAILED" && clean_exit 1
+# Flip one byte in the middle of the stream; -t must notice
+cp $COMP $TF
+printf '\101' | dd of=$TF bs=1 seek=30000 conv=notrunc 2>/dev/null
+$LZJODY -t < $TF 2>>log.test.checksum && echo "FAILED" && clean_exit 1
+echo "passed"
+
+# Huffman coded blocks
+echo -n "Testing Huffman coded blocks...";
+$LZJODY -c -e < $IN > $COMP 2>log.test.huffman || clean_exit 1
+$LZJODY -d < $COMP 2>>log.test.huffman > $OUT || { echo "FAILED"; clean_exit 1; }
+S2="$(sha1sum $OUT | cut -d' ' -f1)"
+test "$S1" != "$S2" && echo "FAILED" && clean_exit 1
+echo "passed"
+
+# Split stream blocks
+echo -n "Testing split stream blocks...";
+$LZJODY -c -s < $IN > $COMP 2>log.test.split || clean_exit 1
+$LZJODY -d < $COMP 2>>log.test.split > $OUT || { echo "FAILED"; clean_exit 1; }
+S2="$(sha1sum $OUT | cut -d' ' -f1)"
+test "$S1" != "$S2" && echo "FAILED" && clean_exit 1
+echo "passed"
+
+# Long-distance matches: the second copy of the input refers to the first
+echo -n "Testing long-distance matching...";
+cat $IN $IN > $TF
+$LZJODY -c -l < $TF > $COMP 2>log.test.far || clean_exit 1
+$LZJODY -t -l < $COMP 2>>log.test.far || { echo "FAILED"; clean_exit 1; }
+$LZJODY -t < $COMP 2>>log.test.far && echo "FAILED" && clean_exit 1
+$LZJODY -d < $COMP 2>>log.test.far >/dev/null && echo "FAILED" && clean_exit 1
+$LZJODY -d -l < $COMP 2>>log.test.far > $OUT || { echo "FAILED"; clean_exit 1; }
+S2="$(sha1sum $OUT | cut -d' ' -f1)"
+S3="$(sha1sum $TF | cut -d' ' -f1)"
+test "$S3" != "$S2" && echo "FAILED" && clean_exit 1
+echo "passed"
+
+# Reference image deltas: a copy of the input with a few bytes inserted
+echo -n "Testing reference image deltas...";
+{ head -c 100000 $IN; echo -n "inserted"; tail -c +100001 $IN; } > $TF
+$LZJODY -c --ref $IN < $TF > $COMP 2>log.test.ref || clean_exit 1
+S2="$(wc -c < $COMP)"
+S3="$($LZJODY -c < $TF | wc -c)"
+test $((S2 * 20)) -gt $S3 && echo "FAILED" && clean_exit 1
+$LZJODY -t --ref $IN < $COMP 2>>log.test.ref || { echo "FAILED"; clean_exit 1; }
+$LZJODY -d < $COMP 2>>log.test.ref >/dev/null && echo "FAILED" && clean_exit 1
+$LZJODY -d --ref=$IN < $COMP 2>>log.test.ref > $OUT || { echo "FAILED"; clean_exit 1; }
+S2="$(sha1sum $OUT | cut -d' ' -f1)"
+S3="$(sha1sum $TF | cut -d' ' -f1)"
+test "$S3" != "$S2" && echo "FAILED" && clean_exit 1
+$LZJODY -r $COMP 200000 10000 --ref $IN 2>>log.test.ref > $OUT || { echo "FAILED"; clean_exit 1; }
+S2="$(sha1sum $OUT | cut -d' ' -f1)"
+S3="$(tail -c +200001 $TF | head -c 10000 | sha1sum | cut -d' ' -f1)"
+test "$S3" != "$S2" && echo "FAILED" && clean_exit 1
+echo "passed"
+
+# Multi-file batch mode
+echo -n "Testing multi-file batch mode...";
+TD="$(mktemp -d)"
+cp $IN "$TD/one"; head -c 10000 $IN > "$TD/two"; : > "$TD/three"
+$LZJODY -c "$TD/one" "$TD/two" "$TD/three" 2>log.test.batch || { echo "FAILED"; rm -rf "$TD"; clean_exit 1; }
+S2="$(sha1sum "$TD/one.lzj" | cut -d' ' -f1)"
+S3="$($LZJODY -c < $IN | sha1sum | cut -d' ' -f1)"
+test "$S3" != "$S2" && echo "FAILED" && rm -rf "$TD" && clean_exit 1
+mkdir "$TD/out"; mv "$TD"/*.lzj "$TD/out"
+ls "$TD"/out/*.lzj | $LZJODY -d -i - 2>>log.test.batch || { echo "FAILED"; rm -rf "$TD"; clean_exit 1; }
+for X in one two three
+	do cmp -s "$TD/$X" "$TD/out/$X" || { echo "FAILED"; rm -rf "$TD"; clean_exit 1; }
+done
+rm -rf "$TD"
+echo "passed"
+
+# Compression trace
+echo -n "Testing compression trace...";
+$LZJODY -c --trace=$TF < $IN > $OUT 2>log.test.trace || { echo "FAILED"; clean_exit 1; }
+S2="$(sha1sum $OUT | cut -d' ' -f1)"
+S3="$($LZJODY -c < $IN | sha1sum | cut -d' ' -f1)"
+test "$S3" != "$S2" && echo "FAILED" && clean_exit 1
+# A magic number and version, then 16-byte records
+test "$(head -c 4 $TF)" != "LZJT" && echo "FAILED" && clean_exit 1
+test $(( ($(wc -c < $TF) - 5) % 16 )) -ne 0 && echo "FAILED" && clean_exit 1
+test $(wc -c < $TF) -le 5 && echo "FAILED" && clean_exit 1
+echo "passed"
+
+# Fastest and smallest speed levels
+for L in 1 9
+	do echo -n "Testing speed level -$L...";
+	$LZJODY -c -$L < $IN > $COMP 2>log.test.level || clean_exit 1
+	$LZJODY -d < $COMP 2>>log.test.level > $OUT || { echo "FAILED"; clean_exit 1; }
+	S2="$(sha1sum $OUT | cut -d' ' -f1)"
+	test "$S1" != "$S2" && echo "FAILED" && clean_exit 1
+	echo "passed"
+done
+
+# Levels picked per block from read and write stalls
+echo -n "Testing adaptive levels...";
+$LZJODY -c -k --adapt < $IN > $COMP 2>log.test.adapt || clean_exit 1
+$LZJODY -t < $COMP 2>>log.test.adapt || { echo "FAILED"; clean_exit 1; }
+$LZJODY -d < $COMP 2>>log.test.adapt > $OUT || { echo "FAILED"; clean_exit 1; }
+S2="$(sha1sum $OUT | cut -d' ' -f1)"
+test "$S1" != "$S2" && echo "FAILED" && clean_exit 1
+echo "passed"
+
+# Random access reads
+echo -n "Testing random access reads...";
+$LZJODY -c < $IN > $COMP 2>log.test.read || clean_exit 1
+$LZJODY -r $COMP 5000 10000 2>>log.test.read > $OUT || { echo "FAILED"; clean_exit 1; }
+S2="$(sha1sum $OUT | cut -d' ' -f1)"
+S3="$(tail -c +5001 $IN | head -c 10000 | sha1sum | cut -d' ' -f1)"
+test "$S3" != "$S2" && echo "FAILED" && clean_exit 1
+echo "passed"
+
 
 ### Decompressor tests
 